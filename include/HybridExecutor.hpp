@@ -0,0 +1,45 @@
+#pragma once
+
+#include "VulkanContext.hpp"
+#include "gemm.hpp"
+#include <cstdint>
+
+// How the rows of one hybrid multiply were shared out
+struct SHybridReport {
+    uint32_t cpuRows      = 0;
+    uint32_t gpuRows      = 0;
+    size_t   cpuChunks    = 0;
+    size_t   gpuChunks    = 0;
+    // Time each side spent multiplying its chunks, excluding waits on the shared queue
+    double   cpuSeconds   = 0;
+    double   gpuSeconds   = 0;
+    double   cpuGflops    = 0;
+    double   gpuGflops    = 0;
+    double   totalSeconds = 0;
+};
+
+// Splits the rows of C between the OpenMP kernel and a Vulkan device in one multiply. Both sides claim row chunks
+// from a shared queue, the GPU from the top and the CPU from the bottom, so whichever side runs faster simply ends up
+// with more of the rows. Chunks are sized by the throughput measured on previous runs; without one, the first chunk
+// of each side is a short calibration. Measured throughput is kept per device and thread count across runs.
+class CHybridExecutor {
+  public:
+    CHybridExecutor(CVulkanContext& context, const NGemm::SBlockSizes& blocks);
+    ~CHybridExecutor();
+
+    // Same contract as NGemm::sgemm and CVulkanContext::sgemm
+    SHybridReport sgemm(uint32_t M, uint32_t N, uint32_t K, float alpha, const float* matrixA, uint32_t lda, const float* matrixB, uint32_t ldb, float beta, float* matrixC,
+                        uint32_t ldc);
+
+    // Running throughput estimates in GFLOP/s, zero until measured
+    double        cpuThroughput = 0;
+    double        gpuThroughput = 0;
+
+  private:
+    void               loadThroughput();
+    void               saveThroughput() const;
+
+    CVulkanContext&    context;
+    NGemm::SBlockSizes blocks;
+    int                threads = 0;
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "common.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <utility>
+
+namespace NCommon {
+    // Version 1 of the matrix file: this header, zero padding up to dataOffset, then the values. dataOffset is a
+    // multiple of MATRIX_FILE_ALIGNMENT so a mapping of the file hands out page aligned values. All fields are
+    // little endian.
+    constexpr char     MATRIX_FILE_MAGIC[8]    = {'C', 'A', 'B', '4', '0', '1', 'M', 'X'};
+    constexpr uint32_t MATRIX_FILE_VERSION     = 1;
+    constexpr size_t   MATRIX_FILE_ALIGNMENT   = 4096;
+    constexpr uint32_t MATRIX_DTYPE_FLOAT32    = 0;
+    // Rows stored one after the other with no padding in between
+    constexpr uint32_t MATRIX_LAYOUT_ROW_MAJOR = 0;
+
+    struct SMatrixFileHeader {
+        char     magic[8];
+        uint32_t version;
+        uint32_t dtype;
+        uint32_t layout;
+        uint32_t reserved;
+        uint64_t rows;
+        uint64_t cols;
+        uint64_t dataOffset;
+        uint64_t dataBytes;
+        // matrixChecksum of the values
+        uint64_t checksum;
+    };
+    static_assert(sizeof(SMatrixFileHeader) == 64, "The matrix file header is part of the on-disk format.");
+
+    // Order independent hash of the values and their positions, so it can be computed in parallel
+    uint64_t matrixChecksum(std::span<const float> values);
+
+    // A matrix file mapped into memory. Read-only mappings are shared with every other process mapping the same file
+    // and the values can go straight to the kernels; nothing is read until a page is touched.
+    class CMappedMatrix {
+      public:
+        // Throws when the file is not a matrix file of a supported version or does not hold the values its header
+        // describes. The checksum is only compared by verify, so opening stays cheap for large files.
+        static CMappedMatrix open(const std::filesystem::path& path, bool writable = false);
+        // Creates or truncates path for a rows x cols matrix and maps it writable, values start out as zero. The
+        // checksum is written by sync.
+        static CMappedMatrix create(const std::filesystem::path& path, size_t rows, size_t cols);
+
+        CMappedMatrix(CMappedMatrix&& other) noexcept;
+        CMappedMatrix& operator=(CMappedMatrix&& other) noexcept;
+        CMappedMatrix(const CMappedMatrix&)            = delete;
+        CMappedMatrix& operator=(const CMappedMatrix&) = delete;
+        ~CMappedMatrix();
+
+        const float*           data() const;
+        // Throws on read-only mappings
+        float*                 mutableData();
+        std::span<const float> values() const;
+
+        // Recomputes the checksum of the values and compares it with the header
+        bool                   verify() const;
+        // Stores the checksum of the current values in the header and flushes the mapping to the file
+        void                   sync();
+
+        // Readahead and release hints for the pages holding rows [first, last)
+        void                   prefetchRows(size_t first, size_t last) const;
+        void                   releaseRows(size_t first, size_t last) const;
+        // Faults in the pages holding rows [first, last), blocking until they are resident
+        void                   loadRows(size_t first, size_t last) const;
+        // Starts writeback of the pages holding rows [first, last) without waiting for it
+        void                   flushRows(size_t first, size_t last) const;
+
+        size_t                 rows     = 0;
+        size_t                 cols     = 0;
+        bool                   writable = false;
+
+      private:
+        CMappedMatrix() = default;
+        // Page aligned byte range [first, second) of the mapping holding rows [first, last). Widened to every page the
+        // rows touch, or with inside shrunk to the pages holding nothing but those rows.
+        std::pair<size_t, size_t> rowPages(size_t first, size_t last, bool inside = false) const;
+
+        SMatrixFileHeader*        header       = nullptr;
+        size_t                    mappingBytes = 0;
+    };
+
+    // Writes a rows x cols row-major matrix to path in the matrix file format
+    void writeMatrixFile(const std::filesystem::path& path, std::span<const float> values, size_t rows, size_t cols);
+
+    // A and B mapped from options.input, with options.m, n and k set to their shapes
+    struct SMappedInputs {
+        CMappedMatrix a;
+        CMappedMatrix b;
+    };
+    SMappedInputs mapInputs(SOptions& options);
+    // Writes A.bin, B.bin and C.bin of an M x N x K multiply to directory, creating it when needed
+    void          saveProblem(const std::filesystem::path& directory, std::span<const float> A, std::span<const float> B, std::span<const float> C, size_t M, size_t N,
+                              size_t K);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_raii.hpp>
+#include <map>
+#include <tuple>
+#include <vector>
+
+// Buffer bound to a sub-range of one of the pool's memory blocks
+struct SPooledBuffer {
+    vk::raii::Buffer        buffer     = nullptr;
+    vk::DeviceSize          size       = 0;
+    vk::BufferUsageFlags    usage      = {};
+    vk::MemoryPropertyFlags properties = {};
+    // Persistent mapping when the block is host visible, otherwise nullptr
+    void*                   mapped     = nullptr;
+    // Range of the memory block the buffer is bound to, given back when the buffer is destroyed
+    vk::DeviceMemory        memory     = nullptr;
+    vk::DeviceSize          offset     = 0;
+    vk::DeviceSize          footprint  = 0;
+};
+
+// Sub-allocates buffers out of a few large DeviceMemory blocks. Buffers are rounded up to a size class and handed
+// back to a per class free list on release, so steady state use never touches the allocator. Classes are powers of
+// two up to FINE_CLASSES and eighths of a power of two above, so a large matrix wastes at most an eighth of its size.
+// Released buffers beyond VULKAN_POOL_RETAIN_MB, 1024 MiB by default, are destroyed smallest first, and memory
+// blocks left without buffers are freed.
+class CVulkanBufferPool {
+  public:
+    static constexpr vk::DeviceSize MIN_CLASS    = vk::DeviceSize(64) << 10;
+    static constexpr vk::DeviceSize FINE_CLASSES = vk::DeviceSize(16) << 20;
+
+    // Buffers are shared concurrently between all given queue families when there is more than one
+    CVulkanBufferPool(const vk::raii::Device& device, const vk::raii::PhysicalDevice& physicalDevice, std::vector<uint32_t> queueFamilyIndices,
+                      vk::DeviceSize blockSize = vk::DeviceSize(256) << 20);
+
+    // Throws when the buffer is larger than maxStorageBufferRange or the memory heap it has to come from
+    SPooledBuffer         acquire(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties);
+    void                  release(SPooledBuffer&& buffer);
+    // Destroys every released buffer and frees the memory blocks that leaves empty
+    void                  trim();
+
+    // Size a buffer of size bytes is created with. A class the device could not bind as one storage buffer falls
+    // back to the exact size.
+    vk::DeviceSize        sizeClass(vk::DeviceSize size) const;
+    vk::DeviceSize        allocatedBytes() const;
+
+  private:
+    struct SMemoryBlock {
+        vk::raii::DeviceMemory memory     = nullptr;
+        vk::DeviceSize         size       = 0;
+        vk::DeviceSize         used       = 0;
+        uint32_t               memoryType = 0;
+        void*                  mapped     = nullptr;
+        // Buffers bound to the block, handed out or on a free list
+        size_t                 buffers    = 0;
+    };
+    using FreeListKey = std::tuple<vk::DeviceSize, VkBufferUsageFlags, VkMemoryPropertyFlags>;
+
+    uint32_t                                          findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties) const;
+    SMemoryBlock&                                     allocateBlock(vk::DeviceSize size, uint32_t memoryType);
+    // Unbinds the buffer from its block, handing the range back when it is the last one bump allocated
+    void                                              destroy(SPooledBuffer&& buffer);
+    void                                              freeEmptyBlocks();
+
+    const vk::raii::Device&                           device;
+    vk::PhysicalDeviceMemoryProperties                memoryProperties;
+    vk::DeviceSize                                    maxStorageBufferRange;
+    std::vector<uint32_t>                             queueFamilyIndices;
+    vk::DeviceSize                                    blockSize;
+    vk::DeviceSize                                    retainLimit;
+    // Footprint of the buffers on the free lists
+    vk::DeviceSize                                    retainedBytes = 0;
+
+    // Declared before the free lists so buffers are destroyed before the memory they are bound to
+    std::vector<SMemoryBlock>                         blocks;
+    std::map<FreeListKey, std::vector<SPooledBuffer>> freeLists;
+};
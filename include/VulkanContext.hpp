@@ -2,47 +2,277 @@
 
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_raii.hpp>
+#include "VulkanBufferPool.hpp"
+#include "precision.hpp"
+#include "matrix_chain.hpp"
 #include <array>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Push constants consumed by shaders/shader.comp, laid out to match its PushConstants block
+struct SGemmPushConstants {
+    uint32_t M;
+    uint32_t N;
+    uint32_t K;
+    uint32_t lda;
+    uint32_t ldb;
+    uint32_t ldc;
+    float    alpha;
+    float    beta;
+
+    bool     operator==(const SGemmPushConstants&) const = default;
+};
+
+// Specialization constants of shaders/shader.comp, in constant_id order
+struct SShaderConfig {
+    uint32_t            workgroupX = 16;
+    uint32_t            workgroupY = 16;
+    uint32_t            tileK      = 16;
+    uint32_t            threadM    = 4;
+    uint32_t            threadN    = 4;
+    // Picked per call from the inputs, never tuned or cached
+    NCommon::EPrecision storage    = NCommon::EPrecision::Float32;
+
+    uint32_t            tileM() const;
+    uint32_t            tileN() const;
+    std::string         toString() const;
+
+    auto                operator<=>(const SShaderConfig&) const = default;
+};
+
+// One problem of a batched multiply: C = alpha * A * B + beta * C, row-major with leading dimensions
+struct SGemmBatchProblem {
+    uint32_t     M;
+    uint32_t     N;
+    uint32_t     K;
+    float        alpha;
+    const float* A;
+    uint32_t     lda;
+    const float* B;
+    uint32_t     ldb;
+    float        beta;
+    float*       C;
+    uint32_t     ldc;
+};
+
+// Where the time of one Vulkan multiply went. Host spans are wall clock; GPU spans come from timestamp queries and
+// stay zero when the queue family has no timestamp support, or for transfers on unified memory.
+struct SGemmTiming {
+    // Slot lookup, plus buffer and descriptor allocation the first time a shape is seen
+    double acquireSeconds = 0;
+    // Host copies of A, B and C into mapped memory
+    double copyInSeconds  = 0;
+    // Command buffer recording, zero when the recorded buffers are reused
+    double recordSeconds  = 0;
+    // First submit until the fence signalled
+    double executeSeconds = 0;
+    double copyOutSeconds = 0;
+    double totalSeconds   = 0;
+
+    double gpuUploadSeconds   = 0;
+    double gpuDispatchSeconds = 0;
+    double gpuReadbackSeconds = 0;
+};
+
+// Host spans of CVulkanContext construction
+struct SContextTiming {
+    double instanceSeconds = 0;
+    // Physical device selection and logical device creation
+    double deviceSeconds   = 0;
+    // Shader module, pipeline layout, pipeline cache and the default pipeline
+    double pipelineSeconds = 0;
+    // Command pools, descriptor layout and pool, buffer pool
+    double resourceSeconds = 0;
+    double totalSeconds    = 0;
+};
 
 // Vulkan Context Object
 class CVulkanContext {
   public:
-    CVulkanContext(int matrix_size);
+    CVulkanContext();
     ~CVulkanContext();
 
-    std::vector<float> runComputeShader(float* matrixA, float* matrixB, size_t matrix_size);
+    // C = alpha * A * B + beta * C with A M x K, B K x N and C M x N, row-major with leading dimensions
+    SGemmTiming sgemm(uint32_t M, uint32_t N, uint32_t K, float alpha, const float* matrixA, uint32_t lda, const float* matrixB, uint32_t ldb, float beta, float* matrixC,
+                      uint32_t ldc);
+    // Mixed precision: A and B stay 16-bit through the upload and in device memory, halving their transfer and
+    // buffer sizes, and are widened by the shader as they are staged so accumulation and C remain fp32
+    SGemmTiming sgemm(uint32_t M, uint32_t N, uint32_t K, float alpha, const NCommon::SFloat16* matrixA, uint32_t lda, const NCommon::SFloat16* matrixB, uint32_t ldb,
+                      float beta, float* matrixC, uint32_t ldc);
+    SGemmTiming sgemm(uint32_t M, uint32_t N, uint32_t K, float alpha, const NCommon::SBFloat16* matrixA, uint32_t lda, const NCommon::SBFloat16* matrixB, uint32_t ldb,
+                      float beta, float* matrixC, uint32_t ldc);
+    SGemmTiming runComputeShader(const float* matrixA, const float* matrixB, float* matrixC, const SGemmPushConstants& params);
+    SGemmTiming runComputeShader(const float* matrixA, const float* matrixB, float* matrixC, const SGemmPushConstants& params, const SShaderConfig& config);
+    // Same contract as sgemm, but C is streamed through the device in bandRows x bandCols tiles. The upload of the next
+    // tile, the dispatch of the current one and the readback of the previous one overlap, so the matrices only have to
+    // fit in host memory. Zero band sizes are picked to fit the streaming buffers.
+    SGemmTiming sgemmStreamed(uint32_t M, uint32_t N, uint32_t K, float alpha, const float* matrixA, uint32_t lda, const float* matrixB, uint32_t ldb, float beta,
+                              float* matrixC, uint32_t ldc, uint32_t bandRows = 0, uint32_t bandCols = 0);
+    // Any number of independent problems, shapes free to differ, packed into shared buffers behind an offsets table and
+    // run in a single dispatch with one problem per z workgroup
+    SGemmTiming sgemmBatched(std::span<const SGemmBatchProblem> problems);
+    // Equal shaped batch where problem i reads A + i * strideA and B + i * strideB and writes C + i * strideC
+    SGemmTiming sgemmStridedBatched(uint32_t M, uint32_t N, uint32_t K, float alpha, const float* matrixA, uint32_t lda, size_t strideA, const float* matrixB, uint32_t ldb,
+                                    size_t strideB, float beta, float* matrixC, uint32_t ldc, size_t strideC, uint32_t batchCount);
+    // C = matrices[0] * matrices[1] * ... with matrix i dims[i] x dims[i + 1], all packed row-major, multiplied in the
+    // order NCommon::planChain picks. The inputs are uploaded once, intermediates never leave device buffers and the
+    // whole chain is one command buffer with a barrier between dispatches, so it costs one submit and one readback
+    // whatever its length. Repeating a chain of the same dimensions reuses the buffers and recorded commands.
+    SGemmTiming sgemmChain(std::span<const float* const> matrices, std::span<const size_t> dims, float* matrixC);
 
-    std::string        deviceName;
-    int                matrixSize;
+    // Times every valid shader configuration on this device for an M x N x K problem, keeps the fastest for that
+    // shape and appends it to the on-disk autotune cache
+    SShaderConfig autotune(uint32_t M, uint32_t N, uint32_t K, size_t repeats = 3);
+    // Tuned configuration for the shape, or the default one
+    SShaderConfig configFor(uint32_t M, uint32_t N, uint32_t K) const;
+
+    std::string           deviceName;
+    // Integrated and CPU devices share memory with the host, so buffers are mapped directly instead of staged
+    bool                  unifiedMemory    = false;
+    // Whether the compute queue supports timestamps, without them the SGemmTiming GPU spans stay zero
+    bool                  timestampQueries = false;
+    // Seconds from construction until the first dispatch finished, set by the first runComputeShader
+    std::optional<double> coldStartSeconds;
+    SContextTiming        initTiming;
 
   private:
-    void                                  createInstance();
-    void                                  pickPhysicalDevice();
-    void                                  createLogicalDevice();
-    void                                  createCommandPool();
-    void                                  createComputePipeline();
-    void                                  createDescriptorSetLayout();
-    void                                  createDescriptorPool();
-    void                                  createDescriptorSets();
-    void                                  createBuffers(float* matrixA, float* matrixB, float* matrixC, int matrix_size);
-    void                                  allocateBufferMemory(vk::raii::Buffer& buffer, vk::raii::DeviceMemory& bufferMemory, vk::MemoryPropertyFlags properties);
-    uint32_t                              findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties);
-
-    vk::raii::Context                     context;
-    vk::raii::Instance                    instance            = nullptr;
-    std::array<vk::raii::Buffer, 3>       buffers             = {nullptr, nullptr, nullptr};
-    std::array<vk::raii::DeviceMemory, 3> bufferMemories      = {nullptr, nullptr, nullptr};
-    vk::raii::Device                      device              = nullptr;
-    vk::raii::PhysicalDevice              physicalDevice      = nullptr;
-    vk::raii::Queue                       computeQueue        = nullptr;
-    vk::raii::CommandPool                 commandPool         = nullptr;
-    vk::raii::DescriptorSetLayout         descriptorSetLayout = nullptr;
-    vk::raii::Pipeline                    computePipeline     = nullptr;
-    vk::raii::ShaderModule                computeShaderModule = nullptr;
-    vk::raii::PipelineLayout              pipelineLayout      = nullptr;
-    vk::raii::DescriptorPool              descriptorPool      = nullptr;
-    vk::raii::CommandBuffer               commandBuffer       = nullptr;
-    vk::raii::DescriptorSet               descriptorSet       = nullptr;
-
-    uint32_t                              computeQueueFamilyIndex;
+    // Everything one problem shape needs, kept alive across calls so repeated multiplies only upload and submit.
+    // Staging buffers and the transfer command buffers stay empty on unified memory devices.
+    struct SGemmSlot {
+        std::array<SPooledBuffer, 3>      buffers;
+        std::array<SPooledBuffer, 3>      staging;
+        vk::raii::DescriptorSet           descriptorSet    = nullptr;
+        vk::raii::CommandBuffer           uploadCommands   = nullptr;
+        vk::raii::CommandBuffer           commandBuffer    = nullptr;
+        vk::raii::CommandBuffer           readbackCommands = nullptr;
+        vk::raii::Semaphore               uploadDone       = nullptr;
+        vk::raii::Semaphore               dispatchDone     = nullptr;
+        vk::raii::Fence                   fence            = nullptr;
+        // Begin and end timestamps of the upload, dispatch and readback, nullptr without timestamp support
+        vk::raii::QueryPool               timestamps       = nullptr;
+        std::optional<SGemmPushConstants> recordedParams;
+        SShaderConfig                     recordedConfig;
+        uint64_t                          lastUsed = 0;
+    };
+    // One entry of the streaming ring: buffers for an A band, a B band and a C tile, and the commands moving them
+    struct SStreamStage {
+        std::array<SPooledBuffer, 3> buffers;
+        std::array<SPooledBuffer, 3> staging;
+        vk::raii::DescriptorSet      descriptorSet    = nullptr;
+        vk::raii::CommandBuffer      uploadCommands   = nullptr;
+        vk::raii::CommandBuffer      commandBuffer    = nullptr;
+        vk::raii::CommandBuffer      readbackCommands = nullptr;
+    };
+    // Shared A, B, C and problem table buffers of sgemmBatched, grown on demand
+    struct SBatchSlot {
+        std::array<SPooledBuffer, 4> buffers;
+        std::array<SPooledBuffer, 4> staging;
+        vk::raii::DescriptorSet      descriptorSet = nullptr;
+        vk::raii::CommandBuffer      commandBuffer = nullptr;
+        vk::raii::Fence              fence         = nullptr;
+    };
+    // Inputs, intermediates and product of sgemmChain, with one descriptor set and dispatch per step of the plan.
+    // Scratch buffers are device local only, nothing but the shader ever touches them.
+    struct SChainSlot {
+        std::vector<size_t>                  dims;
+        NCommon::SChainPlan                  plan;
+        std::vector<SPooledBuffer>           inputs;
+        std::vector<SPooledBuffer>           inputStaging;
+        std::vector<SPooledBuffer>           scratch;
+        SPooledBuffer                        output;
+        SPooledBuffer                        outputStaging;
+        std::vector<vk::raii::DescriptorSet> descriptorSets;
+        vk::raii::CommandBuffer              commandBuffer = nullptr;
+        vk::raii::Fence                      fence         = nullptr;
+        // Begin and end of the dispatches, nullptr without timestamp support
+        vk::raii::QueryPool                  timestamps    = nullptr;
+        bool                                 recorded      = false;
+    };
+    // Size classes of the A, B and C buffers
+    using SlotKey                          = std::array<vk::DeviceSize, 3>;
+    using ShapeKey                         = std::array<uint32_t, 3>;
+    static constexpr uint32_t MAX_SLOTS    = 16;
+    // Tiles in flight while streaming: one uploading, one computing, one reading back
+    static constexpr uint32_t STREAM_DEPTH = 3;
+    // Longest chain sgemmChain takes, which sizes its share of the descriptor pool
+    static constexpr uint32_t MAX_CHAIN    = 16;
+
+    void                                        createInstance();
+    void                                        pickPhysicalDevice();
+    void                                        createLogicalDevice();
+    void                                        createCommandPool();
+    void                                        createShaderModule();
+    void                                        createPipelineLayout();
+    void                                        createPipelineCache();
+    void                                        savePipelineCache() const;
+    vk::raii::Pipeline                          createComputePipeline(const vk::raii::ShaderModule& shaderModule, const vk::raii::PipelineLayout& layout, const SShaderConfig& config);
+    const vk::raii::Pipeline&                   pipelineFor(const SShaderConfig& config);
+    const vk::raii::Pipeline&                   batchedPipelineFor(const SShaderConfig& config);
+    std::vector<SShaderConfig>                  candidateConfigs() const;
+    void                                        loadAutotuneCache();
+    void                                        createDescriptorSetLayout();
+    void                                        createDescriptorPool();
+    vk::raii::DescriptorSet                     bindBuffers(std::span<const vk::Buffer> buffers, const vk::raii::DescriptorSetLayout& layout);
+    vk::raii::DescriptorSet                     createBindings(std::span<SPooledBuffer> buffers, std::span<SPooledBuffer> staging, std::span<const vk::DeviceSize> sizes,
+                                                               const vk::raii::DescriptorSetLayout& layout, bool staged);
+    SGemmTiming                                 sgemmStored(uint32_t M, uint32_t N, uint32_t K, float alpha, const void* matrixA, uint32_t lda, const void* matrixB, uint32_t ldb,
+                                                            float beta, float* matrixC, uint32_t ldc, NCommon::EPrecision storage);
+    // runComputeShader for A and B held in config.storage
+    SGemmTiming                                 runGemm(const void* matrixA, const void* matrixB, float* matrixC, const SGemmPushConstants& params, const SShaderConfig& config);
+    SGemmSlot&                                  acquireSlot(const SGemmPushConstants& params, NCommon::EPrecision storage);
+    SBatchSlot&                                 acquireBatchSlot(const std::array<vk::DeviceSize, 4>& sizes);
+    SChainSlot&                                 acquireChainSlot(std::span<const size_t> dims);
+    void                                        releaseChainSlot();
+    void                                        recordChain(SChainSlot& slot);
+    void                                        recordGemm(const vk::raii::CommandBuffer& commandBuffer, const vk::raii::DescriptorSet& descriptorSet,
+                                                           const SGemmPushConstants& params, const SShaderConfig& config);
+    void                                        recordDispatch(SGemmSlot& slot, const SGemmPushConstants& params, const SShaderConfig& config);
+    void                                        recordTransfers(SGemmSlot& slot, const SGemmPushConstants& params, NCommon::EPrecision storage);
+    void*                                       hostPointer(SGemmSlot& slot, uint32_t binding);
+    std::pair<uint32_t, uint32_t>               streamBands(uint32_t M, uint32_t N, uint32_t K) const;
+    void                                        prepareStreamStages(const std::array<vk::DeviceSize, 3>& sizes);
+    void                                        recordStreamTile(SStreamStage& stage, const SGemmPushConstants& params, const SShaderConfig& config);
+
+    vk::raii::Context                           context;
+    vk::raii::Instance                          instance                   = nullptr;
+    vk::raii::Device                            device                     = nullptr;
+    vk::raii::PhysicalDevice                    physicalDevice             = nullptr;
+    vk::raii::Queue                             computeQueue               = nullptr;
+    vk::raii::Queue                             transferQueue              = nullptr;
+    vk::raii::CommandPool                       commandPool                = nullptr;
+    vk::raii::CommandPool                       transferCommandPool        = nullptr;
+    vk::raii::DescriptorSetLayout               descriptorSetLayout        = nullptr;
+    vk::raii::ShaderModule                      computeShaderModule        = nullptr;
+    vk::raii::PipelineLayout                    pipelineLayout             = nullptr;
+    vk::raii::DescriptorSetLayout               batchedDescriptorSetLayout = nullptr;
+    vk::raii::ShaderModule                      batchedShaderModule        = nullptr;
+    vk::raii::PipelineLayout                    batchedPipelineLayout      = nullptr;
+    vk::raii::PipelineCache                     pipelineCache              = nullptr;
+    std::filesystem::path                       pipelineCacheFile;
+    std::map<SShaderConfig, vk::raii::Pipeline> pipelines;
+    std::map<SShaderConfig, vk::raii::Pipeline> batchedPipelines;
+    std::map<ShapeKey, SShaderConfig>           tunedConfigs;
+    vk::raii::DescriptorPool                    descriptorPool             = nullptr;
+    std::unique_ptr<CVulkanBufferPool>          bufferPool;
+    std::map<SlotKey, SGemmSlot>                slots;
+    std::vector<SStreamStage>                   streamStages;
+    // Uploaded, computed and read back timelines of sgemmStreamed, each signalled by a single queue in tile order
+    std::array<vk::raii::Semaphore, 3>          streamTimelines            = {nullptr, nullptr, nullptr};
+    // Tiles streamed so far, the value every stream timeline has reached once the last call finished
+    uint64_t                                    streamTimelineValue        = 0;
+    std::optional<SBatchSlot>                   batchSlot;
+    std::optional<SChainSlot>                   chainSlot;
+    uint64_t                                    dispatchCount              = 0;
+    std::chrono::steady_clock::time_point       constructedAt;
+
+    uint32_t computeQueueFamilyIndex;
+    uint32_t transferQueueFamilyIndex;
+    uint32_t computeTimestampBits  = 0;
+    uint32_t transferTimestampBits = 0;
+    float    timestampPeriod       = 0.0f;
 };
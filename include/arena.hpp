@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace NCommon {
+    // Counters since the arena was created, for judging whether huge pages and reuse took effect
+    struct SArenaStats {
+        // Bytes currently mapped, whether handed out or cached
+        size_t mappedBytes       = 0;
+        // Bytes held on the free list, ready for the next request
+        size_t cachedBytes       = 0;
+        size_t freshBlocks       = 0;
+        size_t reusedBlocks      = 0;
+        // Fresh blocks backed by reserved huge pages, and by ordinary pages advised for transparent huge pages
+        size_t hugeTlbBlocks     = 0;
+        size_t transparentBlocks = 0;
+    };
+
+    // Process wide source of matrix and packing memory. Requests under BLOCK_THRESHOLD come from the heap aligned to a
+    // cache line. Larger ones are whole mmap mappings: from 2 MiB up they try MAP_HUGETLB first and otherwise get
+    // ordinary pages on a huge page boundary advised with MADV_HUGEPAGE. Released mappings stay on a free list for the
+    // next request they fit, so repeated multiplies of one size reuse memory that is already faulted in. Memory is
+    // never cleared: fresh pages read as zero and reused ones keep what was last written to them.
+    // ARENA_HUGEPAGES=0 turns huge pages off and ARENA_RETAIN_MB caps the free list, 1024 MiB by default.
+    class CArena {
+      public:
+        static constexpr size_t CACHE_LINE      = 64;
+        static constexpr size_t BLOCK_THRESHOLD = size_t(256) << 10;
+        static constexpr size_t HUGE_PAGE       = size_t(2) << 20;
+
+        // Never destroyed, so buffers with static storage can still release into it at exit
+        static CArena& instance();
+
+        // Cache line aligned below BLOCK_THRESHOLD, page aligned from there on. Throws std::bad_alloc.
+        void*          allocate(size_t bytes);
+        // bytes must be what was passed to allocate
+        void           release(void* block, size_t bytes) noexcept;
+        // Unmaps every cached block
+        void           trim();
+        SArenaStats    stats() const;
+
+      private:
+        CArena();
+
+        void*                             map(size_t bytes);
+        void                              unmap(void* block, size_t bytes) noexcept;
+
+        bool                              hugePages;
+        bool                              hugeTlbAvailable = true;
+        size_t                            pageSize;
+        size_t                            retainLimit;
+
+        mutable std::mutex                mutex;
+        // Cached mappings by size, and the mapped size of every block handed out
+        std::multimap<size_t, void*>      freeBlocks;
+        std::unordered_map<void*, size_t> liveBlocks;
+        SArenaStats                       counters;
+    };
+
+    // std::allocator replacement drawing from CArena. Elements are default initialised, so resizing does not write to
+    // the pages and whichever thread fills them first decides their NUMA node.
+    template <typename T>
+    struct SArenaAllocator {
+        using value_type = T;
+
+        SArenaAllocator() = default;
+        template <typename U>
+        SArenaAllocator(const SArenaAllocator<U>&) noexcept {}
+
+        T* allocate(size_t count) {
+            return static_cast<T*>(CArena::instance().allocate(count * sizeof(T)));
+        }
+        void deallocate(T* ptr, size_t count) noexcept {
+            CArena::instance().release(ptr, count * sizeof(T));
+        }
+
+        template <typename U>
+        void construct(U* ptr) noexcept(std::is_nothrow_default_constructible_v<U>) {
+            ::new (static_cast<void*>(ptr)) U;
+        }
+        template <typename U, typename... Args>
+        void construct(U* ptr, Args&&... args) {
+            ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+        }
+
+        template <typename U>
+        bool operator==(const SArenaAllocator<U>&) const noexcept {
+            return true;
+        }
+    };
+
+    // Storage for row-major fp32 matrices. Sizing one does not zero it, so anything read before it is written has to
+    // be filled explicitly.
+    using MatrixBuffer = std::vector<float, SArenaAllocator<float>>;
+}
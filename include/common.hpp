@@ -1,7 +1,74 @@
+#pragma once
+
+#include "arena.hpp"
+#include "precision.hpp"
+#include <cstdint>
 #include <vector>
 #include <string>
+#include <filesystem>
+#include <span>
+
 namespace NCommon {
-    constexpr size_t   MATRIX_SIZE = 1024;
-    std::vector<float> generateRandomMatrix(size_t size);
-    void               writeToBinary(std::vector<float>& matrix, std::string filename);
+    // SplitMix64 increment and finaliser, a bijection on 64 bit words with full avalanche
+    constexpr uint64_t GOLDEN_GAMMA = 0x9E3779B97F4A7C15ull;
+    constexpr uint64_t mix64(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+    // Problem shape for C (M x N) = A (M x K) * B (K x N), chosen on the command line
+    struct SOptions {
+        size_t                m               = 1024;
+        size_t                n               = 1024;
+        size_t                k               = 1024;
+        // Vulkan only: time the candidate shader configurations for this shape before running it
+        bool                  autotune        = false;
+        // Vulkan only: stream C through the device in bands, overlapping transfers with compute
+        bool                  stream          = false;
+        // Vulkan only: number of independent problems of this shape run as one batched dispatch
+        size_t                batch           = 1;
+        // CPU only: multiply with Strassen-Winograd down to this size, zero keeps the classical kernel
+        size_t                strassenCutover = 0;
+        // Inputs are generated from this seed for A and seed + 1 for B, identically on every machine and thread count
+        size_t                seed            = 1;
+        // Directory holding A.bin and B.bin from an earlier run, mapped instead of generating; sets m, n and k
+        std::filesystem::path input;
+        // Directory A.bin, B.bin and C.bin are written to after the multiply
+        std::filesystem::path output;
+        // CPU only: multiply out of core through the files in output within this many MiB, zero keeps it in memory
+        size_t                memoryBudget    = 0;
+        // Storage of A and B; products are still accumulated in fp32 and compared against an all fp32 run
+        EPrecision            precision       = EPrecision::Float32;
+        // Check the result with NCommon::verifyProduct and fail the run when it does not hold
+        bool                  verify          = false;
+        // CPU only: read hardware counters around the multiply and report IPC, memory traffic and a roofline position
+        bool                  perf            = false;
+        // OpenMP and Vulkan only: multiply a chain of generated matrices, matrix i chain[i] x chain[i + 1], in the
+        // cheapest order instead of A * B
+        std::vector<size_t>   chain;
+    };
+
+    // How far a result is from a reference computed another way
+    struct SErrorStats {
+        double maxAbsolute       = 0;
+        // Largest absolute error over the largest reference magnitude
+        double maxRelative       = 0;
+        // ||result - reference|| / ||reference|| in the Frobenius norm
+        double frobeniusRelative = 0;
+    };
+
+    // Accepts --size <n> for square problems, -m, -n, -k for rectangular ones --autotune, --stream, --batch <n>,
+    // --strassen <cutover>, --seed <n>, --input <directory>, --output <directory>, --budget <MiB>,
+    // --precision fp32|fp16|bf16, --verify, --perf and --chain <d0,d1,...>
+    SOptions           parseOptions(int argc, char** argv);
+    // Uniform values in [0, 1) from a counter-based generator: element i is a pure function of (seed, i), so the
+    // fill runs in parallel and the output is bit identical whatever the thread count or machine
+    MatrixBuffer       generateRandomMatrix(size_t rows, size_t cols, uint64_t seed);
+    // Fills already allocated memory, leaving its page placement alone
+    void               fillRandom(std::span<float> matrix, uint64_t seed);
+    void               printCorner(std::span<const float> matrix, size_t rows, size_t cols);
+    SErrorStats        compareMatrices(std::span<const float> result, std::span<const float> reference);
+    // Per-user cache directory for autotune results, pipeline caches and measured throughput, created on first use
+    std::filesystem::path cacheDirectory();
 }
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "arena.hpp"
+#include "precision.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Cache-blocked CPU SGEMM shared by the sequential and OpenMP programs. All matrices are row-major.
+namespace NGemm {
+    // Cache blocking parameters, loosely mapping to L1 (kc), L2 (mc) and L3 (nc)
+    struct SBlockSizes {
+        size_t mc = 64;
+        size_t kc = 256;
+        size_t nc = 4096;
+    };
+
+    // Defaults overridden by the GEMM_MC, GEMM_KC and GEMM_NC environment variables
+    SBlockSizes blockSizesFromEnv();
+    std::string toString(const SBlockSizes& blocks);
+
+    // Packed panels and matrices come from NCommon::CArena: cache line aligned, huge pages for large buffers, never
+    // zeroed, and reused by the next multiply of the same size
+    using AlignedBuffer = NCommon::MatrixBuffer;
+
+    // B (K x N, row-major) copied once into kc x NR micro-panels in the order the kernel consumes them.
+    // Panels are zero padded to a whole NR, so one packed B can be multiplied by any number of A's.
+    // A B stored as fp16 or bf16 is widened while packing, the panels are always fp32.
+    class CPackedB {
+      public:
+        CPackedB(const float* matrixB, size_t rows, size_t cols, size_t ldb, const SBlockSizes& blocks, bool parallel);
+        CPackedB(const NCommon::SFloat16* matrixB, size_t rows, size_t cols, size_t ldb, const SBlockSizes& blocks, bool parallel);
+        CPackedB(const NCommon::SBFloat16* matrixB, size_t rows, size_t cols, size_t ldb, const SBlockSizes& blocks, bool parallel);
+        // Packs sequentially into caller-owned, 64 byte aligned storage of at least floats(rows, cols)
+        CPackedB(const float* matrixB, size_t rows, size_t cols, size_t ldb, const SBlockSizes& blocks, float* storage);
+        CPackedB(const CPackedB&)            = delete;
+        CPackedB& operator=(const CPackedB&) = delete;
+
+        // Floats the panels of a rows x cols B take with the active micro-kernel
+        static size_t floats(size_t rows, size_t cols);
+
+        // Panel holding rows [pc, pc + kc) and columns [jr, jr + NR) of B
+        const float*  panel(size_t pc, size_t jr) const;
+
+        size_t        rows;
+        size_t        cols;
+        size_t        paddedCols;
+        size_t        nr;
+        SBlockSizes   blocks;
+
+      private:
+        CPackedB(size_t rows, size_t cols, const SBlockSizes& blocks, float* storage);
+        template <typename T>
+        void          pack(const T* matrixB, size_t ldb, bool parallel);
+
+        AlignedBuffer data;
+        float*        panels;
+    };
+
+    // Packing space a sequential sgemm otherwise allocates on every call, for callers that multiply many small blocks
+    // such as CStrassen's leaves. Both pointers have to be 64 byte aligned, packedB sized by CPackedB::floats and
+    // packedA by packedAFloats.
+    struct SGemmWorkspace {
+        float* packedA = nullptr;
+        float* packedB = nullptr;
+    };
+    size_t packedAFloats(const SBlockSizes& blocks);
+
+    // C = alpha * A * B + beta * C with A M x K, B K x N and C M x N, BLAS style. C is not read when beta is zero.
+    // When parallel is set packing and the row blocks are split across OpenMP threads.
+    void sgemm(size_t M, size_t N, size_t K, float alpha, const float* A, size_t lda, const float* B, size_t ldb, float beta, float* C, size_t ldc, const SBlockSizes& blocks,
+               bool parallel);
+    void sgemm(size_t M, size_t N, size_t K, float alpha, const float* A, size_t lda, const CPackedB& B, float beta, float* C, size_t ldc, bool parallel);
+    // Sequential, packing into the workspace instead of allocating
+    void sgemm(size_t M, size_t N, size_t K, float alpha, const float* A, size_t lda, const float* B, size_t ldb, float beta, float* C, size_t ldc, const SBlockSizes& blocks,
+               const SGemmWorkspace& workspace);
+    // Mixed precision: A and B stored as fp16 or bf16 are widened as they are packed, so the micro-kernels accumulate
+    // and C is written in fp32 exactly as above. Only the rounding of the inputs to 16 bits is lost.
+    void sgemm(size_t M, size_t N, size_t K, float alpha, const NCommon::SFloat16* A, size_t lda, const NCommon::SFloat16* B, size_t ldb, float beta, float* C, size_t ldc,
+               const SBlockSizes& blocks, bool parallel);
+    void sgemm(size_t M, size_t N, size_t K, float alpha, const NCommon::SBFloat16* A, size_t lda, const NCommon::SBFloat16* B, size_t ldb, float beta, float* C, size_t ldc,
+               const SBlockSizes& blocks, bool parallel);
+    void sgemm(size_t M, size_t N, size_t K, float alpha, const NCommon::SFloat16* A, size_t lda, const CPackedB& B, float beta, float* C, size_t ldc, bool parallel);
+    void sgemm(size_t M, size_t N, size_t K, float alpha, const NCommon::SBFloat16* A, size_t lda, const CPackedB& B, float beta, float* C, size_t ldc, bool parallel);
+
+    // Uninitialised rows x cols matrix whose pages are first touched by the OpenMP thread that owns those rows in
+    // sgemm's tile schedule, so on NUMA machines A and C rows live on the node of the thread computing them. A block
+    // the arena hands out again keeps the placement it got the first time.
+    AlignedBuffer allocateMatrix(size_t rows, size_t cols, const SBlockSizes& blocks);
+
+    // OpenMP thread count, binding policy and the CPU each thread runs on
+    std::string   affinityReport();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "gemm.hpp"
+#include "matrix_chain.hpp"
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace NGemm {
+    // Product of several matrices in the order NCommon::planChain picks, each step a blocked sgemm. Intermediates live
+    // in scratch buffers that are reused within the chain as soon as their value has been consumed, and kept for later
+    // chains, so a repeated chain allocates nothing after the first.
+    class CMatrixChain {
+      public:
+        explicit CMatrixChain(const SBlockSizes& blocks);
+
+        // C = matrices[0] * matrices[1] * ... with matrix i dims[i] x dims[i + 1], all packed row-major. C is
+        // dims.front() x dims.back() and never read.
+        void                multiply(std::span<const float* const> matrices, std::span<const size_t> dims, float* C, bool parallel);
+
+        // Order and scratch layout of the last multiply
+        NCommon::SChainPlan plan;
+        size_t              scratchBytes = 0;
+
+      private:
+        SBlockSizes                blocks;
+        std::vector<AlignedBuffer> scratch;
+    };
+}
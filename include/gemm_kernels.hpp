@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Register-blocked micro-kernels for NGemm, selected at runtime through CPUID
+namespace NGemm {
+    // Largest register tile of any micro-kernel, used to size edge tile scratch space
+    constexpr size_t MAX_MR = 8;
+    constexpr size_t MAX_NR = 32;
+
+    // Computes C = A * B + beta * C for a full mr x nr tile over a kc deep slice. a is a packed kc x mr panel of A
+    // (column by column) and b a packed kc x nr panel of B (row by row). C is not read when beta is zero.
+    using MicroKernelFn = void (*)(size_t kc, const float* a, const float* b, float* c, size_t ldc, float beta);
+
+    struct SMicroKernel {
+        const char*   name;
+        size_t        mr;
+        size_t        nr;
+        MicroKernelFn run;
+        // Peak fp32 FLOP per cycle on one core: vector lanes times two for the multiply-add, times two FMA pipes from
+        // AVX2 on. Parts with a single AVX-512 pipe reach half, PERF_PEAK_GFLOPS overrides the resulting roof.
+        double        flopsPerCycle;
+    };
+
+    // Portable reference kernel, always available
+    const SMicroKernel&       scalarKernel();
+
+    // Every kernel this CPU can run, widest last
+    std::vector<SMicroKernel> availableKernels();
+
+    // Widest supported kernel, or the one named by the GEMM_KERNEL environment variable. Chosen once per process.
+    const SMicroKernel&       activeKernel();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "MatrixFile.hpp"
+#include "gemm.hpp"
+#include <cstddef>
+
+namespace NGemm {
+    // How an out-of-core multiply was cut up and where its time went
+    struct SOutOfCoreReport {
+        size_t bandRows       = 0;
+        size_t bandCols       = 0;
+        size_t rowBands       = 0;
+        size_t colBands       = 0;
+        double packSeconds    = 0;
+        double computeSeconds = 0;
+        // Time the kernel sat waiting for the I/O thread to bring the next band in
+        double ioWaitSeconds  = 0;
+        double totalSeconds   = 0;
+    };
+
+    // C = A * B over matrix files that need not fit in memory. B is packed one column band at a time and A and C are
+    // streamed through in row bands, all sized so that the packed band plus two bands each of A and C stay within
+    // memoryBudget bytes. While the kernel works on one row band an I/O thread faults in the next, and finished bands
+    // are handed to writeback and dropped from the mapping. C's checksum is stored at the end.
+    SOutOfCoreReport sgemmOutOfCore(const NCommon::CMappedMatrix& A, const NCommon::CMappedMatrix& B, NCommon::CMappedMatrix& C, size_t memoryBudget,
+                                    const SBlockSizes& blocks);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <span>
+#include <string>
+#include <vector>
+
+// Evaluation order for a product of several matrices, shared by the CPU and Vulkan chain multiplies
+namespace NCommon {
+    // One multiply of the chosen order: result = left * right, M x K times K x N
+    struct SChainStep {
+        // Operand i < count is input matrix i, count + s is the result of step s
+        size_t left;
+        size_t right;
+        size_t M;
+        size_t N;
+        size_t K;
+        // Scratch buffer the result goes to, OUTPUT for the last step which writes the caller's matrix
+        size_t buffer;
+    };
+
+    struct SChainPlan {
+        static constexpr size_t OUTPUT = std::numeric_limits<size_t>::max();
+
+        // In execution order, every operand is ready before the step that reads it
+        std::vector<SChainStep> steps;
+        // Floats each scratch buffer has to hold. Buffers are reused once the intermediate in them has been consumed,
+        // so there are usually far fewer of them than steps.
+        std::vector<size_t>     bufferFloats;
+        // Multiply-adds of the chosen order and of plain left to right evaluation
+        double                  cost            = 0;
+        double                  leftToRightCost = 0;
+        // Fully parenthesised, inputs named M0, M1, ...
+        std::string             order;
+    };
+
+    // Matrix i of the chain is dims[i] x dims[i + 1]. Picks the order with the fewest multiply-adds by the classic
+    // O(n^3) dynamic programme over split points, then assigns every intermediate a scratch buffer. Throws for fewer
+    // than two matrices.
+    SChainPlan planChain(std::span<const size_t> dims);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Hardware performance counters through Linux perf_event_open, for telling compute bound kernels from memory bound ones
+namespace NCommon {
+    enum class ECounter : uint32_t {
+        Cycles       = 0,
+        Instructions = 1,
+        L1dMisses    = 2,
+        LlcMisses    = 3,
+        DtlbMisses   = 4,
+    };
+    constexpr size_t COUNTER_COUNT = 5;
+    const char*      toString(ECounter counter);
+
+    // Counts of one thread or the sum over threads. A counter the kernel or the CPU does not provide, or that never got
+    // scheduled onto the PMU, stays empty. Multiplexed counters are scaled up to the time they were enabled.
+    struct SCounterValues {
+        std::array<std::optional<uint64_t>, COUNTER_COUNT> values;
+
+        std::optional<uint64_t> operator[](ECounter counter) const {
+            return values[static_cast<size_t>(counter)];
+        }
+    };
+
+    // Where a run sits against the compute roof and the memory bandwidth slope of this host
+    struct SRoofline {
+        // FLOP per byte of DRAM traffic, estimated as one cache line per LLC miss
+        double arithmeticIntensity = 0;
+        double attainedGflops      = 0;
+        double peakGflops          = 0;
+        double peakBandwidthGBs    = 0;
+        // min(peakGflops, arithmeticIntensity * peakBandwidthGBs), the best this intensity allows
+        double roofGflops          = 0;
+        bool   memoryBound         = false;
+    };
+
+    // Counters of one measured region and what follows from them. Derived values stay empty when a counter they need
+    // is missing.
+    struct SPerfReport {
+        // False when no counter could be opened at all, reason says why
+        bool                        available = false;
+        std::string                 reason;
+        double                      seconds   = 0;
+        double                      flops     = 0;
+        std::vector<SCounterValues> threads;
+        SCounterValues              total;
+
+        std::optional<double>       ipc;
+        // Measured DRAM bytes per FLOP, next to the compulsory traffic of reading A and B and writing C once
+        std::optional<double>       bytesPerFlop;
+        double                      compulsoryBytesPerFlop = 0;
+        std::optional<SRoofline>    roofline;
+    };
+
+    // Counts user space events of the calling thread, or of every thread of the OpenMP team when parallel is set. The
+    // team is the one the next parallel regions reuse, so counters follow the threads that run the multiply. Failing
+    // counters are left out rather than failing the run: perf_event_paranoid, containers and virtual machines often
+    // allow some events or none.
+    class CPerfCounters {
+      public:
+        explicit CPerfCounters(bool parallel);
+        ~CPerfCounters();
+        CPerfCounters(const CPerfCounters&)            = delete;
+        CPerfCounters& operator=(const CPerfCounters&) = delete;
+
+        // Zero and enable every counter, then freeze them
+        void           start();
+        void           stop();
+
+        // flops and compulsoryBytes describe the work in between. flopsPerCycle is the per core peak of the kernel that
+        // ran, scaled by the measured clock into the compute roof unless PERF_PEAK_GFLOPS is set. The bandwidth roof is
+        // PERF_PEAK_GBS, or measured once per process with a parallel triad.
+        SPerfReport    report(double seconds, double flops, double compulsoryBytes, double flopsPerCycle) const;
+
+        bool           available = false;
+        std::string    reason;
+
+      private:
+        // One descriptor per thread and counter, -1 where opening failed
+        std::vector<std::array<int, COUNTER_COUNT>> descriptors;
+    };
+
+    // Sustained memory bandwidth in GB/s, from PERF_PEAK_GBS or a STREAM style triad over arrays well past the LLC
+    double memoryBandwidthGBs();
+
+    // Human readable lines for logging: per thread counters, the totals and the derived metrics
+    std::vector<std::string> describe(const SPerfReport& report);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+// Reduced precision storage for GEMM inputs. Values are only stored narrow; every multiply and add happens in fp32
+// after widening, so only the rounding of A and B to 16 bits is lost.
+namespace NCommon {
+    // IEEE 754 binary16: 5 exponent and 10 mantissa bits, about 3 decimal digits up to 65504
+    struct SFloat16 {
+        uint16_t bits;
+    };
+    // bfloat16: the upper half of a binary32, so the full fp32 range with 7 mantissa bits
+    struct SBFloat16 {
+        uint16_t bits;
+    };
+
+    // Storage format of A and B. The values double as the STORAGE specialization constant of the GEMM shaders.
+    enum class EPrecision : uint32_t {
+        Float32  = 0,
+        Float16  = 1,
+        BFloat16 = 2,
+    };
+
+    // Accepts fp32, fp16 and bf16
+    EPrecision  parsePrecision(const std::string& name);
+    const char* toString(EPrecision precision);
+    size_t      bytesPerElement(EPrecision precision);
+
+    // Round to nearest even, overflow goes to infinity and NaN stays NaN
+    SFloat16    toFloat16(float value);
+    SBFloat16   toBFloat16(float value);
+    float       toFloat(SFloat16 value);
+    float       toFloat(SBFloat16 value);
+
+    // Bulk conversions of equally sized ranges, fp16 through F16C when the CPU has it
+    void        narrow(std::span<const float> source, std::span<SFloat16> destination);
+    void        narrow(std::span<const float> source, std::span<SBFloat16> destination);
+    void        widen(std::span<const SFloat16> source, std::span<float> destination);
+    void        widen(std::span<const SBFloat16> source, std::span<float> destination);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common.hpp"
+#include "gemm.hpp"
+#include "perf_counters.hpp"
+#include <optional>
+#include <span>
+
+// What the sequential and OpenMP programs do once C holds A * B, kept in one place so the two cannot drift apart
+namespace NCommon {
+    // One in-memory multiply of a CPU program. A and B are the fp32 inputs even when the multiply ran on narrowed
+    // copies of them, all three are row-major without padding.
+    struct SCpuRun {
+        size_t                 m = 0;
+        size_t                 n = 0;
+        size_t                 k = 0;
+        const float*           a = nullptr;
+        const float*           b = nullptr;
+        std::span<const float> c;
+        NGemm::SBlockSizes     blocks;
+        // Reference multiplies run on every OpenMP thread when the measured one did
+        bool                   parallel = false;
+        double                 seconds  = 0;
+    };
+
+    // Logs the --perf report of the stopped counters and the error of Strassen or reduced precision against the
+    // classical fp32 multiply, then checks --verify and writes --output. Returns the exit code for main.
+    int reportCpuRun(const SOptions& options, const SCpuRun& run, const std::optional<CPerfCounters>& counters);
+}
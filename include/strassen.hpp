@@ -0,0 +1,36 @@
+#pragma once
+
+#include "gemm.hpp"
+#include <cstddef>
+
+namespace NGemm {
+    // Strassen-Winograd multiplication: each level splits A, B and C into quadrants and replaces the eight quadrant
+    // products with seven, at the cost of fifteen quadrant additions. Recursion stops once a dimension is at or below
+    // the cutover, where the blocked classical sgemm takes over. In parallel the seven sub-products of the top levels
+    // run as OpenMP tasks.
+    // Fewer multiplications also means a different rounding pattern. The error grows with the recursion depth and is
+    // typically an order of magnitude above the classical kernel's, so compare against sgemm before relying on it.
+    class CStrassen {
+      public:
+        CStrassen(const SBlockSizes& blocks, size_t cutover);
+
+        // C = A * B with A M x K, B K x N and C M x N, row-major with leading dimensions. C is never read.
+        void   multiply(size_t M, size_t N, size_t K, const float* A, size_t lda, const float* B, size_t ldb, float* C, size_t ldc, bool parallel);
+
+        // Recursion levels and scratch memory used by the last multiply
+        size_t depth        = 0;
+        size_t scratchBytes = 0;
+
+      private:
+        size_t        scratchFloats(size_t m, size_t n, size_t k, size_t level) const;
+        void          recurse(size_t m, size_t n, size_t k, const float* A, size_t lda, const float* B, size_t ldb, float* C, size_t ldc, float* scratch, size_t level);
+
+        SBlockSizes   blocks;
+        size_t        cutover;
+        // Levels whose sub-products are spawned as tasks, each with its own slice of the arena
+        size_t        taskLevels = 0;
+        // Padded operands, quadrant scratch and the packing space of every concurrently running leaf. Grown on demand
+        // and reused by later multiplies, so the recursion itself never allocates.
+        AlignedBuffer arena;
+    };
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "precision.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace NCommon {
+    // Outcome of a Freivalds check. Each row's residual |C x - A (B x)| is held against a rounding error bound for that
+    // row, so the check scales with K and the magnitudes involved instead of using one absolute tolerance.
+    struct SVerifyReport {
+        bool   passed     = true;
+        size_t rounds     = 0;
+        // Largest residual over its bound across all rows and rounds, anything above 1 fails
+        double worstRatio = 0;
+        size_t worstRow   = 0;
+        double residual   = 0;
+        double bound      = 0;
+        double seconds    = 0;
+    };
+
+    // Checks C = A * B (A M x K, B K x N, C M x N, row-major with leading dimensions) by multiplying both sides with
+    // rounds random vectors drawn from seed, in O(rounds * (MK + KN + MN)) instead of another multiply. The bound
+    // allows for fp32 accumulation over K and for A and B having been rounded to precision before the multiply, so
+    // results of reduced precision runs are checked against the fp32 inputs they came from. Rows are split across
+    // OpenMP threads and the matrices are read once whatever the number of rounds.
+    SVerifyReport verifyProduct(size_t M, size_t N, size_t K, const float* A, size_t lda, const float* B, size_t ldb, const float* C, size_t ldc,
+                                EPrecision precision = EPrecision::Float32, uint64_t seed = 1, size_t rounds = 2);
+}
@@ -0,0 +1,105 @@
+// Shared-memory tiled GEMM core, included by shader.comp and batched.comp
+
+// Workgroup shape and tiling are specialization constants, filled in by CVulkanContext::createComputePipeline
+layout(constant_id = 0) const uint WORKGROUP_X = 16;
+layout(constant_id = 1) const uint WORKGROUP_Y = 16;
+layout(constant_id = 2) const uint TILE_K      = 16;
+layout(constant_id = 3) const uint THREAD_M    = 4;
+layout(constant_id = 4) const uint THREAD_N    = 4;
+// Storage of A and B, NCommon::EPrecision: 0 fp32, 1 fp16, 2 bf16. Products are accumulated in fp32 either way.
+layout(constant_id = 5) const uint STORAGE     = 0;
+
+layout(local_size_x_id = 0, local_size_y_id = 1) in;
+
+// Each workgroup computes a TILE_M x TILE_N block of C, each invocation THREAD_M x THREAD_N outputs of it
+const uint TILE_M = WORKGROUP_Y * THREAD_M;
+const uint TILE_N = WORKGROUP_X * THREAD_N;
+
+// A and B are read as raw words so one pipeline layout serves every storage. 16-bit values sit two to a word, the
+// lower element index in the low half, which needs neither shaderFloat16 nor 16-bit storage buffer support.
+layout(std430, binding = 0) readonly buffer matrixA {
+    uint a[];
+};
+layout(std430, binding = 1) readonly buffer matrixB {
+    uint b[];
+};
+layout(std430, binding = 2) buffer matrixC {
+    float c[];
+};
+
+shared float tileA[TILE_M * TILE_K];
+shared float tileB[TILE_K * TILE_N];
+
+// Word holding element index of A or B, and that element widened to fp32. STORAGE folds away when specialised.
+uint storageWord(uint index) {
+    return STORAGE == 0 ? index : index >> 1;
+}
+float widen(uint word, uint index) {
+    if (STORAGE == 0) return uintBitsToFloat(word);
+
+    uint bits = (index & 1u) == 0u ? word & 0xFFFFu : word >> 16;
+    return STORAGE == 1 ? unpackHalf2x16(bits).x : uintBitsToFloat(bits << 16);
+}
+float loadA(uint index) {
+    return widen(a[storageWord(index)], index);
+}
+float loadB(uint index) {
+    return widen(b[storageWord(index)], index);
+}
+
+// C (M x N) = alpha * A (M x K) * B (K x N) + beta * C for the block of C at tile, row-major with leading dimensions.
+// Matrices start at the given offsets into their buffers.
+void gemmTile(uint M, uint N, uint K, uint offsetA, uint lda, uint offsetB, uint ldb, uint offsetC, uint ldc, float alpha, float beta, uvec2 tile) {
+    uint tx      = gl_LocalInvocationID.x;
+    uint ty      = gl_LocalInvocationID.y;
+    uint thread  = (ty * WORKGROUP_X) + tx;
+    uint threads = WORKGROUP_X * WORKGROUP_Y;
+    uint rowBase = tile.y * TILE_M;
+    uint colBase = tile.x * TILE_N;
+
+    float acc[THREAD_M * THREAD_N];
+    for (uint i = 0; i < THREAD_M * THREAD_N; i++) {
+        acc[i] = 0.0;
+    }
+
+    for (uint k0 = 0; k0 < K; k0 += TILE_K) {
+        // Stage the A and B blocks cooperatively, zero filling past the matrix edges
+        for (uint i = thread; i < TILE_M * TILE_K; i += threads) {
+            uint row = rowBase + (i / TILE_K);
+            uint k   = k0 + (i % TILE_K);
+            tileA[i] = (row < M && k < K) ? loadA(offsetA + row * lda + k) : 0.0;
+        }
+        for (uint i = thread; i < TILE_K * TILE_N; i += threads) {
+            uint k   = k0 + (i / TILE_N);
+            uint col = colBase + (i % TILE_N);
+            tileB[i] = (k < K && col < N) ? loadB(offsetB + k * ldb + col) : 0.0;
+        }
+        barrier();
+
+        // Outputs are strided by the workgroup size so neighbouring invocations touch neighbouring columns
+        for (uint k = 0; k < TILE_K; k++) {
+            for (uint i = 0; i < THREAD_M; i++) {
+                float aValue = tileA[(ty + i * WORKGROUP_Y) * TILE_K + k];
+                for (uint j = 0; j < THREAD_N; j++) {
+                    acc[i * THREAD_N + j] += aValue * tileB[k * TILE_N + tx + j * WORKGROUP_X];
+                }
+            }
+        }
+        barrier();
+    }
+
+    for (uint i = 0; i < THREAD_M; i++) {
+        uint row = rowBase + ty + i * WORKGROUP_Y;
+        for (uint j = 0; j < THREAD_N; j++) {
+            uint col = colBase + tx + j * WORKGROUP_X;
+            if (row >= M || col >= N) continue;
+
+            uint  index  = offsetC + row * ldc + col;
+            float result = alpha * acc[i * THREAD_N + j];
+            if (beta != 0.0) {
+                result += beta * c[index];
+            }
+            c[index] = result;
+        }
+    }
+}
@@ -0,0 +1,204 @@
+#include "HybridExecutor.hpp"
+#include "common.hpp"
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <omp.h>
+
+// Chunks are whole multiples of this many rows, which also bounds the number of distinct shapes the Vulkan context
+// has to keep slots for
+static constexpr uint32_t ROW_GRANULE      = 64;
+// First chunk of a side whose throughput is unknown, small enough that a slow side cannot hold up the multiply
+static constexpr uint32_t CALIBRATION_ROWS = 2 * ROW_GRANULE;
+// Guided scheduling: each claim takes its side's share of the remaining rows divided by this. The GPU pays a fixed
+// submit and transfer cost per chunk, so it takes fewer, larger chunks than the CPU.
+static constexpr double   GPU_SPLITS       = 2.0;
+static constexpr double   CPU_SPLITS       = 4.0;
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double gigaflops(uint32_t rows, uint32_t N, uint32_t K) {
+    return 2.0 * static_cast<double>(rows) * static_cast<double>(N) * static_cast<double>(K) / 1e9;
+}
+
+// Rows [begin, end) of C claimed by one side
+struct SRowChunk {
+    uint32_t begin = 0;
+    uint32_t end   = 0;
+
+    uint32_t rows() const {
+        return end - begin;
+    }
+};
+
+// Rows [front, back) of C not yet claimed. The GPU takes chunks off the front and the CPU off the back, so each
+// side's rows stay contiguous and a failed GPU chunk can be handed back.
+struct SRowQueue {
+    std::mutex mutex;
+    uint32_t   front = 0;
+    uint32_t   back  = 0;
+};
+
+// Rows for a side with the given throughput out of the remaining ones, rounded to the granule
+static uint32_t chunkRows(uint32_t remaining, double ownThroughput, double otherThroughput, double splits) {
+    if (ownThroughput <= 0.0)
+        return std::min(remaining, CALIBRATION_ROWS);
+
+    // While the other side is still calibrating assume an even split
+    const double   share = otherThroughput > 0.0 ? ownThroughput / (ownThroughput + otherThroughput) : 0.5;
+    const uint32_t rows  = static_cast<uint32_t>(static_cast<double>(remaining) * share / splits);
+    return std::min(remaining, std::max(ROW_GRANULE, (rows + ROW_GRANULE - 1) / ROW_GRANULE * ROW_GRANULE));
+}
+
+CHybridExecutor::CHybridExecutor(CVulkanContext& context, const NGemm::SBlockSizes& blocks) : context(context), blocks(blocks), threads(omp_get_max_threads()) {
+    loadThroughput();
+}
+
+CHybridExecutor::~CHybridExecutor() {
+    try {
+        saveThroughput();
+    } catch (const std::exception& err) {
+        spdlog::warn("Failed to save hybrid throughput: {}", err.what());
+    }
+}
+
+SHybridReport CHybridExecutor::sgemm(uint32_t M, uint32_t N, uint32_t K, float alpha, const float* matrixA, uint32_t lda, const float* matrixB, uint32_t ldb, float beta,
+                                     float* matrixC, uint32_t ldc) {
+    if (M == 0 || N == 0)
+        return {};
+    if (lda < std::max(K, 1u) || ldb < N || ldc < N) {
+        throw std::runtime_error("Leading dimensions are smaller than the matrix rows they describe.");
+    }
+
+    SHybridReport                               report;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    SRowQueue                                   queue;
+    queue.back = M;
+
+    // Claims the next chunk for one side after crediting the previous one to its running throughput. Both sides
+    // read and update the estimates under the queue lock.
+    auto claim = [&](bool gpu, const SRowChunk& done, double seconds) -> SRowChunk {
+        std::lock_guard lock(queue.mutex);
+        uint32_t&       rows   = gpu ? report.gpuRows : report.cpuRows;
+        size_t&         chunks = gpu ? report.gpuChunks : report.cpuChunks;
+        double&         busy   = gpu ? report.gpuSeconds : report.cpuSeconds;
+        double&         own    = gpu ? gpuThroughput : cpuThroughput;
+        if (done.rows() > 0) {
+            rows += done.rows();
+            busy += seconds;
+            chunks++;
+            own = gigaflops(rows, N, K) / busy;
+        }
+
+        const uint32_t remaining = queue.back - queue.front;
+        if (remaining == 0)
+            return {};
+        const uint32_t size = chunkRows(remaining, own, gpu ? cpuThroughput : gpuThroughput, gpu ? GPU_SPLITS : CPU_SPLITS);
+        if (gpu) {
+            queue.front += size;
+            return {.begin = queue.front - size, .end = queue.front};
+        }
+        queue.back -= size;
+        return {.begin = queue.back, .end = queue.back + size};
+    };
+
+    // Nothing may escape the thread, that would terminate the process, so every failure hands the chunk back. Only the
+    // GPU moves the front, so its chunk is still adjacent to the unclaimed rows.
+    std::thread gpuThread([&] {
+        auto handBack = [&](const SRowChunk& chunk, const char* reason) {
+            spdlog::warn("GPU chunk failed, leaving its rows to the CPU: {}", reason);
+            std::lock_guard lock(queue.mutex);
+            queue.front = chunk.begin;
+        };
+        SRowChunk chunk = claim(true, {}, 0.0);
+        while (chunk.rows() > 0) {
+            const std::chrono::steady_clock::time_point chunkStart = std::chrono::steady_clock::now();
+            try {
+                const size_t row = chunk.begin;
+                context.sgemm(chunk.rows(), N, K, alpha, matrixA + (row * lda), lda, matrixB, ldb, beta, matrixC + (row * ldc), ldc);
+            } catch (const std::exception& err) {
+                handBack(chunk, err.what());
+                return;
+            } catch (...) {
+                handBack(chunk, "unknown exception");
+                return;
+            }
+            chunk = claim(true, chunk, secondsSince(chunkStart));
+        }
+    });
+
+    try {
+        // B is packed once for every CPU chunk, while the GPU is already working through its first one
+        const std::chrono::steady_clock::time_point packStart = std::chrono::steady_clock::now();
+        const NGemm::CPackedB                       packedB(matrixB, K, N, ldb, blocks, true);
+        double                                      packSeconds = secondsSince(packStart);
+
+        auto cpuLoop = [&] {
+            SRowChunk chunk = claim(false, {}, 0.0);
+            while (chunk.rows() > 0) {
+                const std::chrono::steady_clock::time_point chunkStart = std::chrono::steady_clock::now();
+                const size_t                                row        = chunk.begin;
+                NGemm::sgemm(chunk.rows(), N, K, alpha, matrixA + (row * lda), lda, packedB, beta, matrixC + (row * ldc), ldc, true);
+                // The packing time is charged to the first chunk so the estimate covers all of the CPU's work
+                chunk       = claim(false, chunk, secondsSince(chunkStart) + packSeconds);
+                packSeconds = 0.0;
+            }
+        };
+        cpuLoop();
+        gpuThread.join();
+        // Picks up whatever a failing GPU handed back after the CPU ran out of rows
+        cpuLoop();
+    } catch (...) {
+        // Destroying a joinable thread terminates, so stop the GPU after its current chunk and wait for it
+        if (gpuThread.joinable()) {
+            {
+                std::lock_guard lock(queue.mutex);
+                queue.back = queue.front;
+            }
+            gpuThread.join();
+        }
+        throw;
+    }
+
+    report.totalSeconds = secondsSince(start);
+    report.cpuGflops    = report.cpuSeconds > 0.0 ? gigaflops(report.cpuRows, N, K) / report.cpuSeconds : 0.0;
+    report.gpuGflops    = report.gpuSeconds > 0.0 ? gigaflops(report.gpuRows, N, K) / report.gpuSeconds : 0.0;
+    spdlog::debug("Hybrid split of {} rows: CPU {} rows in {} chunks, GPU {} rows in {} chunks", M, report.cpuRows, report.cpuChunks, report.gpuRows, report.gpuChunks);
+    return report;
+}
+
+// Cache lines are "threads cpuGflops gpuGflops deviceName", later lines win
+void CHybridExecutor::loadThroughput() {
+    std::ifstream file(NCommon::cacheDirectory() / "hybrid.txt");
+    std::string   line;
+    while (std::getline(file, line)) {
+        std::istringstream stream(line);
+        int                cachedThreads = 0;
+        double             cpu           = 0;
+        double             gpu           = 0;
+        std::string        name;
+        if (!(stream >> cachedThreads >> cpu >> gpu))
+            continue;
+        std::getline(stream >> std::ws, name);
+        if (cachedThreads == threads && name == context.deviceName) {
+            cpuThroughput = cpu;
+            gpuThroughput = gpu;
+        }
+    }
+    spdlog::debug("Hybrid throughput with {} threads on {}: CPU {} GFLOP/s, GPU {} GFLOP/s", threads, context.deviceName, cpuThroughput, gpuThroughput);
+}
+
+void CHybridExecutor::saveThroughput() const {
+    if (cpuThroughput <= 0.0 || gpuThroughput <= 0.0)
+        return;
+    std::ofstream file(NCommon::cacheDirectory() / "hybrid.txt", std::ios::app);
+    file << threads << " " << cpuThroughput << " " << gpuThroughput << " " << context.deviceName << "\n";
+}
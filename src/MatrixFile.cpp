@@ -0,0 +1,227 @@
+#include "MatrixFile.hpp"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::runtime_error systemError(const std::string& what, const std::filesystem::path& path) {
+    return std::runtime_error(what + " " + path.string() + ": " + std::strerror(errno));
+}
+
+// Closes the descriptor on every exit path, the mapping keeps the file referenced on its own
+struct SFileDescriptor {
+    int fd = -1;
+
+    ~SFileDescriptor() {
+        if (fd >= 0)
+            ::close(fd);
+    }
+};
+
+static size_t dataBytesFor(size_t rows, size_t cols) {
+    if (cols != 0 && rows > std::numeric_limits<size_t>::max() / sizeof(float) / cols)
+        throw std::runtime_error("Matrix of " + std::to_string(rows) + " x " + std::to_string(cols) + " floats does not fit in memory.");
+    return rows * cols * sizeof(float);
+}
+
+uint64_t NCommon::matrixChecksum(std::span<const float> values) {
+    const float* data  = values.data();
+    const size_t count = values.size();
+    uint64_t     sum   = 0;
+#pragma omp parallel for simd reduction(+ : sum) schedule(static)
+    for (size_t i = 0; i < count; i++) {
+        sum += mix64((i * GOLDEN_GAMMA) ^ std::bit_cast<uint32_t>(data[i]));
+    }
+    return sum;
+}
+
+NCommon::CMappedMatrix NCommon::CMappedMatrix::open(const std::filesystem::path& path, bool writable) {
+    SFileDescriptor file{::open(path.c_str(), writable ? O_RDWR : O_RDONLY)};
+    if (file.fd < 0)
+        throw systemError("Failed to open", path);
+
+    struct stat status{};
+    if (::fstat(file.fd, &status) != 0)
+        throw systemError("Failed to stat", path);
+    const size_t fileBytes = static_cast<size_t>(status.st_size);
+    if (fileBytes < sizeof(SMatrixFileHeader))
+        throw std::runtime_error(path.string() + " is too small to be a matrix file.");
+
+    CMappedMatrix matrix;
+    void*         mapping = ::mmap(nullptr, fileBytes, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, file.fd, 0);
+    if (mapping == MAP_FAILED)
+        throw systemError("Failed to map", path);
+    matrix.header       = static_cast<SMatrixFileHeader*>(mapping);
+    matrix.mappingBytes = fileBytes;
+    matrix.writable     = writable;
+
+    // The mapping is released by the destructor when any of these throw
+    const SMatrixFileHeader& header = *matrix.header;
+    if (std::memcmp(header.magic, MATRIX_FILE_MAGIC, sizeof(MATRIX_FILE_MAGIC)) != 0)
+        throw std::runtime_error(path.string() + " is not a matrix file.");
+    if (header.version != MATRIX_FILE_VERSION)
+        throw std::runtime_error(path.string() + " has unsupported matrix file version " + std::to_string(header.version) + ".");
+    if (header.dtype != MATRIX_DTYPE_FLOAT32 || header.layout != MATRIX_LAYOUT_ROW_MAJOR)
+        throw std::runtime_error(path.string() + " holds an unsupported data type or layout.");
+    if (header.dataOffset < sizeof(SMatrixFileHeader) || header.dataOffset % MATRIX_FILE_ALIGNMENT != 0 || header.dataBytes != dataBytesFor(header.rows, header.cols) ||
+        header.dataOffset > fileBytes || header.dataBytes > fileBytes - header.dataOffset) {
+        throw std::runtime_error(path.string() + " is truncated or its header is corrupt.");
+    }
+    matrix.rows = header.rows;
+    matrix.cols = header.cols;
+    return matrix;
+}
+
+NCommon::CMappedMatrix NCommon::CMappedMatrix::create(const std::filesystem::path& path, size_t rows, size_t cols) {
+    const size_t    dataBytes = dataBytesFor(rows, cols);
+    SFileDescriptor file{::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644)};
+    if (file.fd < 0)
+        throw systemError("Failed to create", path);
+    // The file is sparse until written, so the values read back as zero
+    if (::ftruncate(file.fd, static_cast<off_t>(MATRIX_FILE_ALIGNMENT + dataBytes)) != 0)
+        throw systemError("Failed to size", path);
+
+    CMappedMatrix matrix;
+    void*         mapping = ::mmap(nullptr, MATRIX_FILE_ALIGNMENT + dataBytes, PROT_READ | PROT_WRITE, MAP_SHARED, file.fd, 0);
+    if (mapping == MAP_FAILED)
+        throw systemError("Failed to map", path);
+    matrix.header       = static_cast<SMatrixFileHeader*>(mapping);
+    matrix.mappingBytes = MATRIX_FILE_ALIGNMENT + dataBytes;
+    matrix.writable     = true;
+    matrix.rows         = rows;
+    matrix.cols         = cols;
+
+    SMatrixFileHeader& header = *matrix.header;
+    std::memcpy(header.magic, MATRIX_FILE_MAGIC, sizeof(MATRIX_FILE_MAGIC));
+    header.version    = MATRIX_FILE_VERSION;
+    header.dtype      = MATRIX_DTYPE_FLOAT32;
+    header.layout     = MATRIX_LAYOUT_ROW_MAJOR;
+    header.reserved   = 0;
+    header.rows       = rows;
+    header.cols       = cols;
+    header.dataOffset = MATRIX_FILE_ALIGNMENT;
+    header.dataBytes  = dataBytes;
+    header.checksum   = 0;
+    return matrix;
+}
+
+NCommon::CMappedMatrix::CMappedMatrix(CMappedMatrix&& other) noexcept :
+    rows(std::exchange(other.rows, 0)), cols(std::exchange(other.cols, 0)), writable(std::exchange(other.writable, false)), header(std::exchange(other.header, nullptr)),
+    mappingBytes(std::exchange(other.mappingBytes, 0)) {}
+
+NCommon::CMappedMatrix& NCommon::CMappedMatrix::operator=(CMappedMatrix&& other) noexcept {
+    std::swap(rows, other.rows);
+    std::swap(cols, other.cols);
+    std::swap(writable, other.writable);
+    std::swap(header, other.header);
+    std::swap(mappingBytes, other.mappingBytes);
+    return *this;
+}
+
+NCommon::CMappedMatrix::~CMappedMatrix() {
+    if (header != nullptr)
+        ::munmap(header, mappingBytes);
+}
+
+const float* NCommon::CMappedMatrix::data() const {
+    return reinterpret_cast<const float*>(reinterpret_cast<const char*>(header) + header->dataOffset);
+}
+
+float* NCommon::CMappedMatrix::mutableData() {
+    if (!writable)
+        throw std::runtime_error("Matrix file is mapped read-only.");
+    return reinterpret_cast<float*>(reinterpret_cast<char*>(header) + header->dataOffset);
+}
+
+std::span<const float> NCommon::CMappedMatrix::values() const {
+    return {data(), rows * cols};
+}
+
+bool NCommon::CMappedMatrix::verify() const {
+    return matrixChecksum(values()) == header->checksum;
+}
+
+void NCommon::CMappedMatrix::sync() {
+    if (!writable)
+        throw std::runtime_error("Matrix file is mapped read-only.");
+    header->checksum = matrixChecksum(values());
+    if (::msync(header, mappingBytes, MS_SYNC) != 0)
+        throw std::runtime_error(std::string("Failed to flush matrix file: ") + std::strerror(errno));
+}
+
+std::pair<size_t, size_t> NCommon::CMappedMatrix::rowPages(size_t first, size_t last, bool inside) const {
+    // madvise and msync work on whole pages and round the length up, so both ends are rounded explicitly
+    const size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    const size_t from     = header->dataOffset + (std::min(first, rows) * cols * sizeof(float));
+    const size_t to       = header->dataOffset + (std::min(last, rows) * cols * sizeof(float));
+    const size_t begin    = (inside ? from + pageSize - 1 : from) / pageSize * pageSize;
+    const size_t end      = inside ? to / pageSize * pageSize : to;
+    return {begin, std::max(begin, end)};
+}
+
+void NCommon::CMappedMatrix::prefetchRows(size_t first, size_t last) const {
+    const auto [begin, end] = rowPages(first, last);
+    if (end > begin)
+        ::madvise(reinterpret_cast<char*>(header) + begin, end - begin, MADV_WILLNEED);
+}
+
+void NCommon::CMappedMatrix::releaseRows(size_t first, size_t last) const {
+    // Only the mapping goes, dirty pages stay in the page cache and are written back as usual. Pages shared with the
+    // neighbouring rows are kept, they may be what the next band is being prefetched into.
+    const auto [begin, end] = rowPages(first, last, true);
+    if (end > begin)
+        ::madvise(reinterpret_cast<char*>(header) + begin, end - begin, MADV_DONTNEED);
+}
+
+void NCommon::CMappedMatrix::loadRows(size_t first, size_t last) const {
+    const auto [begin, end] = rowPages(first, last);
+    const size_t pageSize   = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    const char*  bytes      = reinterpret_cast<const char*>(header);
+
+    // Readahead first so the reads below mostly find their pages already on the way
+    prefetchRows(first, last);
+    volatile char sink = 0;
+    for (size_t offset = begin; offset < end; offset += pageSize) {
+        sink = bytes[offset];
+    }
+    static_cast<void>(sink);
+}
+
+void NCommon::CMappedMatrix::flushRows(size_t first, size_t last) const {
+    const auto [begin, end] = rowPages(first, last);
+    if (writable && end > begin)
+        ::msync(reinterpret_cast<char*>(header) + begin, end - begin, MS_ASYNC);
+}
+
+void NCommon::writeMatrixFile(const std::filesystem::path& path, std::span<const float> values, size_t rows, size_t cols) {
+    if (values.size() != rows * cols)
+        throw std::runtime_error("Matrix values do not match its shape.");
+    CMappedMatrix file = CMappedMatrix::create(path, rows, cols);
+    std::copy(values.begin(), values.end(), file.mutableData());
+    file.sync();
+}
+
+NCommon::SMappedInputs NCommon::mapInputs(SOptions& options) {
+    SMappedInputs inputs{.a = CMappedMatrix::open(options.input / "A.bin"), .b = CMappedMatrix::open(options.input / "B.bin")};
+    if (inputs.a.cols != inputs.b.rows)
+        throw std::runtime_error("A.bin and B.bin in " + options.input.string() + " cannot be multiplied.");
+    options.m = inputs.a.rows;
+    options.k = inputs.a.cols;
+    options.n = inputs.b.cols;
+    return inputs;
+}
+
+void NCommon::saveProblem(const std::filesystem::path& directory, std::span<const float> A, std::span<const float> B, std::span<const float> C, size_t M, size_t N, size_t K) {
+    std::filesystem::create_directories(directory);
+    writeMatrixFile(directory / "A.bin", A, M, K);
+    writeMatrixFile(directory / "B.bin", B, K, N);
+    writeMatrixFile(directory / "C.bin", C, M, N);
+}
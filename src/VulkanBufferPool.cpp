@@ -0,0 +1,200 @@
+#include "VulkanBufferPool.hpp"
+#include <spdlog/spdlog.h>
+#include <bit>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+#include <iterator>
+
+static constexpr vk::DeviceSize DEFAULT_RETAIN_MB = 1024;
+
+static vk::DeviceSize retainLimitFromEnv() {
+    const char* retain = std::getenv("VULKAN_POOL_RETAIN_MB");
+    char*       end    = nullptr;
+    const auto  parsed = retain != nullptr ? std::strtoull(retain, &end, 10) : 0ull;
+    return (retain != nullptr && end != retain && *end == '\0' ? parsed : DEFAULT_RETAIN_MB) << 20;
+}
+
+CVulkanBufferPool::CVulkanBufferPool(const vk::raii::Device& device, const vk::raii::PhysicalDevice& physicalDevice, std::vector<uint32_t> queueFamilyIndices,
+                                     vk::DeviceSize blockSize) :
+    device(device), memoryProperties(physicalDevice.getMemoryProperties()), maxStorageBufferRange(physicalDevice.getProperties().limits.maxStorageBufferRange),
+    queueFamilyIndices(std::move(queueFamilyIndices)), blockSize(blockSize), retainLimit(retainLimitFromEnv()) {}
+
+vk::DeviceSize CVulkanBufferPool::sizeClass(vk::DeviceSize size) const {
+    // Smallest class is 64 KiB so tiny problems share one class
+    if (size <= MIN_CLASS)
+        return MIN_CLASS;
+    const vk::DeviceSize power = std::bit_ceil(size);
+    if (power <= FINE_CLASSES)
+        return power;
+
+    // Eight classes per power of two: the step is an eighth of the largest power of two below size
+    const vk::DeviceSize step      = std::bit_floor(size) / 8;
+    const vk::DeviceSize sizeClass = (size + step - 1) / step * step;
+    return sizeClass > maxStorageBufferRange ? size : sizeClass;
+}
+
+vk::DeviceSize CVulkanBufferPool::allocatedBytes() const {
+    vk::DeviceSize total = 0;
+    for (const SMemoryBlock& block : blocks) {
+        total += block.size;
+    }
+    return total;
+}
+
+uint32_t CVulkanBufferPool::findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties) const {
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("Failed to find suitable memory type.");
+}
+
+CVulkanBufferPool::SMemoryBlock& CVulkanBufferPool::allocateBlock(vk::DeviceSize size, uint32_t memoryType) {
+    // Blocks never outgrow their heap, which can be smaller than the default block size for host visible device memory
+    const vk::DeviceSize heapSize     = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    const vk::DeviceSize newBlockSize = std::min(std::max(blockSize, size), heapSize);
+    spdlog::debug("Allocating {} MiB memory block of type {}.", newBlockSize >> 20, memoryType);
+
+    SMemoryBlock block{
+        .memory     = vk::raii::DeviceMemory(device, {.allocationSize = newBlockSize, .memoryTypeIndex = memoryType}),
+        .size       = newBlockSize,
+        .memoryType = memoryType,
+    };
+    if (memoryProperties.memoryTypes[memoryType].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) {
+        block.mapped = block.memory.mapMemory(0, VK_WHOLE_SIZE);
+    }
+    blocks.push_back(std::move(block));
+    return blocks.back();
+}
+
+SPooledBuffer CVulkanBufferPool::acquire(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties) {
+    if ((usage & vk::BufferUsageFlagBits::eStorageBuffer) && size > maxStorageBufferRange) {
+        throw std::runtime_error("Buffer of " + std::to_string(size) + " bytes exceeds the device's maxStorageBufferRange of " + std::to_string(maxStorageBufferRange) +
+                                 " bytes.");
+    }
+    const vk::DeviceSize bufferSize = sizeClass(size);
+
+    auto                 freeList = freeLists.find({bufferSize, static_cast<VkBufferUsageFlags>(usage), static_cast<VkMemoryPropertyFlags>(properties)});
+    if (freeList != freeLists.end() && !freeList->second.empty()) {
+        SPooledBuffer buffer = std::move(freeList->second.back());
+        freeList->second.pop_back();
+        retainedBytes -= buffer.footprint;
+        return buffer;
+    }
+
+    const bool    concurrent = queueFamilyIndices.size() > 1;
+    SPooledBuffer buffer{
+        .buffer     = device.createBuffer({
+                .size                  = bufferSize,
+                .usage                 = usage,
+                .sharingMode           = concurrent ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive,
+                .queueFamilyIndexCount = concurrent ? static_cast<uint32_t>(queueFamilyIndices.size()) : 0,
+                .pQueueFamilyIndices   = concurrent ? queueFamilyIndices.data() : nullptr,
+        }),
+        .size       = bufferSize,
+        .usage      = usage,
+        .properties = properties,
+    };
+
+    const vk::MemoryRequirements memRequirements = buffer.buffer.getMemoryRequirements();
+    const uint32_t               memoryType      = findMemoryType(memRequirements.memoryTypeBits, properties);
+    const vk::DeviceSize         heapSize        = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    if (memRequirements.size > heapSize) {
+        throw std::runtime_error("Buffer of " + std::to_string(memRequirements.size) + " bytes does not fit its " + std::to_string(heapSize >> 20) + " MiB memory heap.");
+    }
+
+    // First fit over the existing blocks of this memory type, bump allocating inside the block
+    SMemoryBlock*  target = nullptr;
+    vk::DeviceSize offset = 0;
+    for (SMemoryBlock& block : blocks) {
+        if (block.memoryType != memoryType)
+            continue;
+        const vk::DeviceSize aligned = (block.used + memRequirements.alignment - 1) / memRequirements.alignment * memRequirements.alignment;
+        if (aligned + memRequirements.size <= block.size) {
+            target = &block;
+            offset = aligned;
+            break;
+        }
+    }
+
+    if (target == nullptr) {
+        try {
+            target = &allocateBlock(memRequirements.size, memoryType);
+        } catch (const vk::OutOfDeviceMemoryError&) {
+            // Memory held for released buffers may be what is missing, so give it back and try once more
+            if (retainedBytes == 0)
+                throw;
+            spdlog::debug("Out of device memory, trimming {} MiB of released buffers.", retainedBytes >> 20);
+            trim();
+            target = &allocateBlock(memRequirements.size, memoryType);
+        }
+    }
+
+    buffer.buffer.bindMemory(*target->memory, offset);
+    if (target->mapped != nullptr) {
+        buffer.mapped = static_cast<char*>(target->mapped) + offset;
+    }
+    buffer.memory    = *target->memory;
+    buffer.offset    = offset;
+    buffer.footprint = memRequirements.size;
+    target->used     = offset + memRequirements.size;
+    target->buffers++;
+
+    return buffer;
+}
+
+void CVulkanBufferPool::release(SPooledBuffer&& buffer) {
+    if (buffer.size == 0)
+        return;
+
+    retainedBytes += buffer.footprint;
+    freeLists[{buffer.size, static_cast<VkBufferUsageFlags>(buffer.usage), static_cast<VkMemoryPropertyFlags>(buffer.properties)}].push_back(std::move(buffer));
+    if (retainedBytes <= retainLimit)
+        return;
+
+    // Free lists are ordered by size, so the smallest released buffers go first and large ones stay ready for reuse
+    for (auto freeList = freeLists.begin(); freeList != freeLists.end() && retainedBytes > retainLimit;) {
+        while (!freeList->second.empty() && retainedBytes > retainLimit) {
+            retainedBytes -= freeList->second.back().footprint;
+            destroy(std::move(freeList->second.back()));
+            freeList->second.pop_back();
+        }
+        freeList = freeList->second.empty() ? freeLists.erase(freeList) : std::next(freeList);
+    }
+    freeEmptyBlocks();
+}
+
+void CVulkanBufferPool::trim() {
+    for (auto& [key, buffers] : freeLists) {
+        for (SPooledBuffer& buffer : buffers) {
+            destroy(std::move(buffer));
+        }
+    }
+    freeLists.clear();
+    retainedBytes = 0;
+    freeEmptyBlocks();
+}
+
+void CVulkanBufferPool::destroy(SPooledBuffer&& buffer) {
+    const SPooledBuffer released = std::move(buffer);
+    auto                block    = std::ranges::find_if(blocks, [&](const SMemoryBlock& candidate) { return *candidate.memory == released.memory; });
+    if (block == blocks.end())
+        return;
+
+    block->buffers--;
+    if (block->buffers == 0) {
+        block->used = 0;
+    } else if (released.offset + released.footprint == block->used) {
+        block->used = released.offset;
+    }
+}
+
+void CVulkanBufferPool::freeEmptyBlocks() {
+    const size_t before = blocks.size();
+    std::erase_if(blocks, [](const SMemoryBlock& block) { return block.buffers == 0; });
+    if (blocks.size() != before)
+        spdlog::debug("Freed {} empty memory blocks, {} MiB still allocated.", before - blocks.size(), allocatedBytes() >> 20);
+}
@@ -1,43 +1,184 @@
 #include "VulkanContext.hpp"
+#include "common.hpp"
 #include <spdlog/spdlog.h>
 #include <stdexcept>
 #include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+// Generated at build time from shaders/shader.comp and shaders/batched.comp by glslangValidator --vn
+#include "matrix_comp_spv.h"
+#include "batched_comp_spv.h"
+
+// Storage buffer bindings of the GEMM shader: A, B and C, plus the problem table of the batched shader
+static constexpr uint32_t GEMM_BINDINGS    = 3;
+static constexpr uint32_t BATCHED_BINDINGS = 4;
+
+// Entry of the batched shader's problem table, laid out to match its Problem struct. Offsets are in floats.
+struct SBatchEntry {
+    uint32_t M;
+    uint32_t N;
+    uint32_t K;
+    uint32_t offsetA;
+    uint32_t offsetB;
+    uint32_t offsetC;
+    float    alpha;
+    float    beta;
+};
+
+// Problems below this size are batched with 32 x 32 tiles so each one still spans a few workgroups
+static constexpr uint32_t      SMALL_BATCH_SIZE   = 64;
+static constexpr SShaderConfig SMALL_BATCH_CONFIG = {.workgroupX = 16, .workgroupY = 16, .tileK = 16, .threadM = 2, .threadN = 2};
+
+// Timestamp query pairs in each slot's query pool
+static constexpr uint32_t UPLOAD_QUERY      = 0;
+static constexpr uint32_t DISPATCH_QUERY    = 2;
+static constexpr uint32_t READBACK_QUERY    = 4;
+static constexpr uint32_t TIMESTAMP_QUERIES = 6;
+
+// Streaming GEMM keeps each A band, B band and C tile within one buffer of this size, and aims for at least
+// STREAM_MIN_BANDS row bands so there is something to overlap
+static constexpr vk::DeviceSize STREAM_BUFFER_BYTES = vk::DeviceSize(32) << 20;
+static constexpr uint32_t       STREAM_MIN_BANDS    = 8;
+
+// Stream timelines, each counting tiles through one stage. A timeline only ever has one queue signalling it, so its
+// values rise in submission order as the spec requires.
+static constexpr uint32_t STREAM_UPLOADED  = 0;
+static constexpr uint32_t STREAM_COMPUTED  = 1;
+static constexpr uint32_t STREAM_READ_BACK = 2;
+
+// Submits one command buffer that waits for waitValue on waitTimeline (unless zero) and signals signalValue on signalTimeline
+static void submitTimeline(const vk::raii::Queue& queue, const vk::raii::CommandBuffer& commands, const vk::raii::Semaphore& waitTimeline, uint64_t waitValue,
+                           vk::PipelineStageFlags waitStage, const vk::raii::Semaphore& signalTimeline, uint64_t signalValue) {
+    const uint32_t                        waitCount = waitValue > 0 ? 1 : 0;
+    const vk::TimelineSemaphoreSubmitInfo timelineInfo{
+        .waitSemaphoreValueCount   = waitCount,
+        .pWaitSemaphoreValues      = &waitValue,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues    = &signalValue,
+    };
+    const vk::SubmitInfo submitInfo{
+        .pNext                = &timelineInfo,
+        .waitSemaphoreCount   = waitCount,
+        .pWaitSemaphores      = &*waitTimeline,
+        .pWaitDstStageMask    = &waitStage,
+        .commandBufferCount   = 1,
+        .pCommandBuffers      = &*commands,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores    = &*signalTimeline,
+    };
+    queue.submit(submitInfo);
+}
 
-// Created using Vulkan docs at
-// https://github.com/bmilde/vulkan_matrix_mul
-// https://docs.vulkan.org/tutorial/latest/00_Introduction.html
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    return duration.count();
+}
 
-static std::vector<char> readShaderFile(const std::string& filename) {
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+// GPU time between the timestamp pair starting at firstQuery, or zero when the results are unavailable
+static double timestampSeconds(const vk::raii::QueryPool& pool, uint32_t firstQuery, uint32_t validBits, float period) {
+    auto [result, ticks] = pool.getResults<uint64_t>(firstQuery, 2, 2 * sizeof(uint64_t), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+    if (result != vk::Result::eSuccess)
+        return 0.0;
 
-    if (!file.is_open()) {
-        throw std::runtime_error("Failed to open shader file!");
-    }
+    const uint64_t mask = validBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << validBits) - 1;
+    return static_cast<double>((ticks[1] - ticks[0]) & mask) * period * 1e-9;
+}
 
-    std::vector<char> buffer(file.tellg());
+// Bytes spanned by a rows x cols row-major matrix with leading dimension ld
+static vk::DeviceSize matrixBytes(uint32_t rows, uint32_t cols, uint32_t ld, vk::DeviceSize elementBytes = sizeof(float)) {
+    if (rows == 0)
+        return 0;
+    return elementBytes * ((static_cast<vk::DeviceSize>(rows - 1) * ld) + cols);
+}
 
-    file.seekg(0, std::ios::beg);
-    file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
-    file.close();
+// Sizes of the A, B and C buffers of one multiply. The shaders read A and B in whole 32-bit words, so 16-bit storage
+// is rounded up to the next word.
+static std::array<vk::DeviceSize, GEMM_BINDINGS> gemmBufferSizes(const SGemmPushConstants& params, NCommon::EPrecision storage) {
+    const vk::DeviceSize elementBytes = NCommon::bytesPerElement(storage);
+    auto                 wordAligned  = [](vk::DeviceSize bytes) { return (bytes + sizeof(uint32_t) - 1) / sizeof(uint32_t) * sizeof(uint32_t); };
+    return {
+        wordAligned(matrixBytes(params.M, params.K, params.lda, elementBytes)),
+        wordAligned(matrixBytes(params.K, params.N, params.ldb, elementBytes)),
+        matrixBytes(params.M, params.N, params.ldc),
+    };
+}
 
-    return buffer;
+static_assert(sizeof(SShaderConfig) == 6 * sizeof(uint32_t), "SShaderConfig is passed to the shader as raw specialization data");
+
+uint32_t SShaderConfig::tileM() const {
+    return workgroupY * threadM;
+}
+
+uint32_t SShaderConfig::tileN() const {
+    return workgroupX * threadN;
 }
 
-CVulkanContext::CVulkanContext(int matrix_size) : matrixSize(matrix_size) {
+std::string SShaderConfig::toString() const {
+    std::string result = "workgroup=" + std::to_string(workgroupX) + "x" + std::to_string(workgroupY) + " tileK=" + std::to_string(tileK) + " thread=" +
+        std::to_string(threadM) + "x" + std::to_string(threadN);
+    if (storage != NCommon::EPrecision::Float32)
+        result += std::string(" storage=") + NCommon::toString(storage);
+    return result;
+}
+
+// Created using Vulkan docs at
+// https://github.com/bmilde/vulkan_matrix_mul
+// https://docs.vulkan.org/tutorial/latest/00_Introduction.html
+
+// Drivers should reject foreign cache data themselves, but not all of them do, so check the header first
+static bool pipelineCacheMatches(const std::vector<char>& data, const vk::PhysicalDeviceProperties& properties) {
+    VkPipelineCacheHeaderVersionOne header;
+    if (data.size() < sizeof(header))
+        return false;
+
+    std::memcpy(&header, data.data(), sizeof(header));
+    return header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE && header.vendorID == properties.vendorID && header.deviceID == properties.deviceID &&
+        std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+}
+
+CVulkanContext::CVulkanContext() : constructedAt(std::chrono::steady_clock::now()) {
     spdlog::debug("Constructing Vulkan Context. Using version {}", PROJECT_VERSION);
-    spdlog::info("Initializing Vulkan Context [{}]", matrixSize);
+    spdlog::info("Initializing Vulkan Context");
 
     try {
         // Step One: Instance and Physical Device Selection
+        std::chrono::steady_clock::time_point phase = std::chrono::steady_clock::now();
         createInstance();
+        initTiming.instanceSeconds = secondsSince(phase);
+
+        phase = std::chrono::steady_clock::now();
         pickPhysicalDevice();
         createLogicalDevice();
+        initTiming.deviceSeconds = secondsSince(phase);
         spdlog::info("Vulkan initialized! With GPU: {}", deviceName);
 
+        phase = std::chrono::steady_clock::now();
         createCommandPool();
         createDescriptorSetLayout();
-        createComputePipeline();
+        initTiming.resourceSeconds = secondsSince(phase);
+
+        phase = std::chrono::steady_clock::now();
+        createShaderModule();
+        createPipelineLayout();
+        createPipelineCache();
+        pipelineFor(SShaderConfig{});
+        initTiming.pipelineSeconds = secondsSince(phase);
+        loadAutotuneCache();
+
+        phase = std::chrono::steady_clock::now();
         createDescriptorPool();
+        std::vector<uint32_t> queueFamilies{computeQueueFamilyIndex};
+        if (transferQueueFamilyIndex != computeQueueFamilyIndex)
+            queueFamilies.push_back(transferQueueFamilyIndex);
+        bufferPool = std::make_unique<CVulkanBufferPool>(device, physicalDevice, queueFamilies);
+        initTiming.resourceSeconds += secondsSince(phase);
         spdlog::info("Vulkan setup completed and compute shader successfully loaded.");
 
     } catch (const vk::SystemError& err) {
@@ -48,19 +189,25 @@ CVulkanContext::CVulkanContext(int matrix_size) : matrixSize(matrix_size) {
         throw std::runtime_error("Failed to initialize Vulkan Context.");
     }
 
-    spdlog::info("Vulkan Context initialized successfully.");
+    initTiming.totalSeconds = secondsSince(constructedAt);
+    spdlog::info("Vulkan Context initialized successfully in {} seconds (instance {}, device {}, pipeline {}, resources {}).", initTiming.totalSeconds,
+                 initTiming.instanceSeconds, initTiming.deviceSeconds, initTiming.pipelineSeconds, initTiming.resourceSeconds);
 }
 
 CVulkanContext::~CVulkanContext() {
     spdlog::trace("Destroying Vulkan Context.");
 
-    // cleanup arrays
-    for (auto& buffer : buffers) {
-        buffer = nullptr;
-    }
+    // Slot buffers are bound to pool memory, so they have to go first
+    slots.clear();
+    streamStages.clear();
+    batchSlot.reset();
+    chainSlot.reset();
+    bufferPool.reset();
 
-    for (auto& memory : bufferMemories) {
-        memory = nullptr;
+    try {
+        savePipelineCache();
+    } catch (const std::exception& err) {
+        spdlog::warn("Failed to save pipeline cache: {}", err.what());
     }
 
     // Resources are automatically cleaned up by vk::raii destructors
@@ -97,10 +244,37 @@ void CVulkanContext::pickPhysicalDevice() {
         auto queueFamilyProperties = device.getQueueFamilyProperties();
         for (uint32_t i = 0; i < queueFamilyProperties.size(); ++i) {
             if (queueFamilyProperties[i].queueFlags & vk::QueueFlagBits::eCompute) {
-                physicalDevice          = device;
-                computeQueueFamilyIndex = i;
-                deviceName              = deviceProperties.deviceName.data();
+                physicalDevice           = device;
+                computeQueueFamilyIndex  = i;
+                transferQueueFamilyIndex = i;
+                deviceName               = deviceProperties.deviceName.data();
                 spdlog::debug("Selected device with compute support: {}", deviceName);
+
+                // A dedicated transfer family maps to the copy engines on discrete GPUs, otherwise the compute queue copies
+                for (uint32_t j = 0; j < queueFamilyProperties.size(); ++j) {
+                    const vk::QueueFlags flags = queueFamilyProperties[j].queueFlags;
+                    if ((flags & vk::QueueFlagBits::eTransfer) && !(flags & (vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eGraphics))) {
+                        transferQueueFamilyIndex = j;
+                        spdlog::debug("Using dedicated transfer queue family {}", j);
+                        break;
+                    }
+                }
+
+                timestampPeriod       = deviceProperties.limits.timestampPeriod;
+                computeTimestampBits  = queueFamilyProperties[computeQueueFamilyIndex].timestampValidBits;
+                transferTimestampBits = queueFamilyProperties[transferQueueFamilyIndex].timestampValidBits;
+                timestampQueries      = computeTimestampBits > 0;
+
+                // Unified memory needs a device local type the host can map coherently
+                const bool sharesHostMemory = deviceProperties.deviceType == vk::PhysicalDeviceType::eIntegratedGpu || deviceProperties.deviceType == vk::PhysicalDeviceType::eCpu;
+                const vk::MemoryPropertyFlags unifiedFlags =
+                    vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+                vk::PhysicalDeviceMemoryProperties memProperties = device.getMemoryProperties();
+                for (uint32_t j = 0; sharesHostMemory && j < memProperties.memoryTypeCount; ++j) {
+                    if ((memProperties.memoryTypes[j].propertyFlags & unifiedFlags) == unifiedFlags)
+                        unifiedMemory = true;
+                }
+                spdlog::debug("Device memory is {}", unifiedMemory ? "unified, mapping buffers directly" : "discrete, staging transfers");
                 return;
             }
         }
@@ -112,22 +286,30 @@ void CVulkanContext::pickPhysicalDevice() {
 void CVulkanContext::createLogicalDevice() {
     spdlog::trace("Creating a logical device.");
 
-    float                      queuePriority = 1.0f;
-    vk::DeviceQueueCreateInfo  queueCreateInfo{.queueFamilyIndex = computeQueueFamilyIndex, .queueCount = 1, .pQueuePriorities = &queuePriority};
+    float                                  queuePriority = 1.0f;
+    std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos{{.queueFamilyIndex = computeQueueFamilyIndex, .queueCount = 1, .pQueuePriorities = &queuePriority}};
+    if (transferQueueFamilyIndex != computeQueueFamilyIndex) {
+        queueCreateInfos.push_back({.queueFamilyIndex = transferQueueFamilyIndex, .queueCount = 1, .pQueuePriorities = &queuePriority});
+    }
 
     vk::PhysicalDeviceFeatures features = physicalDevice.getFeatures();
 #ifdef NDEBUG
     features.robustBufferAccess = VK_FALSE;
 #endif
+    // Timeline semaphores pace the streaming GEMM and host query resets serve queues that cannot reset queries
+    // themselves, both are core and always supported since Vulkan 1.2
+    vk::PhysicalDeviceVulkan12Features vulkan12Features{.hostQueryReset = VK_TRUE, .timelineSemaphore = VK_TRUE};
     spdlog::trace("Retrieved device features and queue info for logical device creation.");
-    vk::DeviceCreateInfo createInfo{
-        .queueCreateInfoCount = 1,
-        .pQueueCreateInfos    = &queueCreateInfo,
+    vk::DeviceCreateInfo               createInfo{
+        .pNext                = &vulkan12Features,
+        .queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()),
+        .pQueueCreateInfos    = queueCreateInfos.data(),
         .pEnabledFeatures     = &features,
     };
     //FIXME: ASan detects a memory leak coming from here, use vulkan validation layers to verify what's going wrong
-    device       = physicalDevice.createDevice(createInfo);
-    computeQueue = device.getQueue(computeQueueFamilyIndex, 0);
+    device        = physicalDevice.createDevice(createInfo);
+    computeQueue  = device.getQueue(computeQueueFamilyIndex, 0);
+    transferQueue = device.getQueue(transferQueueFamilyIndex, 0);
 
     spdlog::trace("Logical device created successfully.");
 }
@@ -142,15 +324,18 @@ void CVulkanContext::createCommandPool() {
 
     commandPool = device.createCommandPool(poolInfo);
 
+    poolInfo.queueFamilyIndex = transferQueueFamilyIndex;
+    transferCommandPool       = device.createCommandPool(poolInfo);
+
     spdlog::trace("Successfully created command pool.");
 }
 
 void CVulkanContext::createDescriptorSetLayout() {
     spdlog::trace("Creating descriptor set layout.");
 
-    std::vector<vk::DescriptorSetLayoutBinding> bindings(buffers.size());
+    std::vector<vk::DescriptorSetLayoutBinding> bindings(BATCHED_BINDINGS);
 
-    for (size_t i = 0; i < buffers.size(); i++) {
+    for (uint32_t i = 0; i < BATCHED_BINDINGS; i++) {
         bindings[i] = vk::DescriptorSetLayoutBinding{
             .binding         = i,
             .descriptorType  = vk::DescriptorType::eStorageBuffer,
@@ -159,38 +344,42 @@ void CVulkanContext::createDescriptorSetLayout() {
         };
     }
 
+    // The single problem shader uses the first three bindings, the batched one adds its problem table
     vk::DescriptorSetLayoutCreateInfo layoutInfo{
-        .bindingCount = bindings.size(),
+        .bindingCount = GEMM_BINDINGS,
         .pBindings    = bindings.data(),
     };
 
     descriptorSetLayout = device.createDescriptorSetLayout(layoutInfo);
 
+    layoutInfo.bindingCount    = BATCHED_BINDINGS;
+    batchedDescriptorSetLayout = device.createDescriptorSetLayout(layoutInfo);
+
     spdlog::trace("Descriptor set layout created successfully.");
 }
 
-void CVulkanContext::createComputePipeline() {
-    spdlog::trace("Creating compute pipeline.");
-    auto                       shaderCode = readShaderFile("shaders/matrix_comp.spv");
-
+void CVulkanContext::createShaderModule() {
+    spdlog::trace("Creating compute shader module.");
     vk::ShaderModuleCreateInfo shaderModuleInfo{
-        .codeSize = shaderCode.size() * sizeof(char),
-        .pCode    = reinterpret_cast<const uint32_t*>(shaderCode.data()),
+        .codeSize = sizeof(matrixCompSpv),
+        .pCode    = matrixCompSpv,
     };
 
     computeShaderModule = device.createShaderModule(shaderModuleInfo);
-    spdlog::trace("Created compute shader module.");
 
-    vk::PipelineShaderStageCreateInfo shaderStageInfo{
-        .stage  = vk::ShaderStageFlagBits::eCompute,
-        .module = computeShaderModule,
-        .pName  = "main",
-    };
+    shaderModuleInfo.codeSize = sizeof(batchedCompSpv);
+    shaderModuleInfo.pCode    = batchedCompSpv;
+    batchedShaderModule       = device.createShaderModule(shaderModuleInfo);
+    spdlog::trace("Created compute shader modules.");
+}
+
+void CVulkanContext::createPipelineLayout() {
+    spdlog::trace("Creating pipeline layout.");
 
     vk::PushConstantRange pushConstantRange{
         .stageFlags = vk::ShaderStageFlagBits::eCompute,
         .offset     = 0,
-        .size       = sizeof(uint32_t),
+        .size       = sizeof(SGemmPushConstants),
     };
 
     vk::PipelineLayoutCreateInfo pipelineLayoutInfo{
@@ -200,26 +389,121 @@ void CVulkanContext::createComputePipeline() {
         .pPushConstantRanges    = &pushConstantRange,
     };
     pipelineLayout = vk::raii::PipelineLayout(device, pipelineLayoutInfo);
-    spdlog::trace("Created pipeline layout.");
+
+    // The batched shader only takes the index of the first problem of a dispatch
+    pushConstantRange.size         = sizeof(uint32_t);
+    pipelineLayoutInfo.pSetLayouts = &*batchedDescriptorSetLayout;
+    batchedPipelineLayout          = vk::raii::PipelineLayout(device, pipelineLayoutInfo);
+    spdlog::trace("Created pipeline layouts.");
+}
+
+// Cache blobs are only valid for the device and driver that wrote them, so both are part of the file name
+void CVulkanContext::createPipelineCache() {
+    spdlog::trace("Creating pipeline cache.");
+
+    const auto                          properties       = physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>();
+    const vk::PhysicalDeviceProperties& deviceProperties = properties.get<vk::PhysicalDeviceProperties2>().properties;
+    std::ostringstream                  name;
+    name << "pipeline-" << std::hex << std::setfill('0');
+    for (uint8_t byte : properties.get<vk::PhysicalDeviceIDProperties>().deviceUUID) {
+        name << std::setw(2) << static_cast<uint32_t>(byte);
+    }
+    name << "-" << deviceProperties.driverVersion << ".bin";
+    pipelineCacheFile = NCommon::cacheDirectory() / name.str();
+
+    std::vector<char> data;
+    std::ifstream     file(pipelineCacheFile, std::ios::ate | std::ios::binary);
+    if (file.is_open()) {
+        data.resize(file.tellg());
+        file.seekg(0, std::ios::beg);
+        file.read(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+    if (!data.empty() && !pipelineCacheMatches(data, deviceProperties)) {
+        spdlog::debug("Ignoring pipeline cache written by another device or driver: {}", pipelineCacheFile.string());
+        data.clear();
+    }
+
+    pipelineCache = vk::raii::PipelineCache(device, vk::PipelineCacheCreateInfo{.initialDataSize = data.size(), .pInitialData = data.data()});
+    spdlog::debug("Pipeline cache {} ({} bytes)", data.empty() ? "starting empty" : "loaded from " + pipelineCacheFile.string(), data.size());
+}
+
+// Written to a temporary file first so a concurrent run never loads a half written cache
+void CVulkanContext::savePipelineCache() const {
+    if (!*pipelineCache)
+        return;
+
+    const std::vector<uint8_t> data = pipelineCache.getData();
+    std::filesystem::path      temporary = pipelineCacheFile;
+    temporary += ".tmp";
+
+    std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    file.close();
+    if (!file)
+        throw std::runtime_error("Failed to write " + temporary.string());
+
+    std::filesystem::rename(temporary, pipelineCacheFile);
+    spdlog::debug("Saved {} bytes of pipeline cache to {}", data.size(), pipelineCacheFile.string());
+}
+
+vk::raii::Pipeline CVulkanContext::createComputePipeline(const vk::raii::ShaderModule& shaderModule, const vk::raii::PipelineLayout& layout, const SShaderConfig& config) {
+    spdlog::trace("Creating compute pipeline [{}].", config.toString());
+
+    // SShaderConfig is six consecutive uint32_t, one per constant_id
+    std::array<vk::SpecializationMapEntry, 6> specializationEntries;
+    for (uint32_t i = 0; i < specializationEntries.size(); i++) {
+        specializationEntries[i] = vk::SpecializationMapEntry{.constantID = i, .offset = i * static_cast<uint32_t>(sizeof(uint32_t)), .size = sizeof(uint32_t)};
+    }
+    vk::SpecializationInfo specializationInfo{
+        .mapEntryCount = static_cast<uint32_t>(specializationEntries.size()),
+        .pMapEntries   = specializationEntries.data(),
+        .dataSize      = sizeof(SShaderConfig),
+        .pData         = &config,
+    };
+
+    vk::PipelineShaderStageCreateInfo shaderStageInfo{
+        .stage               = vk::ShaderStageFlagBits::eCompute,
+        .module              = shaderModule,
+        .pName               = "main",
+        .pSpecializationInfo = &specializationInfo,
+    };
 
     const vk::ComputePipelineCreateInfo pipelineInfo{
         .stage  = shaderStageInfo,
-        .layout = pipelineLayout,
+        .layout = layout,
     };
-    computePipeline = device.createComputePipeline(VK_NULL_HANDLE, pipelineInfo);
-    spdlog::trace("Created compute pipeline.");
+    vk::raii::Pipeline pipeline = device.createComputePipeline(pipelineCache, pipelineInfo);
 
     spdlog::trace("Successfully created compute pipeline.");
+    return pipeline;
+}
+
+const vk::raii::Pipeline& CVulkanContext::pipelineFor(const SShaderConfig& config) {
+    auto existing = pipelines.find(config);
+    if (existing != pipelines.end())
+        return existing->second;
+
+    return pipelines.emplace(config, createComputePipeline(computeShaderModule, pipelineLayout, config)).first->second;
+}
+
+const vk::raii::Pipeline& CVulkanContext::batchedPipelineFor(const SShaderConfig& config) {
+    auto existing = batchedPipelines.find(config);
+    if (existing != batchedPipelines.end())
+        return existing->second;
+
+    return batchedPipelines.emplace(config, createComputePipeline(batchedShaderModule, batchedPipelineLayout, config)).first->second;
 }
 
 void CVulkanContext::createDescriptorPool() {
     spdlog::trace("Creating Descriptor Pool.");
 
-    vk::DescriptorPoolSize       poolSize{.type = vk::DescriptorType::eStorageBuffer, .descriptorCount = buffers.size()};
+    // One set per cached slot, streaming stage and chain step plus the batch set, freed individually when a slot is evicted
+    vk::DescriptorPoolSize       poolSize{.type            = vk::DescriptorType::eStorageBuffer,
+                                          .descriptorCount = (GEMM_BINDINGS * (MAX_SLOTS + STREAM_DEPTH + MAX_CHAIN - 1)) + BATCHED_BINDINGS};
 
     vk::DescriptorPoolCreateInfo poolInfo{
         .flags         = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
-        .maxSets       = 1,
+        .maxSets       = MAX_SLOTS + STREAM_DEPTH + MAX_CHAIN,
         .poolSizeCount = 1,
         .pPoolSizes    = &poolSize,
     };
@@ -229,142 +513,997 @@ void CVulkanContext::createDescriptorPool() {
     spdlog::trace("Descriptor Pool created successfully.");
 }
 
-void CVulkanContext::createBuffers(float* matrixA, float* matrixB, float* matrixC, int matrix_size) {
-    spdlog::trace("Creating buffers for matrices.");
+// Descriptor set whose binding i covers the whole of buffers[i]
+vk::raii::DescriptorSet CVulkanContext::bindBuffers(std::span<const vk::Buffer> buffers, const vk::raii::DescriptorSetLayout& layout) {
+    vk::DescriptorSetAllocateInfo descriptorAllocInfo{.descriptorPool = *descriptorPool, .descriptorSetCount = 1, .pSetLayouts = &*layout};
+    vk::raii::DescriptorSet       descriptorSet = std::move(device.allocateDescriptorSets(descriptorAllocInfo).front());
+
+    std::vector<vk::DescriptorBufferInfo> bufferInfos(buffers.size());
+    std::vector<vk::WriteDescriptorSet>   descriptorWrites(buffers.size());
+    for (uint32_t i = 0; i < buffers.size(); i++) {
+        bufferInfos[i]      = vk::DescriptorBufferInfo{.buffer = buffers[i], .offset = 0, .range = VK_WHOLE_SIZE};
+        descriptorWrites[i] = vk::WriteDescriptorSet{
+            .dstSet          = *descriptorSet,
+            .dstBinding      = i,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType  = vk::DescriptorType::eStorageBuffer,
+            .pBufferInfo     = &bufferInfos[i],
+        };
+    }
+    device.updateDescriptorSets(descriptorWrites, nullptr);
+    return descriptorSet;
+}
 
-    vk::DeviceSize                    bufferSize       = sizeof(float) * matrix_size * matrix_size;
-    constexpr vk::MemoryPropertyFlags commonProperties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+// Storage buffers for each binding of the layout plus a descriptor set pointing at them. Staged buffers are device
+// local with host visible staging copies, unstaged ones are mapped by the host directly.
+vk::raii::DescriptorSet CVulkanContext::createBindings(std::span<SPooledBuffer> buffers, std::span<SPooledBuffer> staging, std::span<const vk::DeviceSize> sizes,
+                                                       const vk::raii::DescriptorSetLayout& layout, bool staged) {
+    constexpr vk::MemoryPropertyFlags hostProperties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+    constexpr vk::BufferUsageFlags    storageUsage   = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+    constexpr vk::BufferUsageFlags    stagingUsage   = vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+
+    for (uint32_t i = 0; i < buffers.size(); i++) {
+        if (staged) {
+            buffers[i] = bufferPool->acquire(sizes[i], storageUsage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+            staging[i] = bufferPool->acquire(sizes[i], stagingUsage, hostProperties);
+        } else {
+            buffers[i] = bufferPool->acquire(sizes[i], storageUsage, vk::MemoryPropertyFlagBits::eDeviceLocal | hostProperties);
+        }
+    }
 
-    for (size_t i = 0; i < buffers.size(); i++) {
-        buffers[i] = device.createBuffer({
-            .size        = bufferSize,
-            .usage       = vk::BufferUsageFlagBits::eStorageBuffer,
-            .sharingMode = vk::SharingMode::eExclusive,
-        });
-        allocateBufferMemory(buffers[i], bufferMemories[i], commonProperties);
+    std::vector<vk::Buffer> handles;
+    for (const SPooledBuffer& buffer : buffers) {
+        handles.push_back(*buffer.buffer);
+    }
+    return bindBuffers(handles, layout);
+}
+
+CVulkanContext::SGemmSlot& CVulkanContext::acquireSlot(const SGemmPushConstants& params, NCommon::EPrecision storage) {
+    const std::array<vk::DeviceSize, GEMM_BINDINGS> bufferSizes = gemmBufferSizes(params, storage);
+    const SlotKey key = {bufferPool->sizeClass(bufferSizes[0]), bufferPool->sizeClass(bufferSizes[1]), bufferPool->sizeClass(bufferSizes[2])};
+
+    auto          existing = slots.find(key);
+    if (existing != slots.end()) {
+        existing->second.lastUsed = ++dispatchCount;
+        return existing->second;
+    }
+
+    if (slots.size() >= MAX_SLOTS) {
+        auto oldest = slots.begin();
+        for (auto it = slots.begin(); it != slots.end(); ++it) {
+            if (it->second.lastUsed < oldest->second.lastUsed)
+                oldest = it;
+        }
+        spdlog::trace("Evicting least recently used GEMM slot.");
+        for (uint32_t i = 0; i < GEMM_BINDINGS; i++) {
+            bufferPool->release(std::move(oldest->second.buffers[i]));
+            bufferPool->release(std::move(oldest->second.staging[i]));
+        }
+        slots.erase(oldest);
     }
 
-    createDescriptorSets();
+    spdlog::trace("Creating GEMM slot for buffers of {}, {} and {} bytes.", key[0], key[1], key[2]);
+    SGemmSlot slot;
+    slot.descriptorSet = createBindings(slot.buffers, slot.staging, bufferSizes, descriptorSetLayout, !unifiedMemory);
 
-    spdlog::trace("Successfully created buffers for matrices.");
+    vk::CommandBufferAllocateInfo commandAllocInfo{.commandPool = *commandPool, .level = vk::CommandBufferLevel::ePrimary, .commandBufferCount = 1};
+    slot.commandBuffer = std::move(device.allocateCommandBuffers(commandAllocInfo).front());
+    slot.fence         = device.createFence({});
+    if (computeTimestampBits > 0)
+        slot.timestamps = device.createQueryPool({.queryType = vk::QueryType::eTimestamp, .queryCount = TIMESTAMP_QUERIES});
+
+    if (!unifiedMemory) {
+        vk::CommandBufferAllocateInfo transferAllocInfo{.commandPool = *transferCommandPool, .level = vk::CommandBufferLevel::ePrimary, .commandBufferCount = 2};
+        vk::raii::CommandBuffers      transferCommands = device.allocateCommandBuffers(transferAllocInfo);
+
+        slot.uploadCommands   = std::move(transferCommands[0]);
+        slot.readbackCommands = std::move(transferCommands[1]);
+        slot.uploadDone       = device.createSemaphore({});
+        slot.dispatchDone     = device.createSemaphore({});
+    }
+    slot.lastUsed = ++dispatchCount;
+
+    return slots.emplace(key, std::move(slot)).first->second;
 }
 
-void CVulkanContext::createDescriptorSets() {
-    spdlog::trace("Allocating and updating descriptor sets.");
-    std::vector<vk::DescriptorSetLayout> layouts(1, *descriptorSetLayout);
+void CVulkanContext::recordGemm(const vk::raii::CommandBuffer& commandBuffer, const vk::raii::DescriptorSet& descriptorSet, const SGemmPushConstants& params,
+                                const SShaderConfig& config) {
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *pipelineFor(config));
+    commandBuffer.bindDescriptorSets2({
+        .stageFlags         = vk::ShaderStageFlagBits::eCompute,
+        .layout             = *pipelineLayout,
+        .firstSet           = 0,
+        .descriptorSetCount = 1,
+        .pDescriptorSets    = &*descriptorSet,
+    });
+    commandBuffer.pushConstants2({.layout = *pipelineLayout, .stageFlags = vk::ShaderStageFlagBits::eCompute, .offset = 0, .size = sizeof(SGemmPushConstants), .pValues = &params});
 
-    vk::DescriptorSetAllocateInfo        allocInfo{.descriptorPool = descriptorPool, .descriptorSetCount = static_cast<uint32_t>(layouts.size()), .pSetLayouts = layouts.data()};
+    // One workgroup per tileM x tileN block of C
+    commandBuffer.dispatch((params.N + config.tileN() - 1) / config.tileN(), (params.M + config.tileM() - 1) / config.tileM(), 1);
+}
 
-    descriptorSet = std::move(device.allocateDescriptorSets(allocInfo).front());
+void CVulkanContext::recordDispatch(SGemmSlot& slot, const SGemmPushConstants& params, const SShaderConfig& config) {
+    spdlog::trace("Recording dispatch command buffer.");
 
-    vk::DescriptorBufferInfo            bufInfoA{.buffer = buffers[0], .offset = 0, .range = VK_WHOLE_SIZE};
-    vk::DescriptorBufferInfo            bufInfoB{.buffer = buffers[1], .offset = 0, .range = VK_WHOLE_SIZE};
-    vk::DescriptorBufferInfo            bufInfoC{.buffer = buffers[2], .offset = 0, .range = VK_WHOLE_SIZE};
-    std::vector<vk::WriteDescriptorSet> descriptorWrites(buffers.size());
+    slot.commandBuffer.reset();
+    vk::CommandBufferBeginInfo beginInfo{};
+    slot.commandBuffer.begin(beginInfo);
+    // Written at the compute stage so the begin timestamp also waits for the upload semaphore
+    if (*slot.timestamps) {
+        slot.commandBuffer.resetQueryPool(*slot.timestamps, DISPATCH_QUERY, 2);
+        slot.commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, *slot.timestamps, DISPATCH_QUERY);
+    }
 
-    descriptorWrites[0] = vk::WriteDescriptorSet{
-        .dstSet          = descriptorSet,
-        .dstBinding      = 0,
-        .dstArrayElement = 0,
-        .descriptorCount = 1,
-        .descriptorType  = vk::DescriptorType::eStorageBuffer,
-        .pBufferInfo     = &bufInfoA,
-    };
+    recordGemm(slot.commandBuffer, slot.descriptorSet, params, config);
+    if (*slot.timestamps)
+        slot.commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, *slot.timestamps, DISPATCH_QUERY + 1);
 
-    descriptorWrites[1] = vk::WriteDescriptorSet{
-        .dstSet          = descriptorSet,
-        .dstBinding      = 1,
-        .dstArrayElement = 0,
-        .descriptorCount = 1,
-        .descriptorType  = vk::DescriptorType::eStorageBuffer,
-        .pBufferInfo     = &bufInfoB,
-    };
+    // On unified memory the host reads C straight out of the storage buffer
+    if (unifiedMemory) {
+        vk::MemoryBarrier toHost{.srcAccessMask = vk::AccessFlagBits::eShaderWrite, .dstAccessMask = vk::AccessFlagBits::eHostRead};
+        slot.commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, toHost, nullptr, nullptr);
+    }
+    slot.commandBuffer.end();
 
-    descriptorWrites[2] = vk::WriteDescriptorSet{
-        .dstSet          = descriptorSet,
-        .dstBinding      = 2,
-        .dstArrayElement = 0,
-        .descriptorCount = 1,
-        .descriptorType  = vk::DescriptorType::eStorageBuffer,
-        .pBufferInfo     = &bufInfoC,
-    };
+    slot.recordedParams = params;
+    slot.recordedConfig = config;
+}
 
-    device.updateDescriptorSets(descriptorWrites, nullptr);
+void CVulkanContext::recordTransfers(SGemmSlot& slot, const SGemmPushConstants& params, NCommon::EPrecision storage) {
+    spdlog::trace("Recording staging transfer command buffers.");
+
+    const std::array<vk::DeviceSize, GEMM_BINDINGS> bufferSizes = gemmBufferSizes(params, storage);
+
+    // C only has to go up when beta folds it into the result
+    const uint32_t uploads    = params.beta != 0.0f ? 3 : 2;
+    // vkCmdResetQueryPool needs a graphics or compute queue, so these queries are reset by the host before each submit
+    const bool     timestamps = *slot.timestamps && transferTimestampBits > 0;
+    slot.uploadCommands.reset();
+    slot.uploadCommands.begin({});
+    if (timestamps)
+        slot.uploadCommands.writeTimestamp(vk::PipelineStageFlagBits::eTransfer, *slot.timestamps, UPLOAD_QUERY);
+    for (uint32_t i = 0; i < uploads; i++) {
+        if (bufferSizes[i] > 0)
+            slot.uploadCommands.copyBuffer(*slot.staging[i].buffer, *slot.buffers[i].buffer, vk::BufferCopy{.srcOffset = 0, .dstOffset = 0, .size = bufferSizes[i]});
+    }
+    if (timestamps)
+        slot.uploadCommands.writeTimestamp(vk::PipelineStageFlagBits::eTransfer, *slot.timestamps, UPLOAD_QUERY + 1);
+    slot.uploadCommands.end();
+
+    slot.readbackCommands.reset();
+    slot.readbackCommands.begin({});
+    if (timestamps)
+        slot.readbackCommands.writeTimestamp(vk::PipelineStageFlagBits::eTransfer, *slot.timestamps, READBACK_QUERY);
+    slot.readbackCommands.copyBuffer(*slot.buffers[2].buffer, *slot.staging[2].buffer, vk::BufferCopy{.srcOffset = 0, .dstOffset = 0, .size = bufferSizes[2]});
+    if (timestamps)
+        slot.readbackCommands.writeTimestamp(vk::PipelineStageFlagBits::eTransfer, *slot.timestamps, READBACK_QUERY + 1);
+    vk::MemoryBarrier toHost{.srcAccessMask = vk::AccessFlagBits::eTransferWrite, .dstAccessMask = vk::AccessFlagBits::eHostRead};
+    slot.readbackCommands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, {}, toHost, nullptr, nullptr);
+    slot.readbackCommands.end();
+}
+
+void* CVulkanContext::hostPointer(SGemmSlot& slot, uint32_t binding) {
+    return unifiedMemory ? slot.buffers[binding].mapped : slot.staging[binding].mapped;
+}
+
+SGemmTiming CVulkanContext::sgemm(uint32_t M, uint32_t N, uint32_t K, float alpha, const float* matrixA, uint32_t lda, const float* matrixB, uint32_t ldb, float beta, float* matrixC,
+                                  uint32_t ldc) {
+    return sgemmStored(M, N, K, alpha, matrixA, lda, matrixB, ldb, beta, matrixC, ldc, NCommon::EPrecision::Float32);
+}
+
+SGemmTiming CVulkanContext::sgemm(uint32_t M, uint32_t N, uint32_t K, float alpha, const NCommon::SFloat16* matrixA, uint32_t lda, const NCommon::SFloat16* matrixB,
+                                  uint32_t ldb, float beta, float* matrixC, uint32_t ldc) {
+    return sgemmStored(M, N, K, alpha, matrixA, lda, matrixB, ldb, beta, matrixC, ldc, NCommon::EPrecision::Float16);
+}
+
+SGemmTiming CVulkanContext::sgemm(uint32_t M, uint32_t N, uint32_t K, float alpha, const NCommon::SBFloat16* matrixA, uint32_t lda, const NCommon::SBFloat16* matrixB,
+                                  uint32_t ldb, float beta, float* matrixC, uint32_t ldc) {
+    return sgemmStored(M, N, K, alpha, matrixA, lda, matrixB, ldb, beta, matrixC, ldc, NCommon::EPrecision::BFloat16);
+}
+
+SGemmTiming CVulkanContext::sgemmStored(uint32_t M, uint32_t N, uint32_t K, float alpha, const void* matrixA, uint32_t lda, const void* matrixB, uint32_t ldb, float beta,
+                                        float* matrixC, uint32_t ldc, NCommon::EPrecision storage) {
+    if (M == 0 || N == 0)
+        return {};
+    if (lda < std::max(K, 1u) || ldb < N || ldc < N) {
+        throw std::runtime_error("Leading dimensions are smaller than the matrix rows they describe.");
+    }
 
-    spdlog::trace("Successfully allocated descriptor sets.");
+    SShaderConfig config = configFor(M, N, K);
+    config.storage       = storage;
+    return runGemm(matrixA, matrixB, matrixC, {.M = M, .N = N, .K = K, .lda = lda, .ldb = ldb, .ldc = ldc, .alpha = alpha, .beta = beta}, config);
 }
 
-uint32_t CVulkanContext::findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties) {
-    spdlog::trace("Finding suitable memory type.");
-    vk::PhysicalDeviceMemoryProperties memProperties = physicalDevice.getMemoryProperties();
+SGemmTiming CVulkanContext::runComputeShader(const float* matrixA, const float* matrixB, float* matrixC, const SGemmPushConstants& params) {
+    return runComputeShader(matrixA, matrixB, matrixC, params, configFor(params.M, params.N, params.K));
+}
+
+SGemmTiming CVulkanContext::runComputeShader(const float* matrixA, const float* matrixB, float* matrixC, const SGemmPushConstants& params, const SShaderConfig& config) {
+    if (config.storage != NCommon::EPrecision::Float32)
+        throw std::runtime_error("fp32 inputs cannot run a shader configuration for 16-bit storage.");
+    return runGemm(matrixA, matrixB, matrixC, params, config);
+}
+
+SGemmTiming CVulkanContext::runGemm(const void* matrixA, const void* matrixB, float* matrixC, const SGemmPushConstants& params, const SShaderConfig& config) {
+    spdlog::trace("Running compute shader [{}].", config.toString());
+
+    // The shader indexes A, B and C in elements with 32 bit arithmetic, so the last element of each has to be reachable
+    const vk::DeviceSize lastIndex = std::max({matrixBytes(params.M, params.K, params.lda, 1), matrixBytes(params.K, params.N, params.ldb, 1),
+                                               matrixBytes(params.M, params.N, params.ldc, 1)});
+    if (lastIndex > std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("Matrices are too large for 32 bit indices, use --stream to multiply them in tiles.");
+
+    SGemmTiming                                 timing;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    SGemmSlot&                                  slot = acquireSlot(params, config.storage);
+    timing.acquireSeconds                            = secondsSince(start);
+
+    // Host copies land in the persistently mapped staging buffers, or straight in the storage buffers on unified memory.
+    // Only the bytes of A and B are copied, the shader never reads the unused half of a trailing 16-bit word.
+    std::chrono::steady_clock::time_point phase        = std::chrono::steady_clock::now();
+    const vk::DeviceSize                  elementBytes = NCommon::bytesPerElement(config.storage);
+    std::memcpy(hostPointer(slot, 0), matrixA, matrixBytes(params.M, params.K, params.lda, elementBytes));
+    std::memcpy(hostPointer(slot, 1), matrixB, matrixBytes(params.K, params.N, params.ldb, elementBytes));
+    // C is only read by the shader when it is scaled into the result
+    if (params.beta != 0.0f) {
+        std::memcpy(hostPointer(slot, 2), matrixC, matrixBytes(params.M, params.N, params.ldc));
+    }
+    timing.copyInSeconds = secondsSince(phase);
+
+    // Repeated calls with the same shape reuse the recorded command buffers as is
+    phase = std::chrono::steady_clock::now();
+    if (slot.recordedParams != params || slot.recordedConfig != config) {
+        recordDispatch(slot, params, config);
+        if (!unifiedMemory)
+            recordTransfers(slot, params, config.storage);
+    }
+    timing.recordSeconds = secondsSince(phase);
 
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            spdlog::trace("Found suitable memory type: {}", i);
-            return i;
+    phase = std::chrono::steady_clock::now();
+    if (unifiedMemory) {
+        vk::SubmitInfo submitInfo{
+            .commandBufferCount = 1,
+            .pCommandBuffers    = &*slot.commandBuffer,
+        };
+        computeQueue.submit(submitInfo, *slot.fence);
+    } else {
+        // The previous submit has been waited for, so the transfer queries are free to reset
+        if (*slot.timestamps && transferTimestampBits > 0) {
+            slot.timestamps.reset(UPLOAD_QUERY, 2);
+            slot.timestamps.reset(READBACK_QUERY, 2);
         }
+
+        // upload (transfer queue) -> dispatch (compute queue) -> readback (transfer queue), chained by semaphores
+        const vk::PipelineStageFlags computeWait  = vk::PipelineStageFlagBits::eComputeShader;
+        const vk::PipelineStageFlags transferWait = vk::PipelineStageFlagBits::eTransfer;
+
+        vk::SubmitInfo               uploadInfo{
+            .commandBufferCount   = 1,
+            .pCommandBuffers      = &*slot.uploadCommands,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores    = &*slot.uploadDone,
+        };
+        transferQueue.submit(uploadInfo);
+
+        vk::SubmitInfo dispatchInfo{
+            .waitSemaphoreCount   = 1,
+            .pWaitSemaphores      = &*slot.uploadDone,
+            .pWaitDstStageMask    = &computeWait,
+            .commandBufferCount   = 1,
+            .pCommandBuffers      = &*slot.commandBuffer,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores    = &*slot.dispatchDone,
+        };
+        computeQueue.submit(dispatchInfo);
+
+        vk::SubmitInfo readbackInfo{
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores    = &*slot.dispatchDone,
+            .pWaitDstStageMask  = &transferWait,
+            .commandBufferCount = 1,
+            .pCommandBuffers    = &*slot.readbackCommands,
+        };
+        transferQueue.submit(readbackInfo, *slot.fence);
     }
 
-    throw std::runtime_error("Failed to find suitable memory type.");
+    auto fenceResult = device.waitForFences(*slot.fence, VK_TRUE, UINT64_MAX);
+    if (fenceResult != vk::Result::eSuccess) {
+        throw std::runtime_error("Failed to wait for fence.");
+    }
+    device.resetFences(*slot.fence);
+    timing.executeSeconds = secondsSince(phase);
+
+    if (*slot.timestamps) {
+        timing.gpuDispatchSeconds = timestampSeconds(slot.timestamps, DISPATCH_QUERY, computeTimestampBits, timestampPeriod);
+        if (!unifiedMemory && transferTimestampBits > 0) {
+            timing.gpuUploadSeconds   = timestampSeconds(slot.timestamps, UPLOAD_QUERY, transferTimestampBits, timestampPeriod);
+            timing.gpuReadbackSeconds = timestampSeconds(slot.timestamps, READBACK_QUERY, transferTimestampBits, timestampPeriod);
+        }
+    }
+
+    // Short jobs are dominated by instance, device and pipeline creation, so report how long the first result took
+    if (!coldStartSeconds) {
+        coldStartSeconds = secondsSince(constructedAt);
+        spdlog::info("Cold start to first dispatch completed in {} seconds", *coldStartSeconds);
+    }
+
+    // Only the M x N window is copied back so padding columns of C are left untouched
+    phase               = std::chrono::steady_clock::now();
+    const float* mapped = static_cast<const float*>(hostPointer(slot, 2));
+    for (uint32_t row = 0; row < params.M; row++) {
+        std::memcpy(matrixC + (static_cast<size_t>(row) * params.ldc), mapped + (static_cast<size_t>(row) * params.ldc), sizeof(float) * params.N);
+    }
+    timing.copyOutSeconds = secondsSince(phase);
+    timing.totalSeconds   = secondsSince(start);
+
+    spdlog::debug("GEMM {}x{}x{}: acquire {} s, copy in {} s, record {} s, execute {} s (GPU upload {} s, dispatch {} s, readback {} s), copy out {} s", params.M, params.N,
+                  params.K, timing.acquireSeconds, timing.copyInSeconds, timing.recordSeconds, timing.executeSeconds, timing.gpuUploadSeconds, timing.gpuDispatchSeconds,
+                  timing.gpuReadbackSeconds, timing.copyOutSeconds);
+    return timing;
 }
 
-void CVulkanContext::allocateBufferMemory(vk::raii::Buffer& buffer, vk::raii::DeviceMemory& bufferMemory, vk::MemoryPropertyFlags properties) {
-    vk::MemoryRequirements memRequirements = buffer.getMemoryRequirements();
-    vk::MemoryAllocateInfo allocInfo{
-        .allocationSize  = memRequirements.size,
-        .memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties),
+std::vector<SShaderConfig> CVulkanContext::candidateConfigs() const {
+    const vk::PhysicalDeviceLimits limits = physicalDevice.getProperties().limits;
+
+    // Workgroup shapes and per-invocation output tiles to try, crossed with the K tile depths
+    constexpr std::array<std::pair<uint32_t, uint32_t>, 4> workgroups{{{8, 8}, {16, 8}, {16, 16}, {32, 8}}};
+    constexpr std::array<std::pair<uint32_t, uint32_t>, 4> threadTiles{{{1, 1}, {2, 2}, {4, 4}, {8, 4}}};
+    constexpr std::array<uint32_t, 3>                      tileDepths{8, 16, 32};
+
+    std::vector<SShaderConfig>                             candidates;
+    for (const auto& [workgroupX, workgroupY] : workgroups) {
+        for (uint32_t tileK : tileDepths) {
+            for (const auto& [threadM, threadN] : threadTiles) {
+                const SShaderConfig config{.workgroupX = workgroupX, .workgroupY = workgroupY, .tileK = tileK, .threadM = threadM, .threadN = threadN};
+                const size_t        sharedBytes = sizeof(float) * ((config.tileM() * tileK) + (tileK * config.tileN()));
+
+                if (workgroupX * workgroupY > limits.maxComputeWorkGroupInvocations || workgroupX > limits.maxComputeWorkGroupSize[0] ||
+                    workgroupY > limits.maxComputeWorkGroupSize[1] || sharedBytes > limits.maxComputeSharedMemorySize)
+                    continue;
+                candidates.push_back(config);
+            }
+        }
+    }
+    return candidates;
+}
+
+SShaderConfig CVulkanContext::configFor(uint32_t M, uint32_t N, uint32_t K) const {
+    auto tuned = tunedConfigs.find({M, N, K});
+    return tuned != tunedConfigs.end() ? tuned->second : SShaderConfig{};
+}
+
+// Cache lines are "M N K workgroupX workgroupY tileK threadM threadN deviceName", later lines win
+void CVulkanContext::loadAutotuneCache() {
+    std::ifstream file(NCommon::cacheDirectory() / "autotune.txt");
+    std::string   line;
+    while (std::getline(file, line)) {
+        std::istringstream stream(line);
+        ShapeKey           shape;
+        SShaderConfig      config;
+        std::string        name;
+        if (!(stream >> shape[0] >> shape[1] >> shape[2] >> config.workgroupX >> config.workgroupY >> config.tileK >> config.threadM >> config.threadN))
+            continue;
+        std::getline(stream >> std::ws, name);
+        if (name == deviceName)
+            tunedConfigs[shape] = config;
+    }
+    spdlog::debug("Loaded {} autotuned shader configurations for {}", tunedConfigs.size(), deviceName);
+}
+
+SShaderConfig CVulkanContext::autotune(uint32_t M, uint32_t N, uint32_t K, size_t repeats) {
+    spdlog::info("Autotuning compute shader for {}x{}x{} on {}", M, N, K, deviceName);
+
+    std::vector<float>       matrixA(static_cast<size_t>(M) * K, 1.0f);
+    std::vector<float>       matrixB(static_cast<size_t>(K) * N, 1.0f);
+    std::vector<float>       matrixC(static_cast<size_t>(M) * N, 0.0f);
+    const SGemmPushConstants params{.M = M, .N = N, .K = K, .lda = K, .ldb = N, .ldc = N, .alpha = 1.0f, .beta = 0.0f};
+
+    SShaderConfig            best;
+    double                   bestSeconds = std::numeric_limits<double>::max();
+    for (const SShaderConfig& config : candidateConfigs()) {
+        try {
+            // First run builds the pipeline and records the command buffers
+            runComputeShader(matrixA.data(), matrixB.data(), matrixC.data(), params, config);
+
+            // Kernel time when the device has timestamps, so transfers do not blur the ranking
+            double fastest = std::numeric_limits<double>::max();
+            for (size_t i = 0; i < repeats; i++) {
+                const SGemmTiming timing = runComputeShader(matrixA.data(), matrixB.data(), matrixC.data(), params, config);
+                fastest                  = std::min(fastest, timing.gpuDispatchSeconds > 0.0 ? timing.gpuDispatchSeconds : timing.totalSeconds);
+            }
+            spdlog::debug("[{}] {} seconds", config.toString(), fastest);
+
+            if (fastest < bestSeconds) {
+                bestSeconds = fastest;
+                best        = config;
+            }
+        } catch (const vk::SystemError& err) {
+            spdlog::debug("[{}] rejected by the driver: {}", config.toString(), err.what());
+        }
+    }
+
+    spdlog::info("Best configuration: {} ({} seconds)", best.toString(), bestSeconds);
+    tunedConfigs[{M, N, K}] = best;
+
+    std::ofstream file(NCommon::cacheDirectory() / "autotune.txt", std::ios::app);
+    file << M << " " << N << " " << K << " " << best.workgroupX << " " << best.workgroupY << " " << best.tileK << " " << best.threadM << " " << best.threadN << " " << deviceName
+         << "\n";
+
+    return best;
+}
+
+// Widest column band whose B band fits one streaming buffer, then the tallest row band whose A band and C tile fit
+std::pair<uint32_t, uint32_t> CVulkanContext::streamBands(uint32_t M, uint32_t N, uint32_t K) const {
+    const vk::DeviceSize limit    = std::min<vk::DeviceSize>(STREAM_BUFFER_BYTES, physicalDevice.getProperties().limits.maxStorageBufferRange);
+    const vk::DeviceSize rowBytes = sizeof(float) * static_cast<vk::DeviceSize>(std::max(K, 1u));
+    if (rowBytes > limit)
+        throw std::runtime_error("K is too large to stream a single row of A through the device.");
+
+    const uint32_t bandCols = static_cast<uint32_t>(std::min<vk::DeviceSize>(N, limit / rowBytes));
+    uint32_t       bandRows = static_cast<uint32_t>(std::min<vk::DeviceSize>({M, limit / rowBytes, limit / (sizeof(float) * bandCols)}));
+    bandRows                = std::min(bandRows, std::max(64u, (M + STREAM_MIN_BANDS - 1) / STREAM_MIN_BANDS));
+    return {bandRows, bandCols};
+}
+
+// Stages are kept between calls and only reallocated when a larger band is requested
+void CVulkanContext::prepareStreamStages(const std::array<vk::DeviceSize, 3>& sizes) {
+    for (vk::raii::Semaphore& timeline : streamTimelines) {
+        if (!*timeline) {
+            vk::SemaphoreTypeCreateInfo timelineInfo{.semaphoreType = vk::SemaphoreType::eTimeline, .initialValue = streamTimelineValue};
+            timeline = device.createSemaphore({.pNext = &timelineInfo});
+        }
+    }
+
+    const bool fits = !streamStages.empty() && std::ranges::all_of(streamStages, [&sizes](const SStreamStage& stage) {
+        return stage.buffers[0].size >= sizes[0] && stage.buffers[1].size >= sizes[1] && stage.buffers[2].size >= sizes[2];
+    });
+    if (fits)
+        return;
+
+    spdlog::trace("Creating {} streaming stages for bands of {}, {} and {} bytes.", STREAM_DEPTH, sizes[0], sizes[1], sizes[2]);
+    for (SStreamStage& stage : streamStages) {
+        for (uint32_t i = 0; i < GEMM_BINDINGS; i++) {
+            bufferPool->release(std::move(stage.buffers[i]));
+            bufferPool->release(std::move(stage.staging[i]));
+        }
+    }
+    streamStages.clear();
+
+    vk::CommandBufferAllocateInfo computeAllocInfo{.commandPool = *commandPool, .level = vk::CommandBufferLevel::ePrimary, .commandBufferCount = STREAM_DEPTH};
+    vk::CommandBufferAllocateInfo transferAllocInfo{.commandPool = *transferCommandPool, .level = vk::CommandBufferLevel::ePrimary, .commandBufferCount = 2 * STREAM_DEPTH};
+    vk::raii::CommandBuffers      computeCommands  = device.allocateCommandBuffers(computeAllocInfo);
+    vk::raii::CommandBuffers      transferCommands = device.allocateCommandBuffers(transferAllocInfo);
+    for (uint32_t i = 0; i < STREAM_DEPTH; i++) {
+        SStreamStage stage;
+        stage.descriptorSet    = createBindings(stage.buffers, stage.staging, sizes, descriptorSetLayout, true);
+        stage.uploadCommands   = std::move(transferCommands[2 * i]);
+        stage.commandBuffer    = std::move(computeCommands[i]);
+        stage.readbackCommands = std::move(transferCommands[(2 * i) + 1]);
+        streamStages.push_back(std::move(stage));
+    }
+}
+
+void CVulkanContext::recordStreamTile(SStreamStage& stage, const SGemmPushConstants& params, const SShaderConfig& config) {
+    // Bands are packed tightly into the stage buffers, so the leading dimensions equal the band widths
+    const std::array<vk::DeviceSize, GEMM_BINDINGS> bytes = {
+        sizeof(float) * static_cast<vk::DeviceSize>(params.M) * params.K,
+        sizeof(float) * static_cast<vk::DeviceSize>(params.K) * params.N,
+        sizeof(float) * static_cast<vk::DeviceSize>(params.M) * params.N,
     };
-    bufferMemory = vk::raii::DeviceMemory(device, allocInfo);
-    buffer.bindMemory(*bufferMemory, 0);
+
+    const uint32_t uploads = params.beta != 0.0f ? 3 : 2;
+    stage.uploadCommands.reset();
+    stage.uploadCommands.begin({.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    for (uint32_t i = 0; i < uploads; i++) {
+        if (bytes[i] > 0)
+            stage.uploadCommands.copyBuffer(*stage.staging[i].buffer, *stage.buffers[i].buffer, vk::BufferCopy{.srcOffset = 0, .dstOffset = 0, .size = bytes[i]});
+    }
+    stage.uploadCommands.end();
+
+    stage.commandBuffer.reset();
+    stage.commandBuffer.begin({.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    recordGemm(stage.commandBuffer, stage.descriptorSet, params, config);
+    stage.commandBuffer.end();
+
+    stage.readbackCommands.reset();
+    stage.readbackCommands.begin({.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    stage.readbackCommands.copyBuffer(*stage.buffers[2].buffer, *stage.staging[2].buffer, vk::BufferCopy{.srcOffset = 0, .dstOffset = 0, .size = bytes[2]});
+    vk::MemoryBarrier toHost{.srcAccessMask = vk::AccessFlagBits::eTransferWrite, .dstAccessMask = vk::AccessFlagBits::eHostRead};
+    stage.readbackCommands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, {}, toHost, nullptr, nullptr);
+    stage.readbackCommands.end();
 }
 
-std::vector<float> CVulkanContext::runComputeShader(float* matrixA, float* matrixB, size_t matrix_size) {
-    spdlog::trace("Running compute shader.");
-    std::vector<float> matrixC(matrix_size * matrix_size, 0.0f);
+SGemmTiming CVulkanContext::sgemmStreamed(uint32_t M, uint32_t N, uint32_t K, float alpha, const float* matrixA, uint32_t lda, const float* matrixB, uint32_t ldb, float beta,
+                                          float* matrixC, uint32_t ldc, uint32_t bandRows, uint32_t bandCols) {
+    if (M == 0 || N == 0)
+        return {};
+    if (lda < std::max(K, 1u) || ldb < N || ldc < N) {
+        throw std::runtime_error("Leading dimensions are smaller than the matrix rows they describe.");
+    }
 
-    spdlog::trace("Resetting descriptor pool.");
-    descriptorPool.reset();
+    SGemmTiming                                 timing;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-    createBuffers(matrixA, matrixB, matrixC.data(), matrix_size);
+    const auto [defaultRows, defaultCols] = streamBands(M, N, K);
+    bandRows                              = std::min(bandRows == 0 ? defaultRows : bandRows, M);
+    bandCols                              = std::min(bandCols == 0 ? defaultCols : bandCols, N);
+    prepareStreamStages({
+        sizeof(float) * std::max<vk::DeviceSize>(static_cast<vk::DeviceSize>(bandRows) * K, 1),
+        sizeof(float) * std::max<vk::DeviceSize>(static_cast<vk::DeviceSize>(K) * bandCols, 1),
+        sizeof(float) * static_cast<vk::DeviceSize>(bandRows) * bandCols,
+    });
+    timing.acquireSeconds = secondsSince(start);
+
+    // Tiles of C in row-major order. Tile t signals base + t + 1 on the uploaded, computed and read back timelines in turn.
+    const uint32_t      rowBands = (M + bandRows - 1) / bandRows;
+    const uint32_t      colBands = (N + bandCols - 1) / bandCols;
+    const uint32_t      tiles    = rowBands * colBands;
+    const uint64_t      base     = streamTimelineValue;
+    const SShaderConfig config   = configFor(bandRows, bandCols, K);
+    spdlog::debug("Streaming {}x{}x{} GEMM as {}x{} tiles of {}x{}", M, N, K, rowBands, colBands, bandRows, bandCols);
+
+    struct STile {
+        uint32_t           row;
+        uint32_t           col;
+        SGemmPushConstants params;
+    };
+    auto tileAt = [&](uint32_t tile) {
+        const uint32_t row  = (tile / colBands) * bandRows;
+        const uint32_t col  = (tile % colBands) * bandCols;
+        const uint32_t rows = std::min(bandRows, M - row);
+        const uint32_t cols = std::min(bandCols, N - col);
+        return STile{.row = row, .col = col, .params = {.M = rows, .N = cols, .K = K, .lda = K, .ldb = cols, .ldc = cols, .alpha = alpha, .beta = beta}};
+    };
 
-    vk::CommandBufferAllocateInfo allocInfo{.commandPool = commandPool, .level = vk::CommandBufferLevel::ePrimary, .commandBufferCount = 1};
-    commandBuffer = std::move(device.allocateCommandBuffers(allocInfo).front());
+    // Waits for the tile's readback and copies it out of its stage
+    auto finishTile = [&](uint32_t tile) {
+        const uint64_t              value = base + tile + 1;
+        const vk::SemaphoreWaitInfo waitInfo{.semaphoreCount = 1, .pSemaphores = &*streamTimelines[STREAM_READ_BACK], .pValues = &value};
+        if (device.waitSemaphores(waitInfo, UINT64_MAX) != vk::Result::eSuccess)
+            throw std::runtime_error("Failed to wait for streamed tile.");
+
+        const std::chrono::steady_clock::time_point phase  = std::chrono::steady_clock::now();
+        const STile                                 t      = tileAt(tile);
+        const float*                                mapped = static_cast<const float*>(streamStages[tile % STREAM_DEPTH].staging[2].mapped);
+        for (uint32_t r = 0; r < t.params.M; r++) {
+            std::memcpy(matrixC + (static_cast<size_t>(t.row + r) * ldc) + t.col, mapped + (static_cast<size_t>(r) * t.params.N), sizeof(float) * t.params.N);
+        }
+        timing.copyOutSeconds += secondsSince(phase);
+    };
 
-    vk::CommandBufferBeginInfo beginInfo{};
-    commandBuffer.begin(beginInfo);
+    // Packs the tile's bands into its stage, once the tile that used the stage before has been read back
+    auto uploadTile = [&](uint32_t tile) {
+        if (tile >= STREAM_DEPTH)
+            finishTile(tile - STREAM_DEPTH);
+
+        const std::chrono::steady_clock::time_point phase = std::chrono::steady_clock::now();
+        SStreamStage&                               stage = streamStages[tile % STREAM_DEPTH];
+        const STile                                 t     = tileAt(tile);
+        float*                                      a     = static_cast<float*>(stage.staging[0].mapped);
+        float*                                      b     = static_cast<float*>(stage.staging[1].mapped);
+        float*                                      c     = static_cast<float*>(stage.staging[2].mapped);
+        for (uint32_t r = 0; r < t.params.M && K > 0; r++) {
+            std::memcpy(a + (static_cast<size_t>(r) * K), matrixA + (static_cast<size_t>(t.row + r) * lda), sizeof(float) * K);
+        }
+        for (uint32_t k = 0; k < K; k++) {
+            std::memcpy(b + (static_cast<size_t>(k) * t.params.N), matrixB + (static_cast<size_t>(k) * ldb) + t.col, sizeof(float) * t.params.N);
+        }
+        for (uint32_t r = 0; r < t.params.M && beta != 0.0f; r++) {
+            std::memcpy(c + (static_cast<size_t>(r) * t.params.N), matrixC + (static_cast<size_t>(t.row + r) * ldc) + t.col, sizeof(float) * t.params.N);
+        }
+        timing.copyInSeconds += secondsSince(phase);
 
-    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *computePipeline);
-    commandBuffer.bindDescriptorSets2({
+        recordStreamTile(stage, t.params, config);
+        submitTimeline(transferQueue, stage.uploadCommands, streamTimelines[STREAM_UPLOADED], 0, {}, streamTimelines[STREAM_UPLOADED], base + tile + 1);
+    };
+
+    // The transfer queue sees upload t + 1 ahead of readback t, so the next upload runs while tile t computes
+    const std::chrono::steady_clock::time_point phase = std::chrono::steady_clock::now();
+    try {
+        uploadTile(0);
+        for (uint32_t tile = 0; tile < tiles; tile++) {
+            const SStreamStage& stage = streamStages[tile % STREAM_DEPTH];
+            const uint64_t      value = base + tile + 1;
+            submitTimeline(computeQueue, stage.commandBuffer, streamTimelines[STREAM_UPLOADED], value, vk::PipelineStageFlagBits::eComputeShader, streamTimelines[STREAM_COMPUTED],
+                           value);
+            if (tile + 1 < tiles)
+                uploadTile(tile + 1);
+            submitTimeline(transferQueue, stage.readbackCommands, streamTimelines[STREAM_COMPUTED], value, vk::PipelineStageFlagBits::eTransfer, streamTimelines[STREAM_READ_BACK],
+                           value);
+        }
+        for (uint32_t tile = tiles > STREAM_DEPTH ? tiles - STREAM_DEPTH : 0; tile < tiles; tile++) {
+            finishTile(tile);
+        }
+    } catch (...) {
+        // Tiles submitted so far may still run and signal values up to base + tiles. Let them drain before the stages are
+        // recorded again, and start the next multiply above every value this one could have signalled.
+        try {
+            computeQueue.waitIdle();
+            transferQueue.waitIdle();
+        } catch (const vk::SystemError& err) {
+            spdlog::warn("Failed to drain the queues after a failed stream: {}", err.what());
+        }
+        streamTimelineValue = base + tiles;
+        throw;
+    }
+    streamTimelineValue   = base + tiles;
+
+    timing.executeSeconds = secondsSince(phase) - timing.copyInSeconds - timing.copyOutSeconds;
+    timing.totalSeconds   = secondsSince(start);
+    return timing;
+}
+
+SGemmTiming CVulkanContext::sgemmStridedBatched(uint32_t M, uint32_t N, uint32_t K, float alpha, const float* matrixA, uint32_t lda, size_t strideA, const float* matrixB,
+                                                uint32_t ldb, size_t strideB, float beta, float* matrixC, uint32_t ldc, size_t strideC, uint32_t batchCount) {
+    std::vector<SGemmBatchProblem> problems(batchCount);
+    for (uint32_t i = 0; i < batchCount; i++) {
+        problems[i] = SGemmBatchProblem{
+            .M     = M,
+            .N     = N,
+            .K     = K,
+            .alpha = alpha,
+            .A     = matrixA + (i * strideA),
+            .lda   = lda,
+            .B     = matrixB + (i * strideB),
+            .ldb   = ldb,
+            .beta  = beta,
+            .C     = matrixC + (i * strideC),
+            .ldc   = ldc,
+        };
+    }
+    return sgemmBatched(problems);
+}
+
+// The batch slot only grows, so a steady stream of similar batches reuses its buffers and command buffer
+CVulkanContext::SBatchSlot& CVulkanContext::acquireBatchSlot(const std::array<vk::DeviceSize, 4>& sizes) {
+    if (batchSlot) {
+        bool fits = true;
+        for (uint32_t i = 0; i < BATCHED_BINDINGS; i++) {
+            fits = fits && batchSlot->buffers[i].size >= sizes[i];
+        }
+        if (fits)
+            return *batchSlot;
+
+        for (uint32_t i = 0; i < BATCHED_BINDINGS; i++) {
+            bufferPool->release(std::move(batchSlot->buffers[i]));
+            bufferPool->release(std::move(batchSlot->staging[i]));
+        }
+        batchSlot.reset();
+    }
+
+    spdlog::trace("Creating batch slot for buffers of {}, {}, {} and {} bytes.", sizes[0], sizes[1], sizes[2], sizes[3]);
+    SBatchSlot                    slot;
+    std::array<vk::DeviceSize, 4> classSizes;
+    for (uint32_t i = 0; i < BATCHED_BINDINGS; i++) {
+        classSizes[i] = bufferPool->sizeClass(sizes[i]);
+    }
+    slot.descriptorSet = createBindings(slot.buffers, slot.staging, classSizes, batchedDescriptorSetLayout, !unifiedMemory);
+
+    vk::CommandBufferAllocateInfo commandAllocInfo{.commandPool = *commandPool, .level = vk::CommandBufferLevel::ePrimary, .commandBufferCount = 1};
+    slot.commandBuffer = std::move(device.allocateCommandBuffers(commandAllocInfo).front());
+    slot.fence         = device.createFence({});
+
+    batchSlot.emplace(std::move(slot));
+    return *batchSlot;
+}
+
+SGemmTiming CVulkanContext::sgemmBatched(std::span<const SGemmBatchProblem> problems) {
+    if (problems.empty())
+        return {};
+
+    SGemmTiming                                 timing;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Offsets table for problems packed back to back, each matrix with its leading dimension equal to its width
+    std::vector<SBatchEntry>                    entries(problems.size());
+    uint64_t                                    floatsA = 0, floatsB = 0, floatsC = 0;
+    uint32_t                                    maxM = 0, maxN = 0, maxK = 0;
+    bool                                        readsC = false;
+    for (size_t i = 0; i < problems.size(); i++) {
+        const SGemmBatchProblem& problem = problems[i];
+        if (problem.lda < std::max(problem.K, 1u) || problem.ldb < problem.N || problem.ldc < problem.N) {
+            throw std::runtime_error("Leading dimensions are smaller than the matrix rows they describe.");
+        }
+
+        entries[i] = SBatchEntry{
+            .M       = problem.M,
+            .N       = problem.N,
+            .K       = problem.K,
+            .offsetA = static_cast<uint32_t>(floatsA),
+            .offsetB = static_cast<uint32_t>(floatsB),
+            .offsetC = static_cast<uint32_t>(floatsC),
+            .alpha   = problem.alpha,
+            .beta    = problem.beta,
+        };
+        floatsA += static_cast<uint64_t>(problem.M) * problem.K;
+        floatsB += static_cast<uint64_t>(problem.K) * problem.N;
+        floatsC += static_cast<uint64_t>(problem.M) * problem.N;
+        maxM   = std::max(maxM, problem.M);
+        maxN   = std::max(maxN, problem.N);
+        maxK   = std::max(maxK, problem.K);
+        readsC = readsC || problem.beta != 0.0f;
+    }
+    if (std::max({floatsA, floatsB, floatsC}) > std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("Batch is too large for 32 bit offsets, split it into smaller batches.");
+    if (maxM == 0 || maxN == 0)
+        return {};
+
+    const std::array<vk::DeviceSize, 4> sizes = {
+        sizeof(float) * std::max<vk::DeviceSize>(floatsA, 1),
+        sizeof(float) * std::max<vk::DeviceSize>(floatsB, 1),
+        sizeof(float) * floatsC,
+        sizeof(SBatchEntry) * entries.size(),
+    };
+    SBatchSlot&                         slot  = acquireBatchSlot(sizes);
+    timing.acquireSeconds                     = secondsSince(start);
+
+    // Rows are copied one at a time unless the source is already packed
+    auto packRows = [](float* destination, const float* source, uint32_t rows, uint32_t cols, uint32_t ld) {
+        if (ld == cols) {
+            std::memcpy(destination, source, sizeof(float) * rows * cols);
+            return;
+        }
+        for (uint32_t row = 0; row < rows; row++) {
+            std::memcpy(destination + (static_cast<size_t>(row) * cols), source + (static_cast<size_t>(row) * ld), sizeof(float) * cols);
+        }
+    };
+
+    std::chrono::steady_clock::time_point phase = std::chrono::steady_clock::now();
+    std::array<void*, 4>                  host;
+    for (uint32_t i = 0; i < BATCHED_BINDINGS; i++) {
+        host[i] = unifiedMemory ? slot.buffers[i].mapped : slot.staging[i].mapped;
+    }
+    for (size_t i = 0; i < problems.size(); i++) {
+        const SGemmBatchProblem& problem = problems[i];
+        packRows(static_cast<float*>(host[0]) + entries[i].offsetA, problem.A, problem.M, problem.K, problem.lda);
+        packRows(static_cast<float*>(host[1]) + entries[i].offsetB, problem.B, problem.K, problem.N, problem.ldb);
+        if (problem.beta != 0.0f)
+            packRows(static_cast<float*>(host[2]) + entries[i].offsetC, problem.C, problem.M, problem.N, problem.ldc);
+    }
+    std::memcpy(host[3], entries.data(), sizes[3]);
+    timing.copyInSeconds = secondsSince(phase);
+
+    phase                = std::chrono::steady_clock::now();
+    const SShaderConfig config =
+        tunedConfigs.contains({maxM, maxN, maxK}) || std::max(maxM, maxN) > SMALL_BATCH_SIZE ? configFor(maxM, maxN, maxK) : SMALL_BATCH_CONFIG;
+    const uint32_t                 maxBatch = physicalDevice.getProperties().limits.maxComputeWorkGroupCount[2];
+    const vk::raii::CommandBuffer& commands = slot.commandBuffer;
+
+    commands.reset();
+    commands.begin({.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    if (!unifiedMemory) {
+        for (uint32_t i = 0; i < BATCHED_BINDINGS; i++) {
+            if (i == 2 && !readsC)
+                continue;
+            commands.copyBuffer(*slot.staging[i].buffer, *slot.buffers[i].buffer, vk::BufferCopy{.srcOffset = 0, .dstOffset = 0, .size = sizes[i]});
+        }
+        vk::MemoryBarrier toShader{.srcAccessMask = vk::AccessFlagBits::eTransferWrite, .dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite};
+        commands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, toShader, nullptr, nullptr);
+    }
+
+    commands.bindPipeline(vk::PipelineBindPoint::eCompute, *batchedPipelineFor(config));
+    commands.bindDescriptorSets2({
         .stageFlags         = vk::ShaderStageFlagBits::eCompute,
-        .layout             = *pipelineLayout,
+        .layout             = *batchedPipelineLayout,
         .firstSet           = 0,
         .descriptorSetCount = 1,
-        .pDescriptorSets    = &*descriptorSet,
+        .pDescriptorSets    = &*slot.descriptorSet,
     });
-    commandBuffer.pushConstants2({.layout = *pipelineLayout, .stageFlags = vk::ShaderStageFlagBits::eCompute, .offset = 0, .size = sizeof(uint32_t), .pValues = &matrix_size});
+    // One z workgroup per problem, split across dispatches when the batch exceeds the device's z limit
+    for (uint32_t first = 0; first < problems.size(); first += maxBatch) {
+        const uint32_t count = std::min<uint32_t>(maxBatch, static_cast<uint32_t>(problems.size()) - first);
+        commands.pushConstants2({.layout = *batchedPipelineLayout, .stageFlags = vk::ShaderStageFlagBits::eCompute, .offset = 0, .size = sizeof(uint32_t), .pValues = &first});
+        commands.dispatch((maxN + config.tileN() - 1) / config.tileN(), (maxM + config.tileM() - 1) / config.tileM(), count);
+    }
 
-    uint32_t workGroupSize = 16;
-    uint32_t dispatch      = (matrix_size + workGroupSize - 1) / workGroupSize;
-    commandBuffer.dispatch(dispatch, dispatch, 1);
-    commandBuffer.end();
+    if (unifiedMemory) {
+        vk::MemoryBarrier toHost{.srcAccessMask = vk::AccessFlagBits::eShaderWrite, .dstAccessMask = vk::AccessFlagBits::eHostRead};
+        commands.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, toHost, nullptr, nullptr);
+    } else {
+        vk::MemoryBarrier toTransfer{.srcAccessMask = vk::AccessFlagBits::eShaderWrite, .dstAccessMask = vk::AccessFlagBits::eTransferRead};
+        commands.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, toTransfer, nullptr, nullptr);
+        commands.copyBuffer(*slot.buffers[2].buffer, *slot.staging[2].buffer, vk::BufferCopy{.srcOffset = 0, .dstOffset = 0, .size = sizes[2]});
+        vk::MemoryBarrier toHost{.srcAccessMask = vk::AccessFlagBits::eTransferWrite, .dstAccessMask = vk::AccessFlagBits::eHostRead};
+        commands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, {}, toHost, nullptr, nullptr);
+    }
+    commands.end();
+    timing.recordSeconds = secondsSince(phase);
 
-    vk::SubmitInfo submitInfo{
-        .commandBufferCount = 1,
-        .pCommandBuffers    = &*commandBuffer,
-    };
-    vk::raii::Fence fence = device.createFence({});
-    computeQueue.submit(submitInfo, *fence);
-    auto fenceResult = device.waitForFences(*fence, VK_TRUE, UINT64_MAX);
-    if (fenceResult != vk::Result::eSuccess) {
+    // Everything goes in one submit on the compute queue, the copies are small next to the submission overhead saved
+    phase                = std::chrono::steady_clock::now();
+    computeQueue.submit(vk::SubmitInfo{.commandBufferCount = 1, .pCommandBuffers = &*commands}, *slot.fence);
+    if (device.waitForFences(*slot.fence, VK_TRUE, UINT64_MAX) != vk::Result::eSuccess) {
         throw std::runtime_error("Failed to wait for fence.");
     }
+    device.resetFences(*slot.fence);
+    timing.executeSeconds = secondsSince(phase);
+
+    phase                 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < problems.size(); i++) {
+        const SGemmBatchProblem& problem = problems[i];
+        const float*             packed  = static_cast<const float*>(host[2]) + entries[i].offsetC;
+        for (uint32_t row = 0; row < problem.M; row++) {
+            std::memcpy(problem.C + (static_cast<size_t>(row) * problem.ldc), packed + (static_cast<size_t>(row) * problem.N), sizeof(float) * problem.N);
+        }
+    }
+    timing.copyOutSeconds = secondsSince(phase);
+    timing.totalSeconds   = secondsSince(start);
 
-    vk::DeviceSize bufferSize = sizeof(float) * matrix_size * matrix_size;
-    void*          mapped     = device.mapMemory2({.memory = *bufferMemories[2], .offset = 0, .size = bufferSize});
-    std::memcpy(matrixC.data(), mapped, sizeof(float) * matrix_size * matrix_size);
-    device.unmapMemory2({
-        .memory = *bufferMemories[2],
-    });
+    spdlog::debug("Batched {} GEMMs up to {}x{}x{} [{}] in {} seconds", problems.size(), maxM, maxN, maxK, config.toString(), timing.totalSeconds);
+    return timing;
+}
 
-    return matrixC;
+// The chain slot is kept for as long as the same dimensions come back, anything else replans and rebuilds it
+CVulkanContext::SChainSlot& CVulkanContext::acquireChainSlot(std::span<const size_t> dims) {
+    if (chainSlot && std::ranges::equal(chainSlot->dims, dims))
+        return *chainSlot;
+    releaseChainSlot();
+
+    constexpr vk::MemoryPropertyFlags hostProperties = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+    constexpr vk::BufferUsageFlags    storageUsage   = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+    constexpr vk::BufferUsageFlags    stagingUsage   = vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+    // Zero sized buffers are invalid, and an empty intermediate still has to be bound
+    auto                              floatBytes     = [](size_t floats) { return sizeof(float) * std::max<vk::DeviceSize>(floats, 1); };
+
+    // Inputs and the product are staged like the buffers of createBindings, or mapped directly on unified memory
+    auto hostBuffer = [&](SPooledBuffer& buffer, SPooledBuffer& staging, vk::DeviceSize size) {
+        if (unifiedMemory) {
+            buffer = bufferPool->acquire(size, storageUsage, vk::MemoryPropertyFlagBits::eDeviceLocal | hostProperties);
+        } else {
+            buffer  = bufferPool->acquire(size, storageUsage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+            staging = bufferPool->acquire(size, stagingUsage, hostProperties);
+        }
+    };
+
+    SChainSlot slot;
+    slot.dims.assign(dims.begin(), dims.end());
+    slot.plan = NCommon::planChain(dims);
+    spdlog::trace("Creating chain slot for {} with {} scratch buffers.", slot.plan.order, slot.plan.bufferFloats.size());
+
+    const size_t count = dims.size() - 1;
+    slot.inputs.resize(count);
+    slot.inputStaging.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        hostBuffer(slot.inputs[i], slot.inputStaging[i], floatBytes(dims[i] * dims[i + 1]));
+    }
+    for (size_t floats : slot.plan.bufferFloats) {
+        slot.scratch.push_back(bufferPool->acquire(floatBytes(floats), storageUsage, vk::MemoryPropertyFlagBits::eDeviceLocal));
+    }
+    hostBuffer(slot.output, slot.outputStaging, floatBytes(dims.front() * dims.back()));
+
+    auto operand = [&](size_t index) -> vk::Buffer { return index < count ? *slot.inputs[index].buffer : *slot.scratch[slot.plan.steps[index - count].buffer].buffer; };
+    for (const NCommon::SChainStep& step : slot.plan.steps) {
+        const vk::Buffer                            result   = step.buffer == NCommon::SChainPlan::OUTPUT ? *slot.output.buffer : *slot.scratch[step.buffer].buffer;
+        const std::array<vk::Buffer, GEMM_BINDINGS> bindings = {operand(step.left), operand(step.right), result};
+        slot.descriptorSets.push_back(bindBuffers(bindings, descriptorSetLayout));
+    }
+
+    vk::CommandBufferAllocateInfo commandAllocInfo{.commandPool = *commandPool, .level = vk::CommandBufferLevel::ePrimary, .commandBufferCount = 1};
+    slot.commandBuffer = std::move(device.allocateCommandBuffers(commandAllocInfo).front());
+    slot.fence         = device.createFence({});
+    if (computeTimestampBits > 0)
+        slot.timestamps = device.createQueryPool({.queryType = vk::QueryType::eTimestamp, .queryCount = 2});
+
+    chainSlot.emplace(std::move(slot));
+    return *chainSlot;
+}
+
+void CVulkanContext::releaseChainSlot() {
+    if (!chainSlot)
+        return;
+
+    for (std::vector<SPooledBuffer>* buffers : {&chainSlot->inputs, &chainSlot->inputStaging, &chainSlot->scratch}) {
+        for (SPooledBuffer& buffer : *buffers) {
+            bufferPool->release(std::move(buffer));
+        }
+    }
+    bufferPool->release(std::move(chainSlot->output));
+    bufferPool->release(std::move(chainSlot->outputStaging));
+    chainSlot.reset();
+}
+
+// Upload, every step of the plan and the readback in one command buffer. Each dispatch may read what the one before
+// it wrote, so consecutive dispatches are separated by a compute to compute barrier.
+void CVulkanContext::recordChain(SChainSlot& slot) {
+    spdlog::trace("Recording chain command buffer.");
+
+    const vk::raii::CommandBuffer& commands   = slot.commandBuffer;
+    const size_t                   count      = slot.dims.size() - 1;
+    const vk::DeviceSize           outputSize = sizeof(float) * slot.dims.front() * slot.dims.back();
+
+    commands.reset();
+    commands.begin(vk::CommandBufferBeginInfo{});
+    if (!unifiedMemory) {
+        for (size_t i = 0; i < count; i++) {
+            commands.copyBuffer(*slot.inputStaging[i].buffer, *slot.inputs[i].buffer,
+                                vk::BufferCopy{.srcOffset = 0, .dstOffset = 0, .size = sizeof(float) * slot.dims[i] * slot.dims[i + 1]});
+        }
+        vk::MemoryBarrier toShader{.srcAccessMask = vk::AccessFlagBits::eTransferWrite, .dstAccessMask = vk::AccessFlagBits::eShaderRead};
+        commands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, toShader, nullptr, nullptr);
+    }
+    if (*slot.timestamps) {
+        commands.resetQueryPool(*slot.timestamps, 0, 2);
+        commands.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, *slot.timestamps, 0);
+    }
+
+    for (size_t s = 0; s < slot.plan.steps.size(); s++) {
+        const NCommon::SChainStep& step = slot.plan.steps[s];
+        if (s > 0) {
+            // Also orders the write into a reused scratch buffer after the reads of the intermediate it held before
+            vk::MemoryBarrier betweenSteps{.srcAccessMask = vk::AccessFlagBits::eShaderWrite, .dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite};
+            commands.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, betweenSteps, nullptr, nullptr);
+        }
+
+        const auto               M = static_cast<uint32_t>(step.M);
+        const auto               N = static_cast<uint32_t>(step.N);
+        const auto               K = static_cast<uint32_t>(step.K);
+        const SGemmPushConstants params{.M = M, .N = N, .K = K, .lda = K, .ldb = N, .ldc = N, .alpha = 1.0f, .beta = 0.0f};
+        recordGemm(commands, slot.descriptorSets[s], params, configFor(M, N, K));
+    }
+    if (*slot.timestamps)
+        commands.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, *slot.timestamps, 1);
+
+    if (unifiedMemory) {
+        vk::MemoryBarrier toHost{.srcAccessMask = vk::AccessFlagBits::eShaderWrite, .dstAccessMask = vk::AccessFlagBits::eHostRead};
+        commands.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, toHost, nullptr, nullptr);
+    } else {
+        vk::MemoryBarrier toTransfer{.srcAccessMask = vk::AccessFlagBits::eShaderWrite, .dstAccessMask = vk::AccessFlagBits::eTransferRead};
+        commands.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, toTransfer, nullptr, nullptr);
+        commands.copyBuffer(*slot.output.buffer, *slot.outputStaging.buffer, vk::BufferCopy{.srcOffset = 0, .dstOffset = 0, .size = outputSize});
+        vk::MemoryBarrier toHost{.srcAccessMask = vk::AccessFlagBits::eTransferWrite, .dstAccessMask = vk::AccessFlagBits::eHostRead};
+        commands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, {}, toHost, nullptr, nullptr);
+    }
+    commands.end();
+    slot.recorded = true;
+}
+
+SGemmTiming CVulkanContext::sgemmChain(std::span<const float* const> matrices, std::span<const size_t> dims, float* matrixC) {
+    if (dims.size() != matrices.size() + 1)
+        throw std::runtime_error("A chain of n matrices needs n + 1 dimensions.");
+    if (matrices.size() > MAX_CHAIN)
+        throw std::runtime_error("Chains are limited to " + std::to_string(MAX_CHAIN) + " matrices.");
+    // Intermediates can pair any two dimensions of the chain, so every such pair has to stay within 32 bit indexing
+    const uint64_t largest = *std::ranges::max_element(dims);
+    if (largest > std::numeric_limits<uint32_t>::max() || largest * largest > std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("Chain dimensions are too large for 32 bit indices.");
+    if (dims.front() == 0 || dims.back() == 0)
+        return {};
+
+    SGemmTiming                                 timing;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    SChainSlot&                                 slot  = acquireChainSlot(dims);
+    timing.acquireSeconds                             = secondsSince(start);
+
+    std::chrono::steady_clock::time_point phase = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < matrices.size(); i++) {
+        void* host = unifiedMemory ? slot.inputs[i].mapped : slot.inputStaging[i].mapped;
+        std::memcpy(host, matrices[i], sizeof(float) * dims[i] * dims[i + 1]);
+    }
+    timing.copyInSeconds = secondsSince(phase);
+
+    phase                = std::chrono::steady_clock::now();
+    if (!slot.recorded)
+        recordChain(slot);
+    timing.recordSeconds = secondsSince(phase);
+
+    phase                = std::chrono::steady_clock::now();
+    computeQueue.submit(vk::SubmitInfo{.commandBufferCount = 1, .pCommandBuffers = &*slot.commandBuffer}, *slot.fence);
+    if (device.waitForFences(*slot.fence, VK_TRUE, UINT64_MAX) != vk::Result::eSuccess) {
+        throw std::runtime_error("Failed to wait for fence.");
+    }
+    device.resetFences(*slot.fence);
+    timing.executeSeconds = secondsSince(phase);
+    if (*slot.timestamps)
+        timing.gpuDispatchSeconds = timestampSeconds(slot.timestamps, 0, computeTimestampBits, timestampPeriod);
+
+    phase              = std::chrono::steady_clock::now();
+    const void* mapped = unifiedMemory ? slot.output.mapped : slot.outputStaging.mapped;
+    std::memcpy(matrixC, mapped, sizeof(float) * dims.front() * dims.back());
+    timing.copyOutSeconds = secondsSince(phase);
+    timing.totalSeconds   = secondsSince(start);
+
+    spdlog::debug("Chain {} of {} steps in {} seconds, {} on the GPU", slot.plan.order, slot.plan.steps.size(), timing.totalSeconds, timing.gpuDispatchSeconds);
+    return timing;
 }
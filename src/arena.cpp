@@ -0,0 +1,142 @@
+#include "arena.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Mappings are rounded to whole pages, and to whole huge pages from HUGE_PAGE up so MAP_HUGETLB accepts them and
+// THP can back every byte. A cached block serves any request from its own size down to half of it, which keeps the
+// matrices and packed panels of a repeated multiply on the blocks they had last time without letting one large
+// block get tied up by small requests.
+
+static constexpr size_t DEFAULT_RETAIN_MB = 1024;
+
+static size_t roundUp(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+NCommon::CArena& NCommon::CArena::instance() {
+    static CArena* arena = new CArena();
+    return *arena;
+}
+
+NCommon::CArena::CArena() : pageSize(static_cast<size_t>(::sysconf(_SC_PAGESIZE))) {
+    const char* huge = std::getenv("ARENA_HUGEPAGES");
+    hugePages        = huge == nullptr || std::strcmp(huge, "0") != 0;
+
+    // Malformed values fall back to the default rather than failing an allocation
+    const char* retain = std::getenv("ARENA_RETAIN_MB");
+    char*       end    = nullptr;
+    const auto  parsed = retain != nullptr ? std::strtoull(retain, &end, 10) : 0ull;
+    retainLimit        = (retain != nullptr && end != retain && *end == '\0' ? parsed : DEFAULT_RETAIN_MB) << 20;
+}
+
+void* NCommon::CArena::map(size_t bytes) {
+    const bool huge = hugePages && bytes % HUGE_PAGE == 0;
+#ifdef MAP_HUGETLB
+    // Once the reserved pool has run dry every later attempt would fail the same way
+    if (huge && hugeTlbAvailable) {
+        void* block = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (block != MAP_FAILED) {
+            counters.hugeTlbBlocks++;
+            return block;
+        }
+        hugeTlbAvailable = false;
+    }
+#endif
+
+    // One huge page extra leaves room to trim the mapping down to a huge page boundary
+    const size_t slack = huge ? HUGE_PAGE : 0;
+    void*        raw   = ::mmap(nullptr, bytes + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        throw std::bad_alloc();
+    if (!huge)
+        return raw;
+
+    char*        start   = static_cast<char*>(raw);
+    char*        aligned = reinterpret_cast<char*>(roundUp(reinterpret_cast<uintptr_t>(start), HUGE_PAGE));
+    const size_t head    = aligned - start;
+    if (head > 0)
+        ::munmap(start, head);
+    if (slack - head > 0)
+        ::munmap(aligned + bytes, slack - head);
+#ifdef MADV_HUGEPAGE
+    if (::madvise(aligned, bytes, MADV_HUGEPAGE) == 0)
+        counters.transparentBlocks++;
+#endif
+    return aligned;
+}
+
+void NCommon::CArena::unmap(void* block, size_t bytes) noexcept {
+    ::munmap(block, bytes);
+    counters.mappedBytes -= bytes;
+}
+
+void* NCommon::CArena::allocate(size_t bytes) {
+    if (bytes < BLOCK_THRESHOLD) {
+        void* ptr = std::aligned_alloc(CACHE_LINE, roundUp(std::max<size_t>(bytes, 1), CACHE_LINE));
+        if (ptr == nullptr)
+            throw std::bad_alloc();
+        return ptr;
+    }
+
+    const size_t                mapped = roundUp(bytes, bytes >= HUGE_PAGE ? HUGE_PAGE : pageSize);
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Smallest cached block that fits, as long as it is not more than twice the size
+    if (auto cached = freeBlocks.lower_bound(mapped); cached != freeBlocks.end() && cached->first / 2 <= mapped) {
+        void* block = cached->second;
+        liveBlocks.emplace(block, cached->first);
+        counters.cachedBytes -= cached->first;
+        counters.reusedBlocks++;
+        freeBlocks.erase(cached);
+        return block;
+    }
+
+    void* block = map(mapped);
+    liveBlocks.emplace(block, mapped);
+    counters.mappedBytes += mapped;
+    counters.freshBlocks++;
+    return block;
+}
+
+void NCommon::CArena::release(void* block, size_t bytes) noexcept {
+    if (block == nullptr)
+        return;
+    if (bytes < BLOCK_THRESHOLD) {
+        std::free(block);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto                  live = liveBlocks.find(block);
+    if (live == liveBlocks.end())
+        return;
+    const size_t mapped = live->second;
+    liveBlocks.erase(live);
+    freeBlocks.emplace(mapped, block);
+    counters.cachedBytes += mapped;
+
+    // Over the cap the smallest blocks go first, they are the likeliest leftovers of an earlier, smaller problem
+    while (counters.cachedBytes > retainLimit) {
+        const auto smallest = freeBlocks.begin();
+        counters.cachedBytes -= smallest->first;
+        unmap(smallest->second, smallest->first);
+        freeBlocks.erase(smallest);
+    }
+}
+
+void NCommon::CArena::trim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& [bytes, block] : freeBlocks) {
+        unmap(block, bytes);
+    }
+    freeBlocks.clear();
+    counters.cachedBytes = 0;
+}
+
+NCommon::SArenaStats NCommon::CArena::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
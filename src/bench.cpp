@@ -0,0 +1,279 @@
+#include "HybridExecutor.hpp"
+#include "common.hpp"
+#include "gemm.hpp"
+#include "gemm_kernels.hpp"
+#include "verify.hpp"
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <omp.h>
+
+// Benchmark harness running any backend over a sweep of square sizes.
+// vulkan-kernel times only the dispatch through GPU timestamps, for comparing kernel throughput with the CPU, and
+// vulkan-stream runs the banded streaming path. hybrid splits each multiply between the OpenMP kernel and the device.
+// Usage: bench [--backends sequential,omp,vulkan,vulkan-kernel,vulkan-stream,hybrid] [--sizes 256,512,1024] [--warmup 2] [--repeats 10]
+//              [--format text|json|csv] [--output file] [--seed 1] [--verify]
+// --verify checks the last result of every backend and size with NCommon::verifyProduct and fails the run on a mismatch.
+// Every format records per result whether it was verified and whether it passed.
+
+struct SBenchOptions {
+    std::vector<std::string> backends = {"sequential", "omp", "vulkan"};
+    std::vector<size_t>      sizes    = {256, 512, 1024};
+    size_t                   warmup   = 2;
+    size_t                   repeats  = 10;
+    std::string              format   = "text";
+    std::string              output;
+    size_t                   seed     = 1;
+    bool                     verify   = false;
+};
+
+struct SBenchResult {
+    std::string backend;
+    size_t      m;
+    size_t      n;
+    size_t      k;
+    size_t      repeats;
+    double      minSeconds;
+    double      medianSeconds;
+    double      p95Seconds;
+    double      gflops;
+    double      bandwidthGBs;
+    // Whether the last product was checked with --verify, and if so whether it held
+    bool        verified = false;
+    bool        passed   = false;
+};
+
+// Returns the seconds attributed to one multiply
+using BackendFn = std::function<double(size_t M, size_t N, size_t K, const float* A, const float* B, float* C)>;
+
+template <typename F>
+static double wallSeconds(F&& function) {
+    std::chrono::time_point start = std::chrono::high_resolution_clock::now();
+    function();
+    std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start;
+    return duration.count();
+}
+
+static std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream        stream(list);
+    std::string              item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+static size_t parseCount(const std::string& flag, const std::string& value, bool allowZero) {
+    size_t    consumed = 0;
+    long long parsed   = 0;
+    try {
+        parsed = std::stoll(value, &consumed);
+    } catch (const std::exception&) {
+        consumed = 0;
+    }
+    if (consumed != value.size() || parsed < 0 || (parsed == 0 && !allowZero))
+        throw std::runtime_error("Invalid value for " + flag + ": " + value);
+    return static_cast<size_t>(parsed);
+}
+
+static SBenchOptions parseBenchOptions(int argc, char** argv) {
+    SBenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--verify") {
+            options.verify = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            throw std::runtime_error("Missing value for " + arg);
+        const std::string value = argv[++i];
+
+        if (arg == "--backends") {
+            options.backends = splitList(value);
+        } else if (arg == "--sizes") {
+            options.sizes.clear();
+            for (const std::string& size : splitList(value))
+                options.sizes.push_back(parseCount(arg, size, false));
+        } else if (arg == "--warmup") {
+            options.warmup = parseCount(arg, value, true);
+        } else if (arg == "--repeats") {
+            options.repeats = parseCount(arg, value, false);
+        } else if (arg == "--format") {
+            if (value != "text" && value != "json" && value != "csv")
+                throw std::runtime_error("Unknown format: " + value);
+            options.format = value;
+        } else if (arg == "--output") {
+            options.output = value;
+        } else if (arg == "--seed") {
+            options.seed = parseCount(arg, value, true);
+        } else {
+            throw std::runtime_error("Unknown argument: " + arg);
+        }
+    }
+    return options;
+}
+
+static SBenchResult runBenchmark(const std::string& name, const BackendFn& backend, size_t size, const SBenchOptions& options) {
+    // The arena hands the same blocks to every backend at this size and the packed panels of every repeat, so after
+    // the first run nothing is mapped or faulted in while timing
+    const size_t          M = size, N = size, K = size;
+    NCommon::MatrixBuffer matrixA = NCommon::generateRandomMatrix(M, K, options.seed);
+    NCommon::MatrixBuffer matrixB = NCommon::generateRandomMatrix(K, N, options.seed + 1);
+    NCommon::MatrixBuffer matrixC(M * N);
+
+    for (size_t i = 0; i < options.warmup; i++) {
+        backend(M, N, K, matrixA.data(), matrixB.data(), matrixC.data());
+    }
+
+    std::vector<double> samples;
+    samples.reserve(options.repeats);
+    for (size_t i = 0; i < options.repeats; i++) {
+        samples.push_back(backend(M, N, K, matrixA.data(), matrixB.data(), matrixC.data()));
+    }
+    std::sort(samples.begin(), samples.end());
+
+    SBenchResult result{.backend = name, .m = M, .n = N, .k = K, .repeats = options.repeats};
+    result.minSeconds    = samples.front();
+    result.medianSeconds = samples.size() % 2 == 1 ? samples[samples.size() / 2] : (samples[(samples.size() / 2) - 1] + samples[samples.size() / 2]) / 2.0;
+    result.p95Seconds    = samples[static_cast<size_t>(std::ceil(0.95 * static_cast<double>(samples.size()))) - 1];
+
+    // Bandwidth counts the compulsory traffic only: A and B read once, C written once
+    const double flops  = 2.0 * static_cast<double>(M) * static_cast<double>(N) * static_cast<double>(K);
+    const double bytes  = sizeof(float) * static_cast<double>((M * K) + (K * N) + (M * N));
+    result.gflops       = flops / result.medianSeconds / 1e9;
+    result.bandwidthGBs = bytes / result.medianSeconds / 1e9;
+
+    if (options.verify) {
+        const NCommon::SVerifyReport check = NCommon::verifyProduct(M, N, K, matrixA.data(), K, matrixB.data(), N, matrixC.data(), N, NCommon::EPrecision::Float32, options.seed);
+        result.verified                    = true;
+        result.passed                      = check.passed;
+        if (!check.passed)
+            spdlog::error("{} at {}x{}x{} failed verification: row {} is off by {} against a bound of {}", name, M, N, K, check.worstRow, check.residual, check.bound);
+    }
+    return result;
+}
+
+static void writeResults(std::ostream& out, const std::vector<SBenchResult>& results, const std::string& format) {
+    if (format == "json") {
+        out << "[\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            const SBenchResult& r = results[i];
+            out << "  {\"backend\": \"" << r.backend << "\", \"m\": " << r.m << ", \"n\": " << r.n << ", \"k\": " << r.k << ", \"repeats\": " << r.repeats
+                << ", \"min_s\": " << r.minSeconds << ", \"median_s\": " << r.medianSeconds << ", \"p95_s\": " << r.p95Seconds << ", \"gflops\": " << r.gflops
+                << ", \"bandwidth_gbs\": " << r.bandwidthGBs << ", \"verified\": " << (r.verified ? "true" : "false")
+                << ", \"passed\": " << (r.verified ? (r.passed ? "true" : "false") : "null") << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "]\n";
+    } else if (format == "csv") {
+        out << "backend,m,n,k,repeats,min_s,median_s,p95_s,gflops,bandwidth_gbs,verified,passed\n";
+        for (const SBenchResult& r : results) {
+            out << r.backend << "," << r.m << "," << r.n << "," << r.k << "," << r.repeats << "," << r.minSeconds << "," << r.medianSeconds << "," << r.p95Seconds << ","
+                << r.gflops << "," << r.bandwidthGBs << "," << r.verified << "," << (r.verified ? std::to_string(r.passed) : "") << "\n";
+        }
+    } else {
+        for (const SBenchResult& r : results) {
+            out << r.backend << " " << r.m << "x" << r.n << "x" << r.k << ": min " << r.minSeconds << " s, median " << r.medianSeconds << " s, p95 " << r.p95Seconds << " s, "
+                << r.gflops << " GFLOP/s, " << r.bandwidthGBs << " GB/s" << (r.verified ? (r.passed ? ", verified" : ", FAILED verification") : "") << "\n";
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    // Results go to stdout, so keep logging on stderr
+    spdlog::set_default_logger(spdlog::stderr_color_mt("bench"));
+#ifndef NDEBUG
+    spdlog::set_level(spdlog::level::debug);
+#ifdef TRACE
+    spdlog::set_level(spdlog::level::trace);
+#endif
+#endif
+    SBenchOptions options;
+    try {
+        options = parseBenchOptions(argc, argv);
+    } catch (const std::runtime_error& err) {
+        spdlog::error("{}", err.what());
+        return EXIT_FAILURE;
+    }
+
+    const NGemm::SBlockSizes blocks = NGemm::blockSizesFromEnv();
+    spdlog::info("Kernel: {}, block sizes: {}, OpenMP threads: {}", NGemm::activeKernel().name, NGemm::toString(blocks), omp_get_max_threads());
+
+    // The Vulkan context is only created when that backend is requested, and reused for every size
+    std::unique_ptr<CVulkanContext>  vulkanContext;
+    std::unique_ptr<CHybridExecutor> hybridExecutor;
+
+    std::vector<SBenchResult>        results;
+    for (const std::string& name : options.backends) {
+        BackendFn backend;
+        if (name == "sequential" || name == "omp") {
+            const bool parallel = name == "omp";
+            backend             = [&blocks, parallel](size_t M, size_t N, size_t K, const float* A, const float* B, float* C) {
+                return wallSeconds([&] { NGemm::sgemm(M, N, K, 1.0f, A, K, B, N, 0.0f, C, N, blocks, parallel); });
+            };
+        } else if (name == "vulkan" || name == "vulkan-kernel" || name == "vulkan-stream" || name == "hybrid") {
+            try {
+                if (!vulkanContext)
+                    vulkanContext = std::make_unique<CVulkanContext>();
+            } catch (const std::runtime_error& err) {
+                spdlog::error("Skipping {} backend: {}", name, err.what());
+                continue;
+            }
+            if (name == "vulkan-kernel" && !vulkanContext->timestampQueries) {
+                spdlog::error("Skipping vulkan-kernel backend: {} has no compute timestamp support", vulkanContext->deviceName);
+                continue;
+            }
+            if (name == "hybrid") {
+                if (!hybridExecutor)
+                    hybridExecutor = std::make_unique<CHybridExecutor>(*vulkanContext, blocks);
+                backend = [&hybridExecutor](size_t M, size_t N, size_t K, const float* A, const float* B, float* C) {
+                    return wallSeconds([&] { hybridExecutor->sgemm(M, N, K, 1.0f, A, K, B, N, 0.0f, C, N); });
+                };
+            } else {
+                const bool kernelOnly = name == "vulkan-kernel";
+                const bool streamed   = name == "vulkan-stream";
+                backend               = [&vulkanContext, kernelOnly, streamed](size_t M, size_t N, size_t K, const float* A, const float* B, float* C) {
+                    SGemmTiming  timing;
+                    const double seconds = wallSeconds([&] {
+                        timing = streamed ? vulkanContext->sgemmStreamed(M, N, K, 1.0f, A, K, B, N, 0.0f, C, N) : vulkanContext->sgemm(M, N, K, 1.0f, A, K, B, N, 0.0f, C, N);
+                    });
+                    return kernelOnly ? timing.gpuDispatchSeconds : seconds;
+                };
+            }
+        } else {
+            spdlog::error("Unknown backend: {}", name);
+            return EXIT_FAILURE;
+        }
+
+        for (size_t size : options.sizes) {
+            spdlog::info("Benchmarking {} at {}x{}x{}", name, size, size, size);
+            results.push_back(runBenchmark(name, backend, size, options));
+        }
+    }
+
+    const NCommon::SArenaStats arena = NCommon::CArena::instance().stats();
+    spdlog::debug("Arena: {} MiB mapped, {} blocks mapped and {} reused, {} on reserved huge pages, {} advised for transparent huge pages", arena.mappedBytes >> 20,
+                  arena.freshBlocks, arena.reusedBlocks, arena.hugeTlbBlocks, arena.transparentBlocks);
+
+    const bool verified = std::all_of(results.begin(), results.end(), [](const SBenchResult& result) { return !result.verified || result.passed; });
+    if (options.output.empty()) {
+        writeResults(std::cout, results, options.format);
+    } else {
+        std::ofstream file(options.output);
+        if (!file.is_open()) {
+            spdlog::error("Failed to open {}", options.output);
+            return EXIT_FAILURE;
+        }
+        writeResults(file, results, options.format);
+    }
+
+    return verified ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,23 +1,156 @@
 #include "common.hpp"
-#include <random>
+#include <cmath>
+#include <cstdlib>
 #include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <string_view>
 
-static float randomFloat() {
-    static std::default_random_engine            generator;
-    static std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
-    return distribution(generator);
+static size_t parseSize(const std::string& flag, const char* value, bool allowZero = false) {
+    if (value == nullptr)
+        throw std::runtime_error("Missing value for " + flag);
+
+    char*              end    = nullptr;
+    unsigned long long parsed = std::strtoull(value, &end, 10);
+    if (end == value || *end != '\0' || (parsed == 0 && !allowZero))
+        throw std::runtime_error("Invalid value for " + flag + ": " + value);
+    return parsed;
 }
 
-std::vector<float> NCommon::generateRandomMatrix(size_t size) {
-    std::vector<float> matrix(size * size);
-    for (size_t i = 0; i < size * size; i++) {
-        matrix[i] = randomFloat();
+NCommon::SOptions NCommon::parseOptions(int argc, char** argv) {
+    SOptions options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg   = argv[i];
+        const char*       value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (arg == "--size") {
+            options.m = options.n = options.k = parseSize(arg, value);
+            i++;
+        } else if (arg == "-m") {
+            options.m = parseSize(arg, value);
+            i++;
+        } else if (arg == "-n") {
+            options.n = parseSize(arg, value);
+            i++;
+        } else if (arg == "-k") {
+            options.k = parseSize(arg, value);
+            i++;
+        } else if (arg == "--autotune") {
+            options.autotune = true;
+        } else if (arg == "--stream") {
+            options.stream = true;
+        } else if (arg == "--verify") {
+            options.verify = true;
+        } else if (arg == "--perf") {
+            options.perf = true;
+        } else if (arg == "--batch") {
+            options.batch = parseSize(arg, value);
+            i++;
+        } else if (arg == "--strassen") {
+            options.strassenCutover = parseSize(arg, value);
+            i++;
+        } else if (arg == "--seed") {
+            options.seed = parseSize(arg, value, true);
+            i++;
+        } else if (arg == "--budget") {
+            options.memoryBudget = parseSize(arg, value);
+            i++;
+        } else if (arg == "--chain") {
+            if (value == nullptr)
+                throw std::runtime_error("Missing value for " + arg);
+            std::string_view list = value;
+            for (size_t comma = list.find(','); !list.empty(); comma = list.find(',')) {
+                options.chain.push_back(parseSize(arg, std::string(list.substr(0, comma)).c_str()));
+                list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+            }
+            if (options.chain.size() < 3)
+                throw std::runtime_error("--chain needs the dimensions of at least two matrices, d0,d1,d2,...");
+            i++;
+        } else if (arg == "--precision") {
+            if (value == nullptr)
+                throw std::runtime_error("Missing value for " + arg);
+            options.precision = parsePrecision(value);
+            i++;
+        } else if (arg == "--input" || arg == "--output") {
+            if (value == nullptr)
+                throw std::runtime_error("Missing value for " + arg);
+            (arg == "--input" ? options.input : options.output) = value;
+            i++;
+        } else {
+            throw std::runtime_error("Unknown argument: " + arg);
+        }
     }
+    if (options.precision != EPrecision::Float32 && (options.strassenCutover > 0 || options.memoryBudget > 0))
+        throw std::runtime_error("--precision does not combine with --strassen or --budget");
+    if (options.memoryBudget > 0 && (options.strassenCutover > 0 || options.perf))
+        throw std::runtime_error("--budget does not combine with --strassen or --perf");
+    if (!options.chain.empty() && (options.precision != EPrecision::Float32 || options.strassenCutover > 0 || options.memoryBudget > 0 || !options.input.empty() ||
+                                   !options.output.empty() || options.verify))
+        throw std::runtime_error("--chain does not combine with --precision, --strassen, --budget, --input, --output or --verify");
+    return options;
+}
+
+NCommon::MatrixBuffer NCommon::generateRandomMatrix(size_t rows, size_t cols, uint64_t seed) {
+    MatrixBuffer matrix(rows * cols);
+    fillRandom(matrix, seed);
     return matrix;
 }
 
-void NCommon::writeToBinary(std::vector<float>& matrix, std::string filename) {
-    std::ofstream file(filename, std::ios::out | std::ios::binary);
-    file.write(reinterpret_cast<const char*>(matrix.data()), matrix.size() * sizeof(float));
-    file.close();
+void NCommon::fillRandom(std::span<float> matrix, uint64_t seed) {
+    // Hashing the seed keeps the streams of adjacent seeds unrelated
+    const uint64_t key   = mix64(seed);
+    float*         data  = matrix.data();
+    const size_t   count = matrix.size();
+
+    // The top 24 bits convert to float exactly, so the result does not depend on rounding modes either
+#pragma omp parallel for simd schedule(static)
+    for (size_t i = 0; i < count; i++) {
+        data[i] = static_cast<float>(mix64(key + (i * GOLDEN_GAMMA)) >> 40) * 0x1p-24f;
+    }
+}
+
+void NCommon::printCorner(std::span<const float> matrix, size_t rows, size_t cols) {
+    const size_t print_limit = 12;
+    for (size_t i = 0; i < std::min(print_limit, rows); i++) {
+        for (size_t j = 0; j < std::min(print_limit, cols); j++) {
+            std::cout << "C[" << i << "][" << j << "] = " << matrix[(i * cols) + j] << std::endl;
+        }
+    }
+}
+
+NCommon::SErrorStats NCommon::compareMatrices(std::span<const float> result, std::span<const float> reference) {
+    if (result.size() != reference.size())
+        throw std::runtime_error("Cannot compare matrices of different sizes.");
+
+    SErrorStats stats;
+    double      maxReference = 0;
+    double      errorSquares = 0;
+    double      normSquares  = 0;
+    for (size_t i = 0; i < result.size(); i++) {
+        const double error = std::abs(static_cast<double>(result[i]) - reference[i]);
+        stats.maxAbsolute  = std::max(stats.maxAbsolute, error);
+        maxReference       = std::max(maxReference, std::abs(static_cast<double>(reference[i])));
+        errorSquares += error * error;
+        normSquares += static_cast<double>(reference[i]) * reference[i];
+    }
+    stats.maxRelative       = maxReference > 0 ? stats.maxAbsolute / maxReference : stats.maxAbsolute;
+    stats.frobeniusRelative = normSquares > 0 ? std::sqrt(errorSquares / normSquares) : std::sqrt(errorSquares);
+    return stats;
+}
+
+std::filesystem::path NCommon::cacheDirectory() {
+    std::filesystem::path directory;
+    if (const char* xdgCache = std::getenv("XDG_CACHE_HOME"); xdgCache != nullptr && *xdgCache != '\0') {
+        directory = xdgCache;
+    } else if (const char* home = std::getenv("HOME"); home != nullptr && *home != '\0') {
+        directory = std::filesystem::path(home) / ".cache";
+    } else {
+        directory = std::filesystem::temp_directory_path();
+    }
+    directory /= "cab401";
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    return directory;
 }
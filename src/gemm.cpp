@@ -0,0 +1,393 @@
+#include "gemm.hpp"
+#include "gemm_kernels.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+#include <omp.h>
+#include <sched.h>
+
+// Blocking follows the Goto/BLIS loop order: nc columns of B stay in L3, an mc x kc block of A in L2 and
+// a kc x NR micro-panel of B in L1 while the micro-kernel walks MR rows of A.
+// MR and NR come from the micro-kernel picked for this CPU. Both operands are packed into zero padded
+// panels first so the micro-kernel only ever streams contiguous memory. alpha is folded into A while
+// packing and beta is applied by the first kc slice only, later slices accumulate.
+// In parallel the mc x nc tiles of C are scheduled over per-thread deques seeded with the rows each thread owns,
+// so work stays where allocateMatrix placed it and only imbalance makes a thread steal.
+
+static size_t envOrDefault(const char* name, size_t fallback) {
+    const char* value = std::getenv(name);
+    if (value == nullptr || *value == '\0')
+        return fallback;
+
+    char*              end    = nullptr;
+    unsigned long long parsed = std::strtoull(value, &end, 10);
+    if (end == value || *end != '\0' || parsed == 0) {
+        throw std::runtime_error(std::string("Invalid block size in ") + name + ": " + value);
+    }
+    return parsed;
+}
+
+NGemm::SBlockSizes NGemm::blockSizesFromEnv() {
+    SBlockSizes blocks;
+    blocks.mc = envOrDefault("GEMM_MC", blocks.mc);
+    blocks.kc = envOrDefault("GEMM_KC", blocks.kc);
+    blocks.nc = envOrDefault("GEMM_NC", blocks.nc);
+    return blocks;
+}
+
+std::string NGemm::toString(const SBlockSizes& blocks) {
+    return "mc=" + std::to_string(blocks.mc) + " kc=" + std::to_string(blocks.kc) + " nc=" + std::to_string(blocks.nc);
+}
+
+static size_t roundUp(size_t value, size_t multiple) {
+    return ((value + multiple - 1) / multiple) * multiple;
+}
+
+// Smallest page size there is, touching every one of them places huge pages as well
+static constexpr size_t PAGE_FLOATS = 4096 / sizeof(float);
+
+// First page boundary at or after ptr, so each thread only touches pages that start inside its own rows
+static float* firstPage(float* ptr) {
+    return reinterpret_cast<float*>(roundUp(reinterpret_cast<uintptr_t>(ptr), PAGE_FLOATS * sizeof(float)));
+}
+
+// Copies count consecutive values of A or B as fp32, widening 16-bit storage on the way
+static void widenInto(const float* source, size_t count, float* destination) {
+    std::copy_n(source, count, destination);
+}
+static void widenInto(const NCommon::SFloat16* source, size_t count, float* destination) {
+    NCommon::widen({source, count}, {destination, count});
+}
+static void widenInto(const NCommon::SBFloat16* source, size_t count, float* destination) {
+    NCommon::widen({source, count}, {destination, count});
+}
+
+// Copies an mr x kc slice of alpha * A into a kc x MR panel, zero filling rows past mr
+template <typename T>
+static void packAPanel(const T* a, size_t lda, size_t mr, size_t kc, size_t MR, float alpha, float* panel) {
+    if constexpr (std::is_same_v<T, float>) {
+        for (size_t p = 0; p < kc; ++p) {
+            for (size_t i = 0; i < MR; ++i) {
+                panel[(p * MR) + i] = i < mr ? alpha * a[(i * lda) + p] : 0.0f;
+            }
+        }
+    } else {
+        // Rows are widened a chunk at a time so the conversion runs on contiguous values, then scattered into the panel
+        constexpr size_t CHUNK = 64;
+        float            row[CHUNK];
+        for (size_t p0 = 0; p0 < kc; p0 += CHUNK) {
+            const size_t length = std::min(CHUNK, kc - p0);
+            for (size_t i = 0; i < MR; ++i) {
+                if (i < mr)
+                    widenInto(a + (i * lda) + p0, length, row);
+                for (size_t p = 0; p < length; ++p) {
+                    panel[((p0 + p) * MR) + i] = i < mr ? alpha * row[p] : 0.0f;
+                }
+            }
+        }
+    }
+}
+
+// C = beta * C, used when there is no product to add
+static void scaleC(size_t M, size_t N, float beta, float* C, size_t ldc, bool parallel) {
+#pragma omp parallel for schedule(static) if (parallel)
+    for (size_t i = 0; i < M; ++i) {
+        for (size_t j = 0; j < N; ++j) {
+            C[(i * ldc) + j] = beta == 0.0f ? 0.0f : beta * C[(i * ldc) + j];
+        }
+    }
+}
+
+// Copies a kc x nr slice of B into a kc x NR panel, zero filling columns past nr
+template <typename T>
+static void packBPanel(const T* b, size_t ldb, size_t nr, size_t kc, size_t NR, float* panel) {
+    for (size_t p = 0; p < kc; ++p) {
+        widenInto(b + (p * ldb), nr, panel + (p * NR));
+        std::fill(panel + (p * NR) + nr, panel + ((p + 1) * NR), 0.0f);
+    }
+}
+
+NGemm::CPackedB::CPackedB(size_t rows, size_t cols, const SBlockSizes& blocks, float* storage) : rows(rows), cols(cols), nr(activeKernel().nr), blocks(blocks) {
+    // Column blocks have to start on a panel boundary
+    this->blocks.nc = roundUp(blocks.nc, nr);
+    paddedCols      = roundUp(cols, nr);
+    if (storage == nullptr) {
+        data.resize(rows * paddedCols);
+        storage = data.data();
+    }
+    panels = storage;
+}
+
+NGemm::CPackedB::CPackedB(const float* matrixB, size_t rows, size_t cols, size_t ldb, const SBlockSizes& blocks, bool parallel) : CPackedB(rows, cols, blocks, nullptr) {
+    pack(matrixB, ldb, parallel);
+}
+
+NGemm::CPackedB::CPackedB(const NCommon::SFloat16* matrixB, size_t rows, size_t cols, size_t ldb, const SBlockSizes& blocks, bool parallel) :
+    CPackedB(rows, cols, blocks, nullptr) {
+    pack(matrixB, ldb, parallel);
+}
+
+NGemm::CPackedB::CPackedB(const NCommon::SBFloat16* matrixB, size_t rows, size_t cols, size_t ldb, const SBlockSizes& blocks, bool parallel) :
+    CPackedB(rows, cols, blocks, nullptr) {
+    pack(matrixB, ldb, parallel);
+}
+
+NGemm::CPackedB::CPackedB(const float* matrixB, size_t rows, size_t cols, size_t ldb, const SBlockSizes& blocks, float* storage) : CPackedB(rows, cols, blocks, storage) {
+    pack(matrixB, ldb, false);
+}
+
+size_t NGemm::CPackedB::floats(size_t rows, size_t cols) {
+    return rows * roundUp(cols, activeKernel().nr);
+}
+
+template <typename T>
+void NGemm::CPackedB::pack(const T* matrixB, size_t ldb, bool parallel) {
+    // Every kc deep slice holds paddedCols / nr consecutive panels
+    const size_t panelsPerSlice = paddedCols / nr;
+    const size_t slices         = (rows + blocks.kc - 1) / blocks.kc;
+
+#pragma omp parallel for collapse(2) schedule(static) if (parallel)
+    for (size_t slice = 0; slice < slices; ++slice) {
+        for (size_t panelIndex = 0; panelIndex < panelsPerSlice; ++panelIndex) {
+            const size_t pc = slice * blocks.kc;
+            const size_t jr = panelIndex * nr;
+            const size_t kc = std::min(blocks.kc, rows - pc);
+            packBPanel(matrixB + (pc * ldb) + jr, ldb, std::min(nr, cols - jr), kc, nr, panels + (pc * paddedCols) + (jr * kc));
+        }
+    }
+}
+
+const float* NGemm::CPackedB::panel(size_t pc, size_t jr) const {
+    const size_t kc = std::min(blocks.kc, rows - pc);
+    return panels + (pc * paddedCols) + (jr * kc);
+}
+
+template <typename T>
+static void sgemmUnpacked(size_t M, size_t N, size_t K, float alpha, const T* A, size_t lda, const T* B, size_t ldb, float beta, float* C, size_t ldc,
+                          const NGemm::SBlockSizes& blocks, bool parallel) {
+    if (M == 0 || N == 0)
+        return;
+    if (K == 0 || alpha == 0.0f) {
+        scaleC(M, N, beta, C, ldc, parallel);
+        return;
+    }
+
+    const NGemm::CPackedB packedB(B, K, N, ldb, blocks, parallel);
+    NGemm::sgemm(M, N, K, alpha, A, lda, packedB, beta, C, ldc, parallel);
+}
+
+void NGemm::sgemm(size_t M, size_t N, size_t K, float alpha, const float* A, size_t lda, const float* B, size_t ldb, float beta, float* C, size_t ldc, const SBlockSizes& blocks,
+                  bool parallel) {
+    sgemmUnpacked(M, N, K, alpha, A, lda, B, ldb, beta, C, ldc, blocks, parallel);
+}
+
+void NGemm::sgemm(size_t M, size_t N, size_t K, float alpha, const NCommon::SFloat16* A, size_t lda, const NCommon::SFloat16* B, size_t ldb, float beta, float* C, size_t ldc,
+                  const SBlockSizes& blocks, bool parallel) {
+    sgemmUnpacked(M, N, K, alpha, A, lda, B, ldb, beta, C, ldc, blocks, parallel);
+}
+
+void NGemm::sgemm(size_t M, size_t N, size_t K, float alpha, const NCommon::SBFloat16* A, size_t lda, const NCommon::SBFloat16* B, size_t ldb, float beta, float* C, size_t ldc,
+                  const SBlockSizes& blocks, bool parallel) {
+    sgemmUnpacked(M, N, K, alpha, A, lda, B, ldb, beta, C, ldc, blocks, parallel);
+}
+
+// Row blocks [first, second) of the thread's share. allocateMatrix and the tile schedule split rows the same way, so
+// the thread that first touches a row of A or C is the one that computes it.
+static std::pair<size_t, size_t> ownedRowBlocks(size_t rowBlocks, size_t thread, size_t threads) {
+    return {rowBlocks * thread / threads, rowBlocks * (thread + 1) / threads};
+}
+
+// Contiguous range of tile indices [next, end) packed into one word so both ends move with a single CAS. The owner
+// pops from the front, walking its rows in order, while idle threads steal from the back.
+struct alignas(64) STileDeque {
+    std::atomic<uint64_t> bounds{0};
+
+    void reset(uint64_t next, uint64_t end) {
+        bounds.store((end << 32) | next, std::memory_order_relaxed);
+    }
+
+    std::optional<size_t> take(bool fromBack) {
+        uint64_t current = bounds.load(std::memory_order_relaxed);
+        while (true) {
+            const uint64_t next = current & 0xFFFFFFFFu;
+            const uint64_t end  = current >> 32;
+            if (next >= end)
+                return std::nullopt;
+            const uint64_t taken = fromBack ? ((end - 1) << 32) | next : (end << 32) | (next + 1);
+            if (bounds.compare_exchange_weak(current, taken, std::memory_order_relaxed))
+                return fromBack ? end - 1 : next;
+        }
+    }
+};
+
+size_t NGemm::packedAFloats(const SBlockSizes& blocks) {
+    return roundUp(blocks.mc, activeKernel().mr) * blocks.kc;
+}
+
+// packedAStorage replaces the per-thread A buffer, so it can only be given to a sequential multiply
+template <typename T>
+static void sgemmPacked(size_t M, size_t N, size_t K, float alpha, const T* A, size_t lda, const NGemm::CPackedB& B, float beta, float* C, size_t ldc, bool parallel,
+                        float* packedAStorage = nullptr) {
+    const NGemm::SBlockSizes&  blocks = B.blocks;
+    const NGemm::SMicroKernel& kernel = NGemm::activeKernel();
+    const size_t               MR     = kernel.mr;
+    const size_t               NR     = kernel.nr;
+
+    if (B.nr != NR || B.rows != K || B.cols != N) {
+        throw std::runtime_error("Packed B does not match the problem shape or active micro-kernel.");
+    }
+    if (M == 0 || N == 0)
+        return;
+    if (K == 0 || alpha == 0.0f) {
+        scaleC(M, N, beta, C, ldc, parallel);
+        return;
+    }
+
+    // A tile is an mc x nc block of C carried through the whole K dimension, so tiles are independent and threads
+    // never meet at a barrier between kc slices
+    const size_t rowBlocks = (M + blocks.mc - 1) / blocks.mc;
+    const size_t colBlocks = (N + blocks.nc - 1) / blocks.nc;
+    if (rowBlocks * colBlocks > 0xFFFFFFFFu) {
+        throw std::runtime_error("Too many tiles for the tile scheduler, increase GEMM_MC or GEMM_NC.");
+    }
+    // A sequential multiply keeps its single deque on the stack, so with caller-owned packing space it allocates nothing
+    std::vector<STileDeque> parallelDeques(parallel ? omp_get_max_threads() : 0);
+    STileDeque              sequentialDeque;
+    STileDeque*             deques = parallel ? parallelDeques.data() : &sequentialDeque;
+
+#pragma omp parallel if (parallel)
+    {
+        const size_t thread  = omp_get_thread_num();
+        const size_t threads = omp_get_num_threads();
+
+        // Each thread starts with the tiles of the rows it owns
+        const auto [firstBlock, lastBlock] = ownedRowBlocks(rowBlocks, thread, threads);
+        deques[thread].reset(firstBlock * colBlocks, lastBlock * colBlocks);
+#pragma omp barrier
+
+        // Each thread packs the A blocks it computes into its own buffer
+        NGemm::AlignedBuffer ownPackedA(packedAStorage == nullptr ? NGemm::packedAFloats(blocks) : 0);
+        float*               packedA = packedAStorage != nullptr ? packedAStorage : ownPackedA.data();
+        alignas(64) float edgeTile[NGemm::MAX_MR * NGemm::MAX_NR];
+
+        // Own tiles first, then steal from the other threads, nearest first
+        for (size_t victim = 0; victim < threads; ++victim) {
+            STileDeque& deque = deques[(thread + victim) % threads];
+            while (std::optional<size_t> tile = deque.take(victim != 0)) {
+                const size_t ic = (*tile / colBlocks) * blocks.mc;
+                const size_t jc = (*tile % colBlocks) * blocks.nc;
+                const size_t mc = std::min(blocks.mc, M - ic);
+                const size_t nc = std::min(blocks.nc, N - jc);
+
+                for (size_t pc = 0; pc < K; pc += blocks.kc) {
+                    const size_t kc        = std::min(blocks.kc, K - pc);
+                    const float  sliceBeta = pc == 0 ? beta : 1.0f;
+
+                    for (size_t ir = 0; ir < mc; ir += MR) {
+                        packAPanel(A + ((ic + ir) * lda) + pc, lda, std::min(MR, mc - ir), kc, MR, alpha, packedA + (ir * kc));
+                    }
+
+                    for (size_t jr = 0; jr < nc; jr += NR) {
+                        const size_t nr = std::min(NR, nc - jr);
+                        const float* b  = B.panel(pc, jc + jr);
+
+                        for (size_t ir = 0; ir < mc; ir += MR) {
+                            const size_t mr = std::min(MR, mc - ir);
+                            const float* a  = packedA + (ir * kc);
+                            float*       c  = C + ((ic + ir) * ldc) + jc + jr;
+
+                            if (mr == MR && nr == NR) {
+                                kernel.run(kc, a, b, c, ldc, sliceBeta);
+                                continue;
+                            }
+
+                            // Padded panels let the vector kernel run on edges, only the valid part is written back
+                            kernel.run(kc, a, b, edgeTile, NR, 0.0f);
+                            for (size_t i = 0; i < mr; ++i) {
+                                for (size_t j = 0; j < nr; ++j) {
+                                    float& out = c[(i * ldc) + j];
+                                    out        = sliceBeta == 0.0f ? edgeTile[(i * NR) + j] : (sliceBeta * out) + edgeTile[(i * NR) + j];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void NGemm::sgemm(size_t M, size_t N, size_t K, float alpha, const float* A, size_t lda, const CPackedB& B, float beta, float* C, size_t ldc, bool parallel) {
+    sgemmPacked(M, N, K, alpha, A, lda, B, beta, C, ldc, parallel);
+}
+
+void NGemm::sgemm(size_t M, size_t N, size_t K, float alpha, const float* A, size_t lda, const float* B, size_t ldb, float beta, float* C, size_t ldc, const SBlockSizes& blocks,
+                  const SGemmWorkspace& workspace) {
+    if (M == 0 || N == 0)
+        return;
+    if (K == 0 || alpha == 0.0f) {
+        scaleC(M, N, beta, C, ldc, false);
+        return;
+    }
+
+    const CPackedB packedB(B, K, N, ldb, blocks, workspace.packedB);
+    sgemmPacked(M, N, K, alpha, A, lda, packedB, beta, C, ldc, false, workspace.packedA);
+}
+
+void NGemm::sgemm(size_t M, size_t N, size_t K, float alpha, const NCommon::SFloat16* A, size_t lda, const CPackedB& B, float beta, float* C, size_t ldc, bool parallel) {
+    sgemmPacked(M, N, K, alpha, A, lda, B, beta, C, ldc, parallel);
+}
+
+void NGemm::sgemm(size_t M, size_t N, size_t K, float alpha, const NCommon::SBFloat16* A, size_t lda, const CPackedB& B, float beta, float* C, size_t ldc, bool parallel) {
+    sgemmPacked(M, N, K, alpha, A, lda, B, beta, C, ldc, parallel);
+}
+
+NGemm::AlignedBuffer NGemm::allocateMatrix(size_t rows, size_t cols, const SBlockSizes& blocks) {
+    AlignedBuffer matrix(rows * cols);
+    const size_t  rowBlocks = (rows + blocks.mc - 1) / blocks.mc;
+
+#pragma omp parallel
+    {
+        const auto [firstBlock, lastBlock] = ownedRowBlocks(rowBlocks, omp_get_thread_num(), omp_get_num_threads());
+        const size_t first                 = std::min(rows, firstBlock * blocks.mc);
+        const size_t last                  = std::min(rows, lastBlock * blocks.mc);
+        // One write per page places it, filling the rest would only be overwritten by the caller
+        float*       begin                 = matrix.data() + (first * cols);
+        float*       end                   = matrix.data() + (last * cols);
+        for (float* page = firstPage(begin); page < end; page += PAGE_FLOATS) {
+            *page = 0.0f;
+        }
+    }
+    return matrix;
+}
+
+std::string NGemm::affinityReport() {
+    static constexpr const char* BIND_NAMES[] = {"false", "true", "primary", "close", "spread"};
+    const omp_proc_bind_t        bind         = omp_get_proc_bind();
+    const size_t                 threads      = omp_get_max_threads();
+
+    std::vector<int>             cpus(threads, -1);
+    std::vector<int>             places(threads, -1);
+#pragma omp parallel
+    {
+        cpus[omp_get_thread_num()]   = sched_getcpu();
+        places[omp_get_thread_num()] = omp_get_place_num();
+    }
+
+    std::ostringstream report;
+    report << threads << " threads, proc_bind " << (static_cast<size_t>(bind) < std::size(BIND_NAMES) ? BIND_NAMES[bind] : "unknown") << ", " << omp_get_num_places()
+           << " places, thread:cpu/place";
+    for (size_t thread = 0; thread < threads; ++thread) {
+        report << " " << thread << ":" << cpus[thread] << "/" << places[thread];
+    }
+    if (bind == omp_proc_bind_false) {
+        report << " (unbound, set OMP_PROC_BIND=spread OMP_PLACES=cores to keep threads next to the memory they touched)";
+    }
+    return report.str();
+}
@@ -0,0 +1,27 @@
+#include "gemm_chain.hpp"
+#include <stdexcept>
+
+NGemm::CMatrixChain::CMatrixChain(const SBlockSizes& blocks) : blocks(blocks) {}
+
+void NGemm::CMatrixChain::multiply(std::span<const float* const> matrices, std::span<const size_t> dims, float* C, bool parallel) {
+    if (dims.size() != matrices.size() + 1)
+        throw std::runtime_error("A chain of n matrices needs n + 1 dimensions.");
+
+    plan = NCommon::planChain(dims);
+    if (scratch.size() < plan.bufferFloats.size())
+        scratch.resize(plan.bufferFloats.size());
+    scratchBytes = 0;
+    for (size_t i = 0; i < plan.bufferFloats.size(); i++) {
+        if (scratch[i].size() < plan.bufferFloats[i])
+            scratch[i] = AlignedBuffer(plan.bufferFloats[i]);
+        scratchBytes += plan.bufferFloats[i] * sizeof(float);
+    }
+
+    // Operands past the inputs are step results, each packed with its column count as leading dimension
+    const size_t count   = matrices.size();
+    auto         operand = [&](size_t index) -> const float* { return index < count ? matrices[index] : scratch[plan.steps[index - count].buffer].data(); };
+    for (const NCommon::SChainStep& step : plan.steps) {
+        float* result = step.buffer == NCommon::SChainPlan::OUTPUT ? C : scratch[step.buffer].data();
+        sgemm(step.M, step.N, step.K, 1.0f, operand(step.left), step.K, operand(step.right), step.N, 0.0f, result, step.N, blocks, parallel);
+    }
+}
@@ -0,0 +1,167 @@
+#include "gemm_kernels.hpp"
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GEMM_X86 1
+#include <immintrin.h>
+#endif
+
+// Each kernel is compiled for its own instruction set through a target attribute, so the binary stays
+// portable and only the dispatcher decides what runs. The scalar kernel is the reference for the rest.
+// Packed B panels start on a multiple of nr floats from a 64 byte aligned base, so B loads are aligned.
+
+static void kernelScalar(size_t kc, const float* a, const float* b, float* c, size_t ldc, float beta) {
+    constexpr size_t MR          = 4;
+    constexpr size_t NR          = 8;
+    float            acc[MR][NR] = {};
+
+    for (size_t p = 0; p < kc; ++p) {
+        const float* aCol = a + (p * MR);
+        const float* bRow = b + (p * NR);
+        for (size_t i = 0; i < MR; ++i) {
+            for (size_t j = 0; j < NR; ++j) {
+                acc[i][j] += aCol[i] * bRow[j];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < MR; ++i) {
+        for (size_t j = 0; j < NR; ++j) {
+            c[(i * ldc) + j] = beta == 0.0f ? acc[i][j] : (beta * c[(i * ldc) + j]) + acc[i][j];
+        }
+    }
+}
+
+#ifdef GEMM_X86
+// 4 x 8 tile in eight xmm accumulators. SSE has no FMA so multiply and add are separate.
+__attribute__((target("sse4.2"))) static void kernelSse42(size_t kc, const float* a, const float* b, float* c, size_t ldc, float beta) {
+    constexpr size_t MR = 4;
+    __m128           acc[MR][2];
+    for (size_t i = 0; i < MR; ++i) {
+        acc[i][0] = _mm_setzero_ps();
+        acc[i][1] = _mm_setzero_ps();
+    }
+
+    for (size_t p = 0; p < kc; ++p) {
+        const __m128 b0 = _mm_load_ps(b + (p * 8));
+        const __m128 b1 = _mm_load_ps(b + (p * 8) + 4);
+        for (size_t i = 0; i < MR; ++i) {
+            const __m128 aValue = _mm_set1_ps(a[(p * MR) + i]);
+            acc[i][0]           = _mm_add_ps(acc[i][0], _mm_mul_ps(aValue, b0));
+            acc[i][1]           = _mm_add_ps(acc[i][1], _mm_mul_ps(aValue, b1));
+        }
+    }
+
+    for (size_t i = 0; i < MR; ++i) {
+        float* cRow = c + (i * ldc);
+        if (beta != 0.0f) {
+            const __m128 betaV = _mm_set1_ps(beta);
+            acc[i][0]          = _mm_add_ps(acc[i][0], _mm_mul_ps(betaV, _mm_loadu_ps(cRow)));
+            acc[i][1]          = _mm_add_ps(acc[i][1], _mm_mul_ps(betaV, _mm_loadu_ps(cRow + 4)));
+        }
+        _mm_storeu_ps(cRow, acc[i][0]);
+        _mm_storeu_ps(cRow + 4, acc[i][1]);
+    }
+}
+
+// 6 x 16 tile in twelve ymm accumulators, leaving registers for two B vectors and the A broadcast
+__attribute__((target("avx2,fma"))) static void kernelAvx2(size_t kc, const float* a, const float* b, float* c, size_t ldc, float beta) {
+    constexpr size_t MR = 6;
+    __m256           acc[MR][2];
+    for (size_t i = 0; i < MR; ++i) {
+        acc[i][0] = _mm256_setzero_ps();
+        acc[i][1] = _mm256_setzero_ps();
+    }
+
+    for (size_t p = 0; p < kc; ++p) {
+        const __m256 b0 = _mm256_load_ps(b + (p * 16));
+        const __m256 b1 = _mm256_load_ps(b + (p * 16) + 8);
+        for (size_t i = 0; i < MR; ++i) {
+            const __m256 aValue = _mm256_broadcast_ss(a + (p * MR) + i);
+            acc[i][0]           = _mm256_fmadd_ps(aValue, b0, acc[i][0]);
+            acc[i][1]           = _mm256_fmadd_ps(aValue, b1, acc[i][1]);
+        }
+    }
+
+    for (size_t i = 0; i < MR; ++i) {
+        float* cRow = c + (i * ldc);
+        if (beta != 0.0f) {
+            const __m256 betaV = _mm256_set1_ps(beta);
+            acc[i][0]          = _mm256_fmadd_ps(betaV, _mm256_loadu_ps(cRow), acc[i][0]);
+            acc[i][1]          = _mm256_fmadd_ps(betaV, _mm256_loadu_ps(cRow + 8), acc[i][1]);
+        }
+        _mm256_storeu_ps(cRow, acc[i][0]);
+        _mm256_storeu_ps(cRow + 8, acc[i][1]);
+    }
+}
+
+// 8 x 32 tile in sixteen zmm accumulators
+__attribute__((target("avx512f"))) static void kernelAvx512(size_t kc, const float* a, const float* b, float* c, size_t ldc, float beta) {
+    constexpr size_t MR = 8;
+    __m512           acc[MR][2];
+    for (size_t i = 0; i < MR; ++i) {
+        acc[i][0] = _mm512_setzero_ps();
+        acc[i][1] = _mm512_setzero_ps();
+    }
+
+    for (size_t p = 0; p < kc; ++p) {
+        const __m512 b0 = _mm512_load_ps(b + (p * 32));
+        const __m512 b1 = _mm512_load_ps(b + (p * 32) + 16);
+        for (size_t i = 0; i < MR; ++i) {
+            const __m512 aValue = _mm512_set1_ps(a[(p * MR) + i]);
+            acc[i][0]           = _mm512_fmadd_ps(aValue, b0, acc[i][0]);
+            acc[i][1]           = _mm512_fmadd_ps(aValue, b1, acc[i][1]);
+        }
+    }
+
+    for (size_t i = 0; i < MR; ++i) {
+        float* cRow = c + (i * ldc);
+        if (beta != 0.0f) {
+            const __m512 betaV = _mm512_set1_ps(beta);
+            acc[i][0]          = _mm512_fmadd_ps(betaV, _mm512_loadu_ps(cRow), acc[i][0]);
+            acc[i][1]          = _mm512_fmadd_ps(betaV, _mm512_loadu_ps(cRow + 16), acc[i][1]);
+        }
+        _mm512_storeu_ps(cRow, acc[i][0]);
+        _mm512_storeu_ps(cRow + 16, acc[i][1]);
+    }
+}
+#endif
+
+const NGemm::SMicroKernel& NGemm::scalarKernel() {
+    static const SMicroKernel kernel{.name = "scalar", .mr = 4, .nr = 8, .run = kernelScalar, .flopsPerCycle = 2};
+    return kernel;
+}
+
+std::vector<NGemm::SMicroKernel> NGemm::availableKernels() {
+    std::vector<SMicroKernel> kernels{scalarKernel()};
+#ifdef GEMM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        kernels.push_back({.name = "sse4.2", .mr = 4, .nr = 8, .run = kernelSse42, .flopsPerCycle = 8});
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        kernels.push_back({.name = "avx2", .mr = 6, .nr = 16, .run = kernelAvx2, .flopsPerCycle = 32});
+    if (__builtin_cpu_supports("avx512f"))
+        kernels.push_back({.name = "avx512", .mr = 8, .nr = 32, .run = kernelAvx512, .flopsPerCycle = 64});
+#endif
+    return kernels;
+}
+
+static NGemm::SMicroKernel pickKernel() {
+    const std::vector<NGemm::SMicroKernel> kernels   = NGemm::availableKernels();
+    const char*                            requested = std::getenv("GEMM_KERNEL");
+    if (requested == nullptr || *requested == '\0')
+        return kernels.back();
+
+    for (const NGemm::SMicroKernel& kernel : kernels) {
+        if (requested == std::string(kernel.name))
+            return kernel;
+    }
+    throw std::runtime_error(std::string("GEMM_KERNEL '") + requested + "' is unknown or not supported by this CPU");
+}
+
+const NGemm::SMicroKernel& NGemm::activeKernel() {
+    static const SMicroKernel kernel = pickKernel();
+    return kernel;
+}
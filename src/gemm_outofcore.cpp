@@ -0,0 +1,79 @@
+#include "gemm_outofcore.hpp"
+#include "gemm_kernels.hpp"
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+NGemm::SOutOfCoreReport NGemm::sgemmOutOfCore(const NCommon::CMappedMatrix& A, const NCommon::CMappedMatrix& B, NCommon::CMappedMatrix& C, size_t memoryBudget,
+                                              const SBlockSizes& blocks) {
+    const size_t M = A.rows, N = B.cols, K = A.cols;
+    if (B.rows != K || C.rows != M || C.cols != N)
+        throw std::runtime_error("Matrix files do not form an M x K by K x N multiply into M x N.");
+
+    SOutOfCoreReport                            report;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (M == 0 || N == 0)
+        return report;
+
+    // Half the budget for the packed B band, the other half for double buffered A and C row bands
+    const size_t NR        = activeKernel().nr;
+    const size_t halfBytes = memoryBudget / 2;
+    report.bandCols        = std::min(N, halfBytes / (sizeof(float) * std::max<size_t>(K, 1)) / NR * NR);
+    report.bandRows        = std::min(M, halfBytes / (2 * sizeof(float) * (K + N)));
+    if (report.bandCols == 0 || report.bandRows == 0)
+        throw std::runtime_error("Memory budget is too small for a single row of A and C or panel of B.");
+    // Whole mc blocks keep the kernel's row blocking intact
+    if (report.bandRows > blocks.mc)
+        report.bandRows = report.bandRows / blocks.mc * blocks.mc;
+    report.rowBands = (M + report.bandRows - 1) / report.bandRows;
+    report.colBands = (N + report.bandCols - 1) / report.bandCols;
+
+    // Brings the A and C rows of a band in on the I/O thread
+    auto loadBand = [&](size_t band) {
+        const size_t first = band * report.bandRows;
+        const size_t last  = std::min(M, first + report.bandRows);
+        return std::async(std::launch::async, [&A, &C, first, last] {
+            A.loadRows(first, last);
+            C.loadRows(first, last);
+        });
+    };
+
+    for (size_t jc = 0; jc < N; jc += report.bandCols) {
+        const size_t                                nb        = std::min(report.bandCols, N - jc);
+        std::future<void>                           next      = loadBand(0);
+
+        const std::chrono::steady_clock::time_point packStart = std::chrono::steady_clock::now();
+        const CPackedB                              packedB(B.data() + jc, K, nb, N, blocks, true);
+        report.packSeconds += secondsSince(packStart);
+        B.releaseRows(0, K);
+
+        for (size_t band = 0; band < report.rowBands; ++band) {
+            const size_t                                first     = band * report.bandRows;
+            const size_t                                rows      = std::min(report.bandRows, M - first);
+
+            const std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+            next.get();
+            report.ioWaitSeconds += secondsSince(waitStart);
+            if (band + 1 < report.rowBands)
+                next = loadBand(band + 1);
+
+            const std::chrono::steady_clock::time_point computeStart = std::chrono::steady_clock::now();
+            sgemm(rows, nb, K, 1.0f, A.data() + (first * K), K, packedB, 0.0f, C.mutableData() + (first * N) + jc, N, true);
+            report.computeSeconds += secondsSince(computeStart);
+
+            // The finished C rows start their way to disk, and neither band is needed again until the next column band
+            C.flushRows(first, first + rows);
+            C.releaseRows(first, first + rows);
+            A.releaseRows(first, first + rows);
+        }
+    }
+
+    C.sync();
+    report.totalSeconds = secondsSince(start);
+    return report;
+}
@@ -0,0 +1,75 @@
+#include "HybridExecutor.hpp"
+#include "common.hpp"
+#include "gemm.hpp"
+#include "gemm_kernels.hpp"
+#include "verify.hpp"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <spdlog/spdlog.h>
+#include <chrono>
+#include <vector>
+#include <omp.h>
+
+int main(int argc, char** argv) {
+#ifndef NDEBUG
+    spdlog::set_level(spdlog::level::debug);
+#ifdef TRACE
+    spdlog::set_level(spdlog::level::trace);
+#endif
+#endif
+    NCommon::SOptions options;
+    try {
+        options = NCommon::parseOptions(argc, argv);
+        // Everything else parseOptions accepts belongs to another program and would silently be ignored here
+        if (options.memoryBudget > 0 || !options.chain.empty() || !options.input.empty() || !options.output.empty() || options.precision != NCommon::EPrecision::Float32 ||
+            options.strassenCutover > 0 || options.perf || options.stream || options.batch > 1)
+            throw std::runtime_error("The hybrid program only supports the problem size, --seed, --autotune and --verify.");
+        // The executor takes 32 bit sizes, narrowing larger ones would silently multiply a different problem
+        if (std::max({options.m, options.n, options.k}) > std::numeric_limits<uint32_t>::max())
+            throw std::runtime_error("Sizes above 4294967295 are not supported by the hybrid program.");
+    } catch (const std::runtime_error& err) {
+        spdlog::error("{}", err.what());
+        return EXIT_FAILURE;
+    }
+    const uint32_t M = options.m, N = options.n, K = options.k;
+
+    spdlog::trace("Generating random matrices.");
+    NCommon::MatrixBuffer matrixA = NCommon::generateRandomMatrix(M, K, options.seed);
+    NCommon::MatrixBuffer matrixB = NCommon::generateRandomMatrix(K, N, options.seed + 1);
+    NCommon::MatrixBuffer matrixC(static_cast<size_t>(M) * N);
+    spdlog::trace("Random matrices generated.");
+
+    const NGemm::SBlockSizes blocks = NGemm::blockSizesFromEnv();
+    CVulkanContext           context;
+    if (options.autotune)
+        context.autotune(M, N, K);
+    CHybridExecutor executor(context, blocks);
+
+    spdlog::info("Starting hybrid matrix multiplication ({}x{}x{}) on {} OpenMP threads and {}. Kernel: {}, block sizes: {}", M, N, K, omp_get_max_threads(), context.deviceName,
+                 NGemm::activeKernel().name, NGemm::toString(blocks));
+    std::chrono::time_point       start    = std::chrono::high_resolution_clock::now();
+    const SHybridReport           report   = executor.sgemm(M, N, K, 1.0f, matrixA.data(), K, matrixB.data(), N, 0.0f, matrixC.data(), N);
+    std::chrono::time_point       end      = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> duration = end - start;
+    spdlog::info("CPU: {} rows in {} chunks, busy {} s, {} GFLOP/s", report.cpuRows, report.cpuChunks, report.cpuSeconds, report.cpuGflops);
+    spdlog::info("GPU: {} rows in {} chunks, busy {} s, {} GFLOP/s", report.gpuRows, report.gpuChunks, report.gpuSeconds, report.gpuGflops);
+    spdlog::info("Computation completed in {} seconds", duration.count());
+
+    // Freivalds check, catching rows either side got wrong in O(n^2)
+    if (options.verify) {
+        const NCommon::SVerifyReport check = NCommon::verifyProduct(M, N, K, matrixA.data(), K, matrixB.data(), N, matrixC.data(), N, NCommon::EPrecision::Float32, options.seed);
+        spdlog::info("Verification took {} seconds over {} rounds, worst row {} is {} of its error bound", check.seconds, check.rounds, check.worstRow, check.worstRatio);
+        if (!check.passed) {
+            spdlog::error("C does not match A * B: row {} is off by {} against a bound of {}", check.worstRow, check.residual, check.bound);
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::cout << "Press enter to continue...";
+    std::cin.get();
+
+    NCommon::printCorner(matrixC, M, N);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,102 @@
+#include "matrix_chain.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+// cost[i][j] is the cheapest way to form matrices i..j and split[i][j] the matrix the outermost multiply splits after.
+// Costs are doubles, so a product of three large dimensions cannot overflow.
+
+struct SChainPlanner {
+    std::span<const size_t>          dims;
+    std::vector<std::vector<size_t>> split;
+    NCommon::SChainPlan              plan;
+    // Scratch buffers not holding a live intermediate
+    std::vector<size_t>              freeBuffers;
+
+    // Smallest free buffer that already holds floats, else the largest free one grown to fit, else a new one
+    size_t takeBuffer(size_t floats) {
+        auto fits    = freeBuffers.end();
+        auto largest = freeBuffers.end();
+        for (auto it = freeBuffers.begin(); it != freeBuffers.end(); ++it) {
+            const size_t size = plan.bufferFloats[*it];
+            if (size >= floats && (fits == freeBuffers.end() || size < plan.bufferFloats[*fits]))
+                fits = it;
+            if (largest == freeBuffers.end() || size > plan.bufferFloats[*largest])
+                largest = it;
+        }
+
+        const auto chosen = fits != freeBuffers.end() ? fits : largest;
+        if (chosen == freeBuffers.end()) {
+            plan.bufferFloats.push_back(floats);
+            return plan.bufferFloats.size() - 1;
+        }
+        const size_t buffer       = *chosen;
+        plan.bufferFloats[buffer] = std::max(plan.bufferFloats[buffer], floats);
+        freeBuffers.erase(chosen);
+        return buffer;
+    }
+
+    // Emits the steps forming matrices i..j in post order and returns the operand holding the result
+    size_t emit(size_t i, size_t j, bool last) {
+        if (i == j)
+            return i;
+
+        const size_t        s     = split[i][j];
+        const size_t        left  = emit(i, s, false);
+        const size_t        right = emit(s + 1, j, false);
+        const size_t        count = dims.size() - 1;
+
+        NCommon::SChainStep step{.left = left, .right = right, .M = dims[i], .N = dims[j + 1], .K = dims[s + 1], .buffer = NCommon::SChainPlan::OUTPUT};
+        // The result needs its buffer while both operands are still being read, so theirs are only freed after
+        if (!last)
+            step.buffer = takeBuffer(step.M * step.N);
+        for (size_t operand : {left, right}) {
+            if (operand >= count)
+                freeBuffers.push_back(plan.steps[operand - count].buffer);
+        }
+        plan.steps.push_back(step);
+        return count + plan.steps.size() - 1;
+    }
+
+    // Appends matrices i..j fully parenthesised to out
+    void name(size_t i, size_t j, std::string& out) const {
+        if (i == j) {
+            out.append("M").append(std::to_string(i));
+            return;
+        }
+        out.append("(");
+        name(i, split[i][j], out);
+        out.append(" ");
+        name(split[i][j] + 1, j, out);
+        out.append(")");
+    }
+};
+
+NCommon::SChainPlan NCommon::planChain(std::span<const size_t> dims) {
+    if (dims.size() < 3)
+        throw std::runtime_error("A matrix chain needs at least two matrices.");
+
+    const size_t                     count = dims.size() - 1;
+    std::vector<std::vector<double>> cost(count, std::vector<double>(count, 0.0));
+    SChainPlanner                    planner{.dims = dims, .split = std::vector<std::vector<size_t>>(count, std::vector<size_t>(count, 0))};
+    for (size_t length = 2; length <= count; length++) {
+        for (size_t i = 0; i + length <= count; i++) {
+            const size_t j = i + length - 1;
+            cost[i][j]     = -1;
+            for (size_t s = i; s < j; s++) {
+                const double candidate = cost[i][s] + cost[s + 1][j] + (static_cast<double>(dims[i]) * static_cast<double>(dims[s + 1]) * static_cast<double>(dims[j + 1]));
+                if (cost[i][j] < 0 || candidate < cost[i][j]) {
+                    cost[i][j]          = candidate;
+                    planner.split[i][j] = s;
+                }
+            }
+        }
+    }
+
+    planner.emit(0, count - 1, true);
+    planner.plan.cost = cost[0][count - 1];
+    planner.name(0, count - 1, planner.plan.order);
+    for (size_t j = 1; j < count; j++) {
+        planner.plan.leftToRightCost += static_cast<double>(dims[0]) * static_cast<double>(dims[j]) * static_cast<double>(dims[j + 1]);
+    }
+    return planner.plan;
+}
@@ -1,10 +1,103 @@
 #include "common.hpp"
+#include "gemm.hpp"
+#include "gemm_kernels.hpp"
+#include "strassen.hpp"
+#include "MatrixFile.hpp"
+#include "verify.hpp"
+#include "perf_counters.hpp"
+#include "report.hpp"
+#include "gemm_outofcore.hpp"
+#include "gemm_chain.hpp"
 #include <iostream>
 #include <spdlog/spdlog.h>
 #include <chrono>
+#include <optional>
+#include <tuple>
 #include <omp.h>
 
-int main() {
+// Multiplies through matrix files in --output without holding any of the matrices in memory. A and B come from
+// --input, or are generated straight into files when there is none.
+static int runOutOfCore(const NCommon::SOptions& options, std::optional<NCommon::SMappedInputs>& mapped, const NGemm::SBlockSizes& blocks) {
+    const size_t M = options.m, N = options.n, K = options.k;
+    if (options.output.empty()) {
+        spdlog::error("--budget needs --output for the directory C.bin is written to");
+        return EXIT_FAILURE;
+    }
+
+    try {
+        std::filesystem::create_directories(options.output);
+        if (!mapped) {
+            spdlog::trace("Generating random matrices.");
+            for (const auto& [name, rows, cols, seed] : {std::tuple{"A.bin", M, K, options.seed}, std::tuple{"B.bin", K, N, options.seed + 1}}) {
+                NCommon::CMappedMatrix file = NCommon::CMappedMatrix::create(options.output / name, rows, cols);
+                NCommon::fillRandom({file.mutableData(), rows * cols}, seed);
+                file.sync();
+            }
+            mapped = NCommon::SMappedInputs{.a = NCommon::CMappedMatrix::open(options.output / "A.bin"), .b = NCommon::CMappedMatrix::open(options.output / "B.bin")};
+            spdlog::trace("Random matrices generated.");
+        }
+        NCommon::CMappedMatrix matrixC = NCommon::CMappedMatrix::create(options.output / "C.bin", M, N);
+
+        spdlog::info("Starting out-of-core matrix multiplication ({}x{}x{}) within {} MiB. Kernel: {}, block sizes: {}", M, N, K, options.memoryBudget,
+                     NGemm::activeKernel().name, NGemm::toString(blocks));
+        const NGemm::SOutOfCoreReport report = NGemm::sgemmOutOfCore(mapped->a, mapped->b, matrixC, options.memoryBudget << 20, blocks);
+        spdlog::info("{} row bands of {} rows by {} column bands of {} columns: pack {} s, compute {} s, I/O wait {} s", report.rowBands, report.bandRows, report.colBands,
+                     report.bandCols, report.packSeconds, report.computeSeconds, report.ioWaitSeconds);
+        spdlog::info("Computation completed in {} seconds", report.totalSeconds);
+
+        if (options.verify) {
+            const NCommon::SVerifyReport check = NCommon::verifyProduct(M, N, K, mapped->a.data(), K, mapped->b.data(), N, matrixC.data(), N, options.precision, options.seed);
+            spdlog::info("Verification took {} seconds over {} rounds, worst row {} is {} of its error bound", check.seconds, check.rounds, check.worstRow, check.worstRatio);
+            if (!check.passed) {
+                spdlog::error("C does not match A * B: row {} is off by {} against a bound of {}", check.worstRow, check.residual, check.bound);
+                return EXIT_FAILURE;
+            }
+        }
+
+        std::cout << "Press enter to continue...";
+        std::cin.get();
+
+        NCommon::printCorner(matrixC.values(), M, N);
+    } catch (const std::runtime_error& err) {
+        spdlog::error("{}", err.what());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Multiplies the generated chain of --chain, matrix i from seed + i, in the order with the fewest multiply-adds
+static int runChain(const NCommon::SOptions& options, const NGemm::SBlockSizes& blocks) {
+    const std::vector<size_t>&        dims = options.chain;
+    std::vector<NGemm::AlignedBuffer> storage;
+    std::vector<const float*>         matrices;
+    spdlog::trace("Generating random matrices.");
+    for (size_t i = 0; i + 1 < dims.size(); i++) {
+        storage.push_back(NGemm::allocateMatrix(dims[i], dims[i + 1], blocks));
+        NCommon::fillRandom(storage.back(), options.seed + i);
+        matrices.push_back(storage.back().data());
+    }
+    spdlog::trace("Random matrices generated.");
+    NGemm::AlignedBuffer matrixC = NGemm::allocateMatrix(dims.front(), dims.back(), blocks);
+
+    spdlog::info("Starting parallel chain multiplication of {} matrices ({}x{} result). Kernel: {}, block sizes: {}", matrices.size(), dims.front(), dims.back(),
+                 NGemm::activeKernel().name, NGemm::toString(blocks));
+    NGemm::CMatrixChain     chain(blocks);
+    std::chrono::time_point start = std::chrono::high_resolution_clock::now();
+    chain.multiply(matrices, dims, matrixC.data(), true);
+    std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start;
+    spdlog::info("Order {}: {} multiply-adds against {} left to right ({}x fewer)", chain.plan.order, chain.plan.cost, chain.plan.leftToRightCost,
+                 chain.plan.leftToRightCost / chain.plan.cost);
+    spdlog::debug("{} steps through {} scratch buffers of {} MiB in total", chain.plan.steps.size(), chain.plan.bufferFloats.size(), chain.scratchBytes >> 20);
+    spdlog::info("Computation completed in {} seconds", duration.count());
+
+    std::cout << "Press enter to continue...";
+    std::cin.get();
+
+    NCommon::printCorner(matrixC, dims.front(), dims.back());
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
 #ifndef NDEBUG
     spdlog::set_level(spdlog::level::debug);
 #ifdef TRACE
@@ -12,37 +105,97 @@ int main() {
 #endif
 #endif
 
-    spdlog::trace("Generating random matrices.");
-    std::vector<float> matrixA = NCommon::generateRandomMatrix(NCommon::MATRIX_SIZE);
-    std::vector<float> matrixB = NCommon::generateRandomMatrix(NCommon::MATRIX_SIZE);
-    std::vector<float> matrixC(NCommon::MATRIX_SIZE * NCommon::MATRIX_SIZE, 0.0f);
-    spdlog::trace("Random matrices generated.");
+    NCommon::SOptions                     options;
+    std::optional<NCommon::SMappedInputs> mapped;
+    try {
+        options = NCommon::parseOptions(argc, argv);
+        if (!options.input.empty())
+            mapped = NCommon::mapInputs(options);
+    } catch (const std::runtime_error& err) {
+        spdlog::error("{}", err.what());
+        return EXIT_FAILURE;
+    }
+    const size_t M = options.m, N = options.n, K = options.k;
 
-    spdlog::info("Starting parallel matrix multiplication.");
+    const NGemm::SBlockSizes blocks = NGemm::blockSizesFromEnv();
+    spdlog::info("OpenMP: {}", NGemm::affinityReport());
+    if (options.memoryBudget > 0)
+        return runOutOfCore(options, mapped, blocks);
+    if (!options.chain.empty())
+        return runChain(options, blocks);
+
+    // Inputs mapped from --input go straight to the kernel. Generated ones have their pages first touched by the
+    // threads that compute those rows before the values are filled in.
+    NGemm::AlignedBuffer matrixA;
+    NGemm::AlignedBuffer matrixB;
+    if (!mapped) {
+        spdlog::trace("Generating random matrices.");
+        matrixA = NGemm::allocateMatrix(M, K, blocks);
+        matrixB = NGemm::allocateMatrix(K, N, blocks);
+        NCommon::fillRandom(matrixA, options.seed);
+        NCommon::fillRandom(matrixB, options.seed + 1);
+        spdlog::trace("Random matrices generated.");
+    }
+    const float*         A       = mapped ? mapped->a.data() : matrixA.data();
+    const float*         B       = mapped ? mapped->b.data() : matrixB.data();
+    NGemm::AlignedBuffer matrixC = NGemm::allocateMatrix(M, N, blocks);
+
+    // Reduced precision inputs are rounded once up front, as if they had been stored that way
+    std::vector<NCommon::SFloat16>  halfA;
+    std::vector<NCommon::SFloat16>  halfB;
+    std::vector<NCommon::SBFloat16> bfloatA;
+    std::vector<NCommon::SBFloat16> bfloatB;
+    if (options.precision == NCommon::EPrecision::Float16) {
+        halfA.resize(M * K);
+        halfB.resize(K * N);
+        NCommon::narrow({A, M * K}, halfA);
+        NCommon::narrow({B, K * N}, halfB);
+    } else if (options.precision == NCommon::EPrecision::BFloat16) {
+        bfloatA.resize(M * K);
+        bfloatB.resize(K * N);
+        NCommon::narrow({A, M * K}, bfloatA);
+        NCommon::narrow({B, K * N}, bfloatB);
+    }
+
+    spdlog::info("Starting parallel matrix multiplication ({}x{}x{}). Kernel: {}, block sizes: {}, Strassen cutover: {}, precision: {}", M, N, K,
+                 NGemm::activeKernel().name, NGemm::toString(blocks), options.strassenCutover, NCommon::toString(options.precision));
+    // Counters are opened before the clock starts, so only switching them on and off falls inside the timing
+    std::optional<NCommon::CPerfCounters> counters;
+    if (options.perf) {
+        counters.emplace(true);
+        counters->start();
+    }
     std::chrono::time_point start = std::chrono::high_resolution_clock::now();
-#pragma omp parallel for collapse(2)
-    for (size_t row = 0; row < NCommon::MATRIX_SIZE; ++row) {
-        for (size_t col = 0; col < NCommon::MATRIX_SIZE; ++col) {
-            float total = 0.0f;
-            for (size_t k = 0; k < NCommon::MATRIX_SIZE; ++k) {
-                total += matrixA[(row * NCommon::MATRIX_SIZE) + k] * matrixB[(k * NCommon::MATRIX_SIZE) + col];
-            }
-            matrixC[(row * NCommon::MATRIX_SIZE) + col] = total;
-        }
+    if (options.strassenCutover > 0) {
+        NGemm::CStrassen strassen(blocks, options.strassenCutover);
+        strassen.multiply(M, N, K, A, K, B, N, matrixC.data(), N, true);
+        spdlog::debug("Strassen recursed {} levels using {} MiB of scratch", strassen.depth, strassen.scratchBytes >> 20);
+    } else if (options.precision == NCommon::EPrecision::Float16) {
+        NGemm::sgemm(M, N, K, 1.0f, halfA.data(), K, halfB.data(), N, 0.0f, matrixC.data(), N, blocks, true);
+    } else if (options.precision == NCommon::EPrecision::BFloat16) {
+        NGemm::sgemm(M, N, K, 1.0f, bfloatA.data(), K, bfloatB.data(), N, 0.0f, matrixC.data(), N, blocks, true);
+    } else {
+        NGemm::sgemm(M, N, K, 1.0f, A, K, B, N, 0.0f, matrixC.data(), N, blocks, true);
     }
     std::chrono::time_point       end      = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> duration = end - start;
+    if (counters)
+        counters->stop();
     spdlog::info("Computation completed in {} seconds", duration.count());
 
+    const NCommon::SArenaStats arena = NCommon::CArena::instance().stats();
+    spdlog::debug("Arena: {} MiB mapped, {} blocks mapped and {} reused, {} on reserved huge pages, {} advised for transparent huge pages", arena.mappedBytes >> 20,
+                  arena.freshBlocks, arena.reusedBlocks, arena.hugeTlbBlocks, arena.transparentBlocks);
+
+    const NCommon::SCpuRun run{.m = M, .n = N, .k = K, .a = A, .b = B, .c = matrixC, .blocks = blocks, .parallel = true, .seconds = duration.count()};
+    const int              status = NCommon::reportCpuRun(options, run, counters);
+    if (status != EXIT_SUCCESS)
+        return status;
+
     std::cout << "Press enter to continue...";
     std::cin.get();
 
-    const size_t print_limit = 12;
-    for (size_t i = 0; i < print_limit; i++) {
-        for (size_t j = 0; j < print_limit; j++) {
-            std::cout << "C[" << i << "][" << j << "] = " << matrixC[(i * NCommon::MATRIX_SIZE) + j] << std::endl;
-        }
-    }
+    NCommon::printCorner(matrixC, M, N);
 
     return EXIT_SUCCESS;
 }
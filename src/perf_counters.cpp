@@ -0,0 +1,303 @@
+#include "perf_counters.hpp"
+#include "arena.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <utility>
+#include <omp.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Every counter is opened on its own rather than as a group: a group is all or nothing, and hosts commonly refuse
+// just the cache events. The price is that counters may be multiplexed, which the TOTAL_TIME fields scale back out.
+
+static constexpr double CACHE_LINE_BYTES = 64.0;
+
+static std::optional<double> envPositive(const char* name) {
+    const char* value = std::getenv(name);
+    if (value == nullptr || *value == '\0')
+        return std::nullopt;
+    char*        end    = nullptr;
+    const double parsed = std::strtod(value, &end);
+    if (end == value || *end != '\0' || !(parsed > 0))
+        return std::nullopt;
+    return parsed;
+}
+
+const char* NCommon::toString(ECounter counter) {
+    switch (counter) {
+        case ECounter::Cycles: return "cycles";
+        case ECounter::Instructions: return "instructions";
+        case ECounter::L1dMisses: return "L1d misses";
+        case ECounter::LlcMisses: return "LLC misses";
+        case ECounter::DtlbMisses: return "dTLB misses";
+    }
+    return "unknown";
+}
+
+#ifdef __linux__
+static constexpr uint64_t readMisses(uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+// Type and config of each ECounter, in order
+static constexpr std::pair<uint32_t, uint64_t> EVENTS[NCommon::COUNTER_COUNT] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, readMisses(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HW_CACHE, readMisses(PERF_COUNT_HW_CACHE_LL)},
+    {PERF_TYPE_HW_CACHE, readMisses(PERF_COUNT_HW_CACHE_DTLB)},
+};
+
+// Disabled user space counter on the calling thread, -1 with errno set on failure
+static int openCounter(uint32_t type, uint64_t config) {
+    perf_event_attr attr{};
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+// Count scaled up from the time the counter was on the PMU to the time it was enabled, empty if it never was
+static std::optional<uint64_t> readCounter(int descriptor) {
+    uint64_t data[3] = {};
+    if (descriptor < 0 || ::read(descriptor, data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)) || data[2] == 0)
+        return std::nullopt;
+    if (data[2] < data[1])
+        return static_cast<uint64_t>(static_cast<double>(data[0]) * static_cast<double>(data[1]) / static_cast<double>(data[2]));
+    return data[0];
+}
+#endif
+
+NCommon::CPerfCounters::CPerfCounters(bool parallel) {
+#ifdef __linux__
+    const size_t threads = parallel ? static_cast<size_t>(omp_get_max_threads()) : 1;
+    std::array<int, COUNTER_COUNT> closed;
+    closed.fill(-1);
+    descriptors.assign(threads, closed);
+    std::vector<int> errors(threads, 0);
+
+    // perf_event_open with pid 0 follows the thread that calls it, so each team thread opens its own
+    auto             openAll = [&](size_t thread) {
+        for (size_t counter = 0; counter < COUNTER_COUNT; counter++) {
+            descriptors[thread][counter] = openCounter(EVENTS[counter].first, EVENTS[counter].second);
+            if (descriptors[thread][counter] < 0 && errors[thread] == 0)
+                errors[thread] = errno;
+        }
+    };
+    if (parallel) {
+#pragma omp parallel num_threads(threads)
+        openAll(omp_get_thread_num());
+    } else {
+        openAll(0);
+    }
+
+    std::string missing;
+    for (size_t counter = 0; counter < COUNTER_COUNT; counter++) {
+        const bool opened = std::all_of(descriptors.begin(), descriptors.end(), [counter](const std::array<int, COUNTER_COUNT>& fds) { return fds[counter] >= 0; });
+        available         = available || opened;
+        if (!opened)
+            missing += std::string(missing.empty() ? "" : ", ") + toString(static_cast<ECounter>(counter));
+    }
+    if (!available) {
+        const int error = *std::max_element(errors.begin(), errors.end());
+        reason          = std::string("perf_event_open failed: ") + std::strerror(error);
+        if (error == EACCES || error == EPERM)
+            reason += ", lower /proc/sys/kernel/perf_event_paranoid to 2 or grant CAP_PERFMON";
+    } else if (!missing.empty()) {
+        reason = "not counted on this host: " + missing;
+    }
+#else
+    reason = "hardware counters need Linux perf_event_open";
+#endif
+}
+
+NCommon::CPerfCounters::~CPerfCounters() {
+#ifdef __linux__
+    for (const std::array<int, COUNTER_COUNT>& fds : descriptors) {
+        for (int descriptor : fds) {
+            if (descriptor >= 0)
+                ::close(descriptor);
+        }
+    }
+#endif
+}
+
+// The descriptors are not tied to the thread using them, so one thread switches every counter
+void NCommon::CPerfCounters::start() {
+#ifdef __linux__
+    for (const std::array<int, COUNTER_COUNT>& fds : descriptors) {
+        for (int descriptor : fds) {
+            if (descriptor >= 0) {
+                ::ioctl(descriptor, PERF_EVENT_IOC_RESET, 0);
+                ::ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+#endif
+}
+
+void NCommon::CPerfCounters::stop() {
+#ifdef __linux__
+    for (const std::array<int, COUNTER_COUNT>& fds : descriptors) {
+        for (int descriptor : fds) {
+            if (descriptor >= 0)
+                ::ioctl(descriptor, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+#endif
+}
+
+NCommon::SPerfReport NCommon::CPerfCounters::report(double seconds, double flops, double compulsoryBytes, double flopsPerCycle) const {
+    SPerfReport report{.available = available, .reason = reason, .seconds = seconds, .flops = flops};
+    report.compulsoryBytesPerFlop = flops > 0 ? compulsoryBytes / flops : 0;
+    if (!available)
+        return report;
+
+#ifdef __linux__
+    // A total only exists when every thread has the counter, a partial sum would read as fewer events
+    std::array<bool, COUNTER_COUNT> complete;
+    complete.fill(true);
+    std::array<uint64_t, COUNTER_COUNT> sums{};
+    for (const std::array<int, COUNTER_COUNT>& fds : descriptors) {
+        SCounterValues values;
+        for (size_t counter = 0; counter < COUNTER_COUNT; counter++) {
+            values.values[counter] = readCounter(fds[counter]);
+            complete[counter]      = complete[counter] && values.values[counter].has_value();
+            sums[counter] += values.values[counter].value_or(0);
+        }
+        report.threads.push_back(values);
+    }
+    for (size_t counter = 0; counter < COUNTER_COUNT; counter++) {
+        if (complete[counter])
+            report.total.values[counter] = sums[counter];
+    }
+#endif
+
+    const std::optional<uint64_t> cycles       = report.total[ECounter::Cycles];
+    const std::optional<uint64_t> instructions = report.total[ECounter::Instructions];
+    const std::optional<uint64_t> llcMisses    = report.total[ECounter::LlcMisses];
+    if (cycles && instructions && *cycles > 0)
+        report.ipc = static_cast<double>(*instructions) / static_cast<double>(*cycles);
+    if (!llcMisses || flops <= 0 || seconds <= 0)
+        return report;
+    const double dramBytes = static_cast<double>(*llcMisses) * CACHE_LINE_BYTES;
+    report.bytesPerFlop    = dramBytes / flops;
+
+    // The compute roof runs at the clock the busiest thread was measured at, on every thread
+    std::optional<double> peakGflops = envPositive("PERF_PEAK_GFLOPS");
+    if (!peakGflops && cycles) {
+        uint64_t busiest = 0;
+        for (const SCounterValues& values : report.threads) {
+            busiest = std::max(busiest, values[ECounter::Cycles].value_or(0));
+        }
+        peakGflops = static_cast<double>(report.threads.size()) * (static_cast<double>(busiest) / seconds) * flopsPerCycle / 1e9;
+    }
+    if (!peakGflops)
+        return report;
+
+    SRoofline roofline{
+        .arithmeticIntensity = dramBytes > 0 ? flops / dramBytes : std::numeric_limits<double>::infinity(),
+        .attainedGflops      = flops / seconds / 1e9,
+        .peakGflops          = *peakGflops,
+        .peakBandwidthGBs    = memoryBandwidthGBs(),
+    };
+    roofline.roofGflops  = std::min(roofline.peakGflops, roofline.arithmeticIntensity * roofline.peakBandwidthGBs);
+    roofline.memoryBound = roofline.roofGflops < roofline.peakGflops;
+    report.roofline      = roofline;
+    return report;
+}
+
+double NCommon::memoryBandwidthGBs() {
+    static const double bandwidth = [] {
+        if (const std::optional<double> configured = envPositive("PERF_PEAK_GBS"))
+            return *configured;
+
+        // Three 64 MiB arrays, first touched with the schedule the triad uses, best of a few passes
+        constexpr size_t      COUNT = size_t(16) << 20;
+        NCommon::MatrixBuffer a(COUNT);
+        NCommon::MatrixBuffer b(COUNT);
+        NCommon::MatrixBuffer c(COUNT);
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < COUNT; i++) {
+            a[i] = 0.0f;
+            b[i] = 1.0f;
+            c[i] = 2.0f;
+        }
+
+        double best = 0;
+        for (size_t pass = 0; pass < 4; pass++) {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#pragma omp parallel for schedule(static)
+            for (size_t i = 0; i < COUNT; i++) {
+                a[i] = b[i] + (3.0f * c[i]);
+            }
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            best                 = std::max(best, 3.0 * sizeof(float) * COUNT / seconds / 1e9);
+        }
+        return best;
+    }();
+    return bandwidth;
+}
+
+static std::string formatValues(const NCommon::SCounterValues& values) {
+    std::ostringstream line;
+    for (size_t counter = 0; counter < NCommon::COUNTER_COUNT; counter++) {
+        line << (counter > 0 ? ", " : "") << NCommon::toString(static_cast<NCommon::ECounter>(counter)) << " ";
+        if (values.values[counter])
+            line << *values.values[counter];
+        else
+            line << "n/a";
+    }
+    return line.str();
+}
+
+std::vector<std::string> NCommon::describe(const SPerfReport& report) {
+    if (!report.available)
+        return {"Hardware counters unavailable, " + report.reason};
+
+    std::vector<std::string> lines;
+    if (!report.reason.empty())
+        lines.push_back("Hardware counters " + report.reason);
+    for (size_t thread = 0; report.threads.size() > 1 && thread < report.threads.size(); thread++) {
+        lines.push_back("Thread " + std::to_string(thread) + ": " + formatValues(report.threads[thread]));
+    }
+    lines.push_back("Total: " + formatValues(report.total));
+
+    std::ostringstream derived;
+    derived << "IPC ";
+    if (report.ipc)
+        derived << *report.ipc;
+    else
+        derived << "n/a";
+    derived << ", DRAM bytes per FLOP ";
+    if (report.bytesPerFlop)
+        derived << *report.bytesPerFlop;
+    else
+        derived << "n/a";
+    derived << " against " << report.compulsoryBytesPerFlop << " compulsory";
+    lines.push_back(derived.str());
+
+    if (report.roofline) {
+        const SRoofline&   roofline = *report.roofline;
+        std::ostringstream position;
+        position << "Roofline: " << roofline.arithmeticIntensity << " FLOP/byte, " << roofline.attainedGflops << " GFLOP/s attained of a " << roofline.roofGflops
+                 << " GFLOP/s roof (" << (100.0 * roofline.attainedGflops / roofline.roofGflops) << "%), peak " << roofline.peakGflops << " GFLOP/s and "
+                 << roofline.peakBandwidthGBs << " GB/s, " << (roofline.memoryBound ? "memory bound" : "compute bound");
+        lines.push_back(position.str());
+    }
+    return lines;
+}
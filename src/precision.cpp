@@ -0,0 +1,167 @@
+#include "precision.hpp"
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PRECISION_X86 1
+#include <immintrin.h>
+#endif
+
+// The scalar conversions are the reference, the F16C paths produce the same bits. Narrowing runs once over whole
+// matrices and is split across threads; widening is called from the GEMM packing loops, which already are.
+
+static constexpr size_t NARROW_CHUNK = 4096;
+
+NCommon::EPrecision NCommon::parsePrecision(const std::string& name) {
+    if (name == "fp32")
+        return EPrecision::Float32;
+    if (name == "fp16")
+        return EPrecision::Float16;
+    if (name == "bf16")
+        return EPrecision::BFloat16;
+    throw std::runtime_error("Unknown precision " + name + ", expected fp32, fp16 or bf16");
+}
+
+const char* NCommon::toString(EPrecision precision) {
+    switch (precision) {
+        case EPrecision::Float16: return "fp16";
+        case EPrecision::BFloat16: return "bf16";
+        default: return "fp32";
+    }
+}
+
+size_t NCommon::bytesPerElement(EPrecision precision) {
+    return precision == EPrecision::Float32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+NCommon::SFloat16 NCommon::toFloat16(float value) {
+    const uint32_t bits      = std::bit_cast<uint32_t>(value);
+    const uint32_t sign      = (bits >> 16) & 0x8000u;
+    const uint32_t magnitude = bits & 0x7FFFFFFFu;
+
+    // Infinity and NaN keep their class. NaNs come out quiet with the top of their payload, as F16C truncates it.
+    if (magnitude >= 0x7F800000u)
+        return {static_cast<uint16_t>(sign | 0x7C00u | (magnitude > 0x7F800000u ? 0x200u | ((magnitude >> 13) & 0x3FFu) : 0u))};
+    // 65520 and up round past the largest half
+    if (magnitude >= 0x477FF000u)
+        return {static_cast<uint16_t>(sign | 0x7C00u)};
+    // Below 2^-14 the result is subnormal. Adding 0.5 leaves the value in the mantissa in steps of 2^-24, rounded to
+    // nearest even by the FPU.
+    if (magnitude < 0x38800000u) {
+        const float shifted = std::bit_cast<float>(magnitude) + 0.5f;
+        return {static_cast<uint16_t>(sign | (std::bit_cast<uint32_t>(shifted) - 0x3F000000u))};
+    }
+    // Rebias the exponent from 127 to 15 and round the mantissa from 23 to 10 bits, a carry moves into the exponent
+    const uint32_t odd     = (magnitude >> 13) & 1u;
+    const uint32_t rounded = magnitude + 0xFFFu + odd - (112u << 23);
+    return {static_cast<uint16_t>(sign | (rounded >> 13))};
+}
+
+NCommon::SBFloat16 NCommon::toBFloat16(float value) {
+    const uint32_t bits = std::bit_cast<uint32_t>(value);
+    if ((bits & 0x7FFFFFFFu) > 0x7F800000u)
+        return {static_cast<uint16_t>((bits >> 16) | 0x40u)};
+    const uint32_t odd = (bits >> 16) & 1u;
+    return {static_cast<uint16_t>((bits + 0x7FFFu + odd) >> 16)};
+}
+
+float NCommon::toFloat(SFloat16 value) {
+    const uint32_t sign     = static_cast<uint32_t>(value.bits & 0x8000u) << 16;
+    const uint32_t exponent = (value.bits >> 10) & 0x1Fu;
+    const uint32_t mantissa = value.bits & 0x3FFu;
+
+    // Signalling NaNs come back quiet, as F16C returns them
+    if (exponent == 0x1F)
+        return std::bit_cast<float>(sign | 0x7F800000u | (mantissa << 13) | (mantissa != 0 ? 0x400000u : 0u));
+    if (exponent == 0) {
+        const float magnitude = static_cast<float>(mantissa) * 0x1p-24f;
+        return sign != 0 ? -magnitude : magnitude;
+    }
+    return std::bit_cast<float>(sign | ((exponent + 112u) << 23) | (mantissa << 13));
+}
+
+float NCommon::toFloat(SBFloat16 value) {
+    return std::bit_cast<float>(static_cast<uint32_t>(value.bits) << 16);
+}
+
+#ifdef PRECISION_X86
+__attribute__((target("avx,f16c"))) static void narrowF16c(const float* source, NCommon::SFloat16* destination, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(source + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), half);
+    }
+    for (; i < count; i++) {
+        destination[i] = NCommon::toFloat16(source[i]);
+    }
+}
+
+__attribute__((target("avx,f16c"))) static void widenF16c(const NCommon::SFloat16* source, float* destination, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(destination + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i))));
+    }
+    for (; i < count; i++) {
+        destination[i] = NCommon::toFloat(source[i]);
+    }
+}
+
+static bool hasF16c() {
+    static const bool supported = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+    }();
+    return supported;
+}
+#endif
+
+template <typename T>
+static void checkSizes(std::span<const float> wide, std::span<T> narrow) {
+    if (wide.size() != narrow.size())
+        throw std::runtime_error("Cannot convert between ranges of different sizes.");
+}
+
+void NCommon::narrow(std::span<const float> source, std::span<SFloat16> destination) {
+    checkSizes(source, destination);
+    const size_t count = source.size();
+#pragma omp parallel for schedule(static)
+    for (size_t first = 0; first < count; first += NARROW_CHUNK) {
+        const size_t length = std::min(NARROW_CHUNK, count - first);
+#ifdef PRECISION_X86
+        if (hasF16c()) {
+            narrowF16c(source.data() + first, destination.data() + first, length);
+            continue;
+        }
+#endif
+        for (size_t i = first; i < first + length; i++) {
+            destination[i] = toFloat16(source[i]);
+        }
+    }
+}
+
+void NCommon::narrow(std::span<const float> source, std::span<SBFloat16> destination) {
+    checkSizes(source, destination);
+    const size_t count = source.size();
+#pragma omp parallel for simd schedule(static)
+    for (size_t i = 0; i < count; i++) {
+        destination[i] = toBFloat16(source[i]);
+    }
+}
+
+void NCommon::widen(std::span<const SFloat16> source, std::span<float> destination) {
+    checkSizes(std::span<const float>(destination), source);
+#ifdef PRECISION_X86
+    if (hasF16c()) {
+        widenF16c(source.data(), destination.data(), source.size());
+        return;
+    }
+#endif
+    std::transform(source.begin(), source.end(), destination.begin(), [](SFloat16 value) { return toFloat(value); });
+}
+
+void NCommon::widen(std::span<const SBFloat16> source, std::span<float> destination) {
+    checkSizes(std::span<const float>(destination), source);
+    // A shift per value, which the compiler vectorises on its own
+    std::transform(source.begin(), source.end(), destination.begin(), [](SBFloat16 value) { return toFloat(value); });
+}
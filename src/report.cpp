@@ -0,0 +1,71 @@
+#include "report.hpp"
+#include "gemm_kernels.hpp"
+#include "MatrixFile.hpp"
+#include "verify.hpp"
+#include <spdlog/spdlog.h>
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+
+// Classical fp32 product of the run's inputs, placed like the measured C so both multiplies see the same memory
+static NCommon::MatrixBuffer classicalProduct(const NCommon::SCpuRun& run) {
+    NCommon::MatrixBuffer reference = run.parallel ? NGemm::allocateMatrix(run.m, run.n, run.blocks) : NCommon::MatrixBuffer(run.m * run.n);
+    NGemm::sgemm(run.m, run.n, run.k, 1.0f, run.a, run.k, run.b, run.n, 0.0f, reference.data(), run.n, run.blocks, run.parallel);
+    return reference;
+}
+
+int NCommon::reportCpuRun(const SOptions& options, const SCpuRun& run, const std::optional<CPerfCounters>& counters) {
+    const size_t M = run.m, N = run.n, K = run.k;
+
+    // Strassen is charged the classical 2MNK FLOP, so its roofline position reads as effective throughput
+    if (counters) {
+        const double flops      = 2.0 * static_cast<double>(M) * static_cast<double>(N) * static_cast<double>(K);
+        const double compulsory = static_cast<double>(((M * K) + (K * N)) * bytesPerElement(options.precision) + (M * N * sizeof(float)));
+        for (const std::string& line : describe(counters->report(run.seconds, flops, compulsory, NGemm::activeKernel().flopsPerCycle))) {
+            spdlog::info("{}", line);
+        }
+    }
+
+    // Strassen trades accuracy for fewer multiplications, so measure the trade against the classical kernel
+    if (options.strassenCutover > 0) {
+        const std::chrono::time_point       start     = std::chrono::high_resolution_clock::now();
+        const MatrixBuffer                  reference = classicalProduct(run);
+        const std::chrono::duration<double> classical = std::chrono::high_resolution_clock::now() - start;
+
+        const SErrorStats                   error     = compareMatrices(run.c, reference);
+        spdlog::info("Classical kernel took {} seconds ({}x speedup)", classical.count(), classical.count() / run.seconds);
+        spdlog::info("Strassen error: max absolute {}, max relative {}, relative Frobenius {}", error.maxAbsolute, error.maxRelative, error.frobeniusRelative);
+    }
+
+    // Half the input bytes for some accuracy, measured against the same multiply on the fp32 inputs
+    if (options.precision != EPrecision::Float32) {
+        const MatrixBuffer reference = classicalProduct(run);
+
+        const size_t       elements  = (M * K) + (K * N);
+        const SErrorStats  error     = compareMatrices(run.c, reference);
+        spdlog::info("A and B stored in {} MiB instead of {} MiB", (elements * bytesPerElement(options.precision)) >> 20, (elements * sizeof(float)) >> 20);
+        spdlog::info("{} error: max absolute {}, max relative {}, relative Frobenius {}", toString(options.precision), error.maxAbsolute, error.maxRelative,
+                     error.frobeniusRelative);
+    }
+
+    // Freivalds check against the fp32 inputs, O(n^2) instead of a second multiply
+    if (options.verify) {
+        const SVerifyReport check = verifyProduct(M, N, K, run.a, K, run.b, N, run.c.data(), N, options.precision, options.seed);
+        spdlog::info("Verification took {} seconds over {} rounds, worst row {} is {} of its error bound", check.seconds, check.rounds, check.worstRow, check.worstRatio);
+        if (!check.passed) {
+            spdlog::error("C does not match A * B: row {} is off by {} against a bound of {}", check.worstRow, check.residual, check.bound);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!options.output.empty()) {
+        try {
+            saveProblem(options.output, {run.a, M * K}, {run.b, K * N}, run.c, M, N, K);
+            spdlog::info("Wrote A, B and C to {}", options.output.string());
+        } catch (const std::runtime_error& err) {
+            spdlog::error("{}", err.what());
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
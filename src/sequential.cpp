@@ -1,9 +1,16 @@
 #include "common.hpp"
+#include "gemm.hpp"
+#include "gemm_kernels.hpp"
+#include "strassen.hpp"
+#include "MatrixFile.hpp"
+#include "perf_counters.hpp"
+#include "report.hpp"
 #include <iostream>
 #include <spdlog/spdlog.h>
 #include <chrono>
+#include <optional>
 
-int main() {
+int main(int argc, char** argv) {
 #ifndef NDEBUG
     spdlog::set_level(spdlog::level::debug);
 #ifdef TRACE
@@ -11,36 +18,89 @@ int main() {
 #endif
 #endif
 
-    spdlog::trace("Generating random matrices.");
-    std::vector<float> matrixA = NCommon::generateRandomMatrix(NCommon::MATRIX_SIZE);
-    std::vector<float> matrixB = NCommon::generateRandomMatrix(NCommon::MATRIX_SIZE);
-    std::vector<float> matrixC(NCommon::MATRIX_SIZE * NCommon::MATRIX_SIZE, 0.0f);
-    spdlog::trace("Random matrices generated.");
+    NCommon::SOptions                     options;
+    std::optional<NCommon::SMappedInputs> mapped;
+    try {
+        options = NCommon::parseOptions(argc, argv);
+        if (options.memoryBudget > 0)
+            throw std::runtime_error("--budget is only supported by the OpenMP program.");
+        if (!options.chain.empty())
+            throw std::runtime_error("--chain is only supported by the OpenMP and Vulkan programs.");
+        if (!options.input.empty())
+            mapped = NCommon::mapInputs(options);
+    } catch (const std::runtime_error& err) {
+        spdlog::error("{}", err.what());
+        return EXIT_FAILURE;
+    }
+    const size_t M = options.m, N = options.n, K = options.k;
+
+    // Inputs mapped from --input go straight to the kernel, otherwise they are generated
+    NCommon::MatrixBuffer matrixA;
+    NCommon::MatrixBuffer matrixB;
+    if (!mapped) {
+        spdlog::trace("Generating random matrices.");
+        matrixA = NCommon::generateRandomMatrix(M, K, options.seed);
+        matrixB = NCommon::generateRandomMatrix(K, N, options.seed + 1);
+        spdlog::trace("Random matrices generated.");
+    }
+    const float*          A = mapped ? mapped->a.data() : matrixA.data();
+    const float*          B = mapped ? mapped->b.data() : matrixB.data();
+    // Left uninitialised, the multiply writes every element of C with beta zero
+    NCommon::MatrixBuffer matrixC(M * N);
+
+    // Reduced precision inputs are rounded once up front, as if they had been stored that way
+    std::vector<NCommon::SFloat16>  halfA;
+    std::vector<NCommon::SFloat16>  halfB;
+    std::vector<NCommon::SBFloat16> bfloatA;
+    std::vector<NCommon::SBFloat16> bfloatB;
+    if (options.precision == NCommon::EPrecision::Float16) {
+        halfA.resize(M * K);
+        halfB.resize(K * N);
+        NCommon::narrow({A, M * K}, halfA);
+        NCommon::narrow({B, K * N}, halfB);
+    } else if (options.precision == NCommon::EPrecision::BFloat16) {
+        bfloatA.resize(M * K);
+        bfloatB.resize(K * N);
+        NCommon::narrow({A, M * K}, bfloatA);
+        NCommon::narrow({B, K * N}, bfloatB);
+    }
 
-    spdlog::info("Starting sequential matrix multiplication.");
+    const NGemm::SBlockSizes blocks = NGemm::blockSizesFromEnv();
+    spdlog::info("Starting sequential matrix multiplication ({}x{}x{}). Kernel: {}, block sizes: {}, Strassen cutover: {}, precision: {}", M, N, K,
+                 NGemm::activeKernel().name, NGemm::toString(blocks), options.strassenCutover, NCommon::toString(options.precision));
+    // Counters are opened before the clock starts, so only switching them on and off falls inside the timing
+    std::optional<NCommon::CPerfCounters> counters;
+    if (options.perf) {
+        counters.emplace(false);
+        counters->start();
+    }
     std::chrono::time_point start = std::chrono::high_resolution_clock::now();
-    for (size_t row = 0; row < NCommon::MATRIX_SIZE; ++row) {
-        for (size_t col = 0; col < NCommon::MATRIX_SIZE; ++col) {
-            float total = 0.0f;
-            for (size_t k = 0; k < NCommon::MATRIX_SIZE; ++k) {
-                total += matrixA[(row * NCommon::MATRIX_SIZE) + k] * matrixB[(k * NCommon::MATRIX_SIZE) + col];
-            }
-            matrixC[(row * NCommon::MATRIX_SIZE) + col] = total;
-        }
+    if (options.strassenCutover > 0) {
+        NGemm::CStrassen strassen(blocks, options.strassenCutover);
+        strassen.multiply(M, N, K, A, K, B, N, matrixC.data(), N, false);
+        spdlog::debug("Strassen recursed {} levels using {} MiB of scratch", strassen.depth, strassen.scratchBytes >> 20);
+    } else if (options.precision == NCommon::EPrecision::Float16) {
+        NGemm::sgemm(M, N, K, 1.0f, halfA.data(), K, halfB.data(), N, 0.0f, matrixC.data(), N, blocks, false);
+    } else if (options.precision == NCommon::EPrecision::BFloat16) {
+        NGemm::sgemm(M, N, K, 1.0f, bfloatA.data(), K, bfloatB.data(), N, 0.0f, matrixC.data(), N, blocks, false);
+    } else {
+        NGemm::sgemm(M, N, K, 1.0f, A, K, B, N, 0.0f, matrixC.data(), N, blocks, false);
     }
     std::chrono::time_point       end      = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> duration = end - start;
+    if (counters)
+        counters->stop();
     spdlog::info("Computation completed in {} seconds", duration.count());
 
+    const NCommon::SCpuRun run{.m = M, .n = N, .k = K, .a = A, .b = B, .c = matrixC, .blocks = blocks, .parallel = false, .seconds = duration.count()};
+    const int              status = NCommon::reportCpuRun(options, run, counters);
+    if (status != EXIT_SUCCESS)
+        return status;
+
     std::cout << "Press enter to continue...";
     std::cin.get();
 
-    const size_t print_limit = 12;
-    for (size_t i = 0; i < print_limit; i++) {
-        for (size_t j = 0; j < print_limit; j++) {
-            std::cout << "C[" << i << "][" << j << "] = " << matrixC[(i * NCommon::MATRIX_SIZE) + j] << std::endl;
-        }
-    }
+    NCommon::printCorner(matrixC, M, N);
 
     return EXIT_SUCCESS;
 }
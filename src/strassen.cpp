@@ -0,0 +1,228 @@
+#include "strassen.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <omp.h>
+
+// Winograd's form of Strassen's algorithm over quadrants of half size m x k (A), k x n (B) and m x n (C):
+//   S1 = A21 + A22  S2 = S1 - A11   S3 = A11 - A21  S4 = A12 - S2
+//   T1 = B12 - B11  T2 = B22 - T1   T3 = B22 - B12  T4 = T2 - B21
+//   P1 = A11 B11    P2 = A12 B21    P3 = S4 B22     P4 = A22 T4     P5 = S1 T1     P6 = S2 T2     P7 = S3 T3
+//   C11 = P1 + P2   C12 = P1 + P6 + P5 + P3         C21 = P1 + P6 + P7 - P4        C22 = P1 + P6 + P7 + P5
+// P1, P3, P4 and P5 are written straight into the C quadrants and combined in place, so each level only needs
+// scratch for S1-S4, T1-T4, P2, P6 and P7. The problem is zero padded once up front so every level splits evenly.
+// Below the last level each leaf packs its operands into its own slice of the same scratch, so the recursion never
+// allocates and leaves running as different tasks never share packing space.
+
+static constexpr size_t CACHE_LINE_FLOATS = 64 / sizeof(float);
+
+static size_t roundUp(size_t value, size_t multiple) {
+    return ((value + multiple - 1) / multiple) * multiple;
+}
+
+static float* alignToCacheLine(float* ptr) {
+    return reinterpret_cast<float*>(roundUp(reinterpret_cast<uintptr_t>(ptr), CACHE_LINE_FLOATS * sizeof(float)));
+}
+
+// out = x + sign * y over rows x cols, each with its own leading dimension
+static void combine(size_t rows, size_t cols, const float* x, size_t ldx, float sign, const float* y, size_t ldy, float* out, size_t ldo) {
+    for (size_t i = 0; i < rows; ++i) {
+        const float* xRow   = x + (i * ldx);
+        const float* yRow   = y + (i * ldy);
+        float*       outRow = out + (i * ldo);
+        for (size_t j = 0; j < cols; ++j) {
+            outRow[j] = xRow[j] + (sign * yRow[j]);
+        }
+    }
+}
+
+// Copies rows x cols into a paddedRows x paddedCols block, zero filling the rest
+static void copyPadded(size_t rows, size_t cols, const float* source, size_t lds, size_t paddedRows, size_t paddedCols, float* target) {
+    for (size_t i = 0; i < paddedRows; ++i) {
+        float* row = target + (i * paddedCols);
+        if (i < rows)
+            std::copy(source + (i * lds), source + (i * lds) + cols, row);
+        std::fill(row + (i < rows ? cols : 0), row + paddedCols, 0.0f);
+    }
+}
+
+NGemm::CStrassen::CStrassen(const SBlockSizes& blocks, size_t cutover) : blocks(blocks), cutover(cutover) {
+    if (cutover == 0)
+        throw std::runtime_error("Strassen cutover has to be at least 1.");
+}
+
+size_t NGemm::CStrassen::scratchFloats(size_t m, size_t n, size_t k, size_t level) const {
+    // Packed B and A of the leaf sgemm, plus the slack to start both on a cache line
+    if (level == depth)
+        return roundUp(CPackedB::floats(k, n), CACHE_LINE_FLOATS) + roundUp(packedAFloats(blocks), CACHE_LINE_FLOATS) + CACHE_LINE_FLOATS;
+
+    const size_t m2       = m / 2;
+    const size_t n2       = n / 2;
+    const size_t k2       = k / 2;
+    const size_t own      = (4 * m2 * k2) + (4 * k2 * n2) + (3 * m2 * n2);
+    // Spawned sub-products each need their own subtree, sequential ones reuse one after the other
+    const size_t children = level < taskLevels ? 7 : 1;
+    return own + (children * scratchFloats(m2, n2, k2, level + 1));
+}
+
+void NGemm::CStrassen::multiply(size_t M, size_t N, size_t K, const float* A, size_t lda, const float* B, size_t ldb, float* C, size_t ldc, bool parallel) {
+    if (M == 0 || N == 0)
+        return;
+
+    // Halve until a dimension reaches the cutover
+    depth = 0;
+    for (size_t m = M, n = N, k = K; std::min({m, n, k}) > cutover; m = (m + 1) / 2, n = (n + 1) / 2, k = (k + 1) / 2) {
+        depth++;
+    }
+    if (depth == 0) {
+        scratchBytes = 0;
+        sgemm(M, N, K, 1.0f, A, lda, B, ldb, 0.0f, C, ldc, blocks, parallel);
+        return;
+    }
+
+    // Just enough task levels to give every thread a sub-product, the leaves below them run sequentially. With more
+    // than one thread there is always at least one task level, so a sequential leaf never leaves threads idle.
+    const size_t threads = parallel ? omp_get_max_threads() : 1;
+    taskLevels           = 0;
+    for (size_t tasks = 1; tasks < threads && taskLevels < depth; tasks *= 7) {
+        taskLevels++;
+    }
+
+    const size_t unit    = size_t(1) << depth;
+    const size_t paddedM = roundUp(M, unit);
+    const size_t paddedN = roundUp(N, unit);
+    const size_t paddedK = roundUp(K, unit);
+    const bool   padA    = paddedM != M || paddedK != K;
+    const bool   padB    = paddedK != K || paddedN != N;
+    const bool   padC    = paddedM != M || paddedN != N;
+
+    const size_t sizeA   = padA ? paddedM * paddedK : 0;
+    const size_t sizeB   = padB ? paddedK * paddedN : 0;
+    const size_t sizeC   = padC ? paddedM * paddedN : 0;
+    const size_t needed  = sizeA + sizeB + sizeC + scratchFloats(paddedM, paddedN, paddedK, 0);
+    if (arena.size() < needed)
+        arena = AlignedBuffer(needed);
+    scratchBytes = needed * sizeof(float);
+
+    float*       base    = arena.data();
+    const float* a       = A;
+    const float* b       = B;
+    float*       c       = C;
+    size_t       ldPadA  = lda;
+    size_t       ldPadB  = ldb;
+    size_t       ldPadC  = ldc;
+    if (padA) {
+        copyPadded(M, K, A, lda, paddedM, paddedK, base);
+        a      = base;
+        ldPadA = paddedK;
+    }
+    if (padB) {
+        copyPadded(K, N, B, ldb, paddedK, paddedN, base + sizeA);
+        b      = base + sizeA;
+        ldPadB = paddedN;
+    }
+    if (padC) {
+        c      = base + sizeA + sizeB;
+        ldPadC = paddedN;
+    }
+    float* scratch = base + sizeA + sizeB + sizeC;
+
+    if (taskLevels > 0) {
+#pragma omp parallel
+#pragma omp single
+        recurse(paddedM, paddedN, paddedK, a, ldPadA, b, ldPadB, c, ldPadC, scratch, 0);
+    } else {
+        recurse(paddedM, paddedN, paddedK, a, ldPadA, b, ldPadB, c, ldPadC, scratch, 0);
+    }
+
+    if (padC) {
+        for (size_t i = 0; i < M; ++i) {
+            std::copy(c + (i * ldPadC), c + (i * ldPadC) + N, C + (i * ldc));
+        }
+    }
+}
+
+void NGemm::CStrassen::recurse(size_t m, size_t n, size_t k, const float* A, size_t lda, const float* B, size_t ldb, float* C, size_t ldc, float* scratch, size_t level) {
+    if (level == depth) {
+        float*               packedB   = alignToCacheLine(scratch);
+        const SGemmWorkspace workspace = {.packedA = packedB + roundUp(CPackedB::floats(k, n), CACHE_LINE_FLOATS), .packedB = packedB};
+        sgemm(m, n, k, 1.0f, A, lda, B, ldb, 0.0f, C, ldc, blocks, workspace);
+        return;
+    }
+
+    const size_t m2  = m / 2;
+    const size_t n2  = n / 2;
+    const size_t k2  = k / 2;
+    const float* A11 = A;
+    const float* A12 = A + k2;
+    const float* A21 = A + (m2 * lda);
+    const float* A22 = A21 + k2;
+    const float* B11 = B;
+    const float* B12 = B + n2;
+    const float* B21 = B + (k2 * ldb);
+    const float* B22 = B21 + n2;
+    float*       C11 = C;
+    float*       C12 = C + n2;
+    float*       C21 = C + (m2 * ldc);
+    float*       C22 = C21 + n2;
+
+    float*       S1  = scratch;
+    float*       S2  = S1 + (m2 * k2);
+    float*       S3  = S2 + (m2 * k2);
+    float*       S4  = S3 + (m2 * k2);
+    float*       T1  = S4 + (m2 * k2);
+    float*       T2  = T1 + (k2 * n2);
+    float*       T3  = T2 + (k2 * n2);
+    float*       T4  = T3 + (k2 * n2);
+    float*       P2  = T4 + (k2 * n2);
+    float*       P6  = P2 + (m2 * n2);
+    float*       P7  = P6 + (m2 * n2);
+
+    combine(m2, k2, A21, lda, 1.0f, A22, lda, S1, k2);
+    combine(m2, k2, S1, k2, -1.0f, A11, lda, S2, k2);
+    combine(m2, k2, A11, lda, -1.0f, A21, lda, S3, k2);
+    combine(m2, k2, A12, lda, -1.0f, S2, k2, S4, k2);
+    combine(k2, n2, B12, ldb, -1.0f, B11, ldb, T1, n2);
+    combine(k2, n2, B22, ldb, -1.0f, T1, n2, T2, n2);
+    combine(k2, n2, B22, ldb, -1.0f, B12, ldb, T3, n2);
+    combine(k2, n2, T2, n2, -1.0f, B21, ldb, T4, n2);
+
+    struct SProduct {
+        const float* a;
+        size_t       lda;
+        const float* b;
+        size_t       ldb;
+        float*       c;
+        size_t       ldc;
+    };
+    const SProduct products[7] = {
+        {A11, lda, B11, ldb, C11, ldc}, {A12, lda, B21, ldb, P2, n2}, {S4, k2, B22, ldb, C12, ldc}, {A22, lda, T4, n2, C21, ldc},
+        {S1, k2, T1, n2, C22, ldc},     {S2, k2, T2, n2, P6, n2},     {S3, k2, T3, n2, P7, n2},
+    };
+
+    float*       childScratch = P7 + (m2 * n2);
+    const size_t childFloats  = scratchFloats(m2, n2, k2, level + 1);
+    const bool   spawn        = level < taskLevels;
+    for (size_t i = 0; i < 7; ++i) {
+        const SProduct& product = products[i];
+        float*          child   = spawn ? childScratch + (i * childFloats) : childScratch;
+        if (spawn) {
+#pragma omp task firstprivate(product, child)
+            recurse(m2, n2, k2, product.a, product.lda, product.b, product.ldb, product.c, product.ldc, child, level + 1);
+        } else {
+            recurse(m2, n2, k2, product.a, product.lda, product.b, product.ldb, product.c, product.ldc, child, level + 1);
+        }
+    }
+    if (spawn) {
+#pragma omp taskwait
+    }
+
+    // C11 holds P1, C12 P3, C21 P4 and C22 P5. P6 becomes U2 = P1 + P6 and then U4 = U2 + P5, P7 becomes U3 = U2 + P7.
+    combine(m2, n2, P6, n2, 1.0f, C11, ldc, P6, n2);
+    combine(m2, n2, C11, ldc, 1.0f, P2, n2, C11, ldc);
+    combine(m2, n2, P7, n2, 1.0f, P6, n2, P7, n2);
+    combine(m2, n2, P6, n2, 1.0f, C22, ldc, P6, n2);
+    combine(m2, n2, C12, ldc, 1.0f, P6, n2, C12, ldc);
+    combine(m2, n2, P7, n2, -1.0f, C21, ldc, C21, ldc);
+    combine(m2, n2, C22, ldc, 1.0f, P7, n2, C22, ldc);
+}
@@ -0,0 +1,138 @@
+#include "verify.hpp"
+#include "common.hpp"
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+// Freivalds: if C != A * B then C x != A (B x) for almost every random x, and both sides cost O(n^2). Rounding makes
+// the two sides differ slightly even for a correct C. Summing K products in fp32 leaves an entry off by about
+// sqrt(K) u |A_i| |B_j| as a random walk, and rounding A and B to 16 bits first adds at most 2 u' |A_i| |B_j|. The
+// independent entries of x add those errors up in quadrature across a row, and by Cauchy-Schwarz
+// |A_i| |B_j| <= ||A_i|| ||B_j||, so row norms of A and column norms of B give a bound per row in O(n^2). SAFETY covers
+// the tail of that statistical model and the extra error of Strassen. Being sqrt(N K) tighter than the worst case
+// bound, it catches a single entry off by a few parts in a thousand. The sums here run in double.
+
+static constexpr size_t MAX_ROUNDS = 8;
+static constexpr double SAFETY     = 16.0;
+
+// Unit roundoff of the storage A and B were rounded to before the multiply, zero when the multiply saw them as is
+static double inputRoundoff(NCommon::EPrecision precision) {
+    switch (precision) {
+        case NCommon::EPrecision::Float16: return 0x1p-11;
+        case NCommon::EPrecision::BFloat16: return 0x1p-8;
+        default: return 0.0;
+    }
+}
+
+NCommon::SVerifyReport NCommon::verifyProduct(size_t M, size_t N, size_t K, const float* A, size_t lda, const float* B, size_t ldb, const float* C, size_t ldc,
+                                              EPrecision precision, uint64_t seed, size_t rounds) {
+    if (rounds == 0 || rounds > MAX_ROUNDS)
+        throw std::runtime_error("Verification takes between 1 and " + std::to_string(MAX_ROUNDS) + " rounds.");
+
+    SVerifyReport                               report{.rounds = rounds};
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Roundoff of the fp32 accumulation plus the relative error of a product of two rounded inputs
+    const double input  = inputRoundoff(precision);
+    const double factor = SAFETY * ((std::sqrt(static_cast<double>(K + 1)) * 0x1p-24) + (2.0 * input) + (input * input));
+
+    // Round r uses x[j * rounds + r], uniform in [-1, 1) from the same counter-based stream as the inputs
+    const uint64_t      key = mix64(seed ^ 0x5EED5EED5EED5EEDull);
+    std::vector<double> x(N * rounds);
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = (static_cast<double>(mix64(key + (i * GOLDEN_GAMMA)) >> 11) * 0x1p-52) - 1.0;
+    }
+
+    // B x for every round and the squared column norms of B, in one pass over B
+    std::vector<double> y(K * rounds);
+    std::vector<double> columnNorms(N, 0.0);
+#pragma omp parallel
+    {
+        std::vector<double> partialNorms(N, 0.0);
+#pragma omp for schedule(static) nowait
+        for (size_t k = 0; k < K; k++) {
+            double       sum[MAX_ROUNDS] = {};
+            const float* row             = B + (k * ldb);
+            for (size_t j = 0; j < N; j++) {
+                partialNorms[j] += static_cast<double>(row[j]) * row[j];
+                for (size_t r = 0; r < rounds; r++) {
+                    sum[r] += row[j] * x[(j * rounds) + r];
+                }
+            }
+            for (size_t r = 0; r < rounds; r++) {
+                y[(k * rounds) + r] = sum[r];
+            }
+        }
+#pragma omp critical
+        {
+            for (size_t j = 0; j < N; j++) {
+                columnNorms[j] += partialNorms[j];
+            }
+        }
+    }
+
+    // sqrt(sum_j ||B_j||^2 x_j^2) per round, the row norm of A is the only per-row part of the bound
+    double spread[MAX_ROUNDS] = {};
+    for (size_t j = 0; j < N; j++) {
+        for (size_t r = 0; r < rounds; r++) {
+            spread[r] += columnNorms[j] * x[(j * rounds) + r] * x[(j * rounds) + r];
+        }
+    }
+    for (size_t r = 0; r < rounds; r++) {
+        spread[r] = std::sqrt(spread[r]);
+    }
+
+    // A (B x) against C x row by row, keeping the row furthest over its bound
+#pragma omp parallel
+    {
+        SVerifyReport worst;
+#pragma omp for schedule(static) nowait
+        for (size_t i = 0; i < M; i++) {
+            double       expected[MAX_ROUNDS] = {};
+            double       actual[MAX_ROUNDS]   = {};
+            double       rowNorm              = 0;
+            const float* rowA                 = A + (i * lda);
+            const float* rowC                 = C + (i * ldc);
+            for (size_t k = 0; k < K; k++) {
+                rowNorm += static_cast<double>(rowA[k]) * rowA[k];
+                for (size_t r = 0; r < rounds; r++) {
+                    expected[r] += rowA[k] * y[(k * rounds) + r];
+                }
+            }
+            rowNorm = std::sqrt(rowNorm);
+            for (size_t j = 0; j < N; j++) {
+                for (size_t r = 0; r < rounds; r++) {
+                    actual[r] += rowC[j] * x[(j * rounds) + r];
+                }
+            }
+
+            for (size_t r = 0; r < rounds; r++) {
+                const double residual = std::abs(actual[r] - expected[r]);
+                const double bound    = factor * rowNorm * spread[r];
+                // NaN or infinity in C lands here as well, as does any residual on a row whose bound is zero
+                const double ratio    = residual == 0.0 ? 0.0 : (std::isfinite(residual) ? residual / bound : std::numeric_limits<double>::infinity());
+                if (ratio > worst.worstRatio) {
+                    worst.worstRatio = ratio;
+                    worst.worstRow   = i;
+                    worst.residual   = residual;
+                    worst.bound      = bound;
+                }
+            }
+        }
+#pragma omp critical
+        {
+            if (worst.worstRatio > report.worstRatio) {
+                report.worstRatio = worst.worstRatio;
+                report.worstRow   = worst.worstRow;
+                report.residual   = worst.residual;
+                report.bound      = worst.bound;
+            }
+        }
+    }
+
+    report.passed  = !(report.worstRatio > 1.0);
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
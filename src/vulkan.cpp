@@ -1,40 +1,203 @@
 #include "VulkanContext.hpp"
 #include "common.hpp"
+#include "MatrixFile.hpp"
+#include "verify.hpp"
+#include "gemm_chain.hpp"
+#include <algorithm>
 #include <iostream>
+#include <limits>
 #include <spdlog/spdlog.h>
 #include <chrono>
+#include <optional>
 #include <vector>
 
-int main() {
+// Multiplies the generated chain of --chain on the device, matrix i from seed + i, and measures it against the same
+// order on the CPU
+static int runChain(const NCommon::SOptions& options) {
+    const std::vector<size_t>&         dims = options.chain;
+    std::vector<NCommon::MatrixBuffer> storage;
+    std::vector<const float*>          matrices;
+    spdlog::trace("Generating random matrices.");
+    for (size_t i = 0; i + 1 < dims.size(); i++) {
+        storage.push_back(NCommon::generateRandomMatrix(dims[i], dims[i + 1], options.seed + i));
+        matrices.push_back(storage.back().data());
+    }
+    spdlog::trace("Random matrices generated.");
+    NCommon::MatrixBuffer matrixC(dims.front() * dims.back());
+
+    try {
+        CVulkanContext context;
+        spdlog::info("Starting Vulkan chain multiplication of {} matrices ({}x{} result).", matrices.size(), dims.front(), dims.back());
+        const SGemmTiming timing = context.sgemmChain(matrices, dims, matrixC.data());
+        spdlog::info("Multiply took {} seconds: acquire {}, copy in {}, record {}, execute {}, copy out {}", timing.totalSeconds, timing.acquireSeconds, timing.copyInSeconds,
+                     timing.recordSeconds, timing.executeSeconds, timing.copyOutSeconds);
+        if (timing.gpuDispatchSeconds > 0.0)
+            spdlog::info("GPU time of all dispatches: {} s", timing.gpuDispatchSeconds);
+    } catch (const std::runtime_error& err) {
+        spdlog::error("{}", err.what());
+        return EXIT_FAILURE;
+    }
+
+    NGemm::CMatrixChain   chain(NGemm::blockSizesFromEnv());
+    NCommon::MatrixBuffer reference(matrixC.size());
+    chain.multiply(matrices, dims, reference.data(), true);
+    const NCommon::SErrorStats error = NCommon::compareMatrices(matrixC, reference);
+    spdlog::info("Order {}: {} multiply-adds against {} left to right", chain.plan.order, chain.plan.cost, chain.plan.leftToRightCost);
+    spdlog::info("Error against the CPU chain: max absolute {}, max relative {}, relative Frobenius {}", error.maxAbsolute, error.maxRelative, error.frobeniusRelative);
+
+    std::cout << "Press enter to continue...";
+    std::cin.get();
+
+    NCommon::printCorner(matrixC, dims.front(), dims.back());
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
 #ifndef NDEBUG
     spdlog::set_level(spdlog::level::debug);
 #ifdef TRACE
     spdlog::set_level(spdlog::level::trace);
 #endif
 #endif
-    spdlog::trace("Generating random matrices.");
-    std::vector<float> matrixA = NCommon::generateRandomMatrix(NCommon::MATRIX_SIZE);
-    std::vector<float> matrixB = NCommon::generateRandomMatrix(NCommon::MATRIX_SIZE);
-    spdlog::trace("Random matrices generated.");
+    NCommon::SOptions                     options;
+    std::optional<NCommon::SMappedInputs> mapped;
+    try {
+        options = NCommon::parseOptions(argc, argv);
+        if (options.memoryBudget > 0)
+            throw std::runtime_error("--budget is only supported by the OpenMP program.");
+        if (options.strassenCutover > 0 || options.perf)
+            throw std::runtime_error("--strassen and --perf are only supported by the sequential and OpenMP programs.");
+        if (!options.input.empty())
+            mapped = NCommon::mapInputs(options);
+        // The device takes 32 bit sizes, narrowing larger ones would silently multiply a different problem
+        if (std::max({options.m, options.n, options.k, options.batch}) > std::numeric_limits<uint32_t>::max())
+            throw std::runtime_error("Sizes and --batch above 4294967295 are not supported by the Vulkan program.");
+        if (mapped && options.batch > 1)
+            throw std::runtime_error("--input holds a single problem and cannot be combined with --batch.");
+        if (options.precision != NCommon::EPrecision::Float32 && (options.batch > 1 || options.stream))
+            throw std::runtime_error("--precision only applies to a single multiply and cannot be combined with --batch or --stream.");
+        if (!options.chain.empty() && (options.batch > 1 || options.stream || options.autotune))
+            throw std::runtime_error("--chain cannot be combined with --batch, --stream or --autotune.");
+    } catch (const std::runtime_error& err) {
+        spdlog::error("{}", err.what());
+        return EXIT_FAILURE;
+    }
+    if (!options.chain.empty())
+        return runChain(options);
+    const uint32_t M = options.m, N = options.n, K = options.k;
 
-    std::chrono::time_point       start = std::chrono::high_resolution_clock::now();
-    CVulkanContext                context(NCommon::MATRIX_SIZE);
+    // Batches are stored back to back, the corner printed at the end is that of the first problem. Inputs mapped
+    // from --input are copied straight from the mapping into the staging buffers.
+    const uint32_t     batch = options.batch;
+    NCommon::MatrixBuffer matrixA;
+    NCommon::MatrixBuffer matrixB;
+    if (!mapped) {
+        spdlog::trace("Generating random matrices.");
+        matrixA = NCommon::generateRandomMatrix(static_cast<size_t>(M) * batch, K, options.seed);
+        matrixB = NCommon::generateRandomMatrix(static_cast<size_t>(K) * batch, N, options.seed + 1);
+        spdlog::trace("Random matrices generated.");
+    }
+    const float*          A = mapped ? mapped->a.data() : matrixA.data();
+    const float*          B = mapped ? mapped->b.data() : matrixB.data();
+    // Left uninitialised, with beta zero C is only downloaded, never uploaded
+    NCommon::MatrixBuffer matrixC(static_cast<size_t>(M) * N * batch);
+
+    // Reduced precision inputs are rounded once up front, as if they had been stored that way
+    const size_t                    sizeA = static_cast<size_t>(M) * K;
+    const size_t                    sizeB = static_cast<size_t>(K) * N;
+    std::vector<NCommon::SFloat16>  halfA;
+    std::vector<NCommon::SFloat16>  halfB;
+    std::vector<NCommon::SBFloat16> bfloatA;
+    std::vector<NCommon::SBFloat16> bfloatB;
+    if (options.precision == NCommon::EPrecision::Float16) {
+        halfA.resize(sizeA);
+        halfB.resize(sizeB);
+        NCommon::narrow({A, sizeA}, halfA);
+        NCommon::narrow({B, sizeB}, halfB);
+    } else if (options.precision == NCommon::EPrecision::BFloat16) {
+        bfloatA.resize(sizeA);
+        bfloatB.resize(sizeB);
+        NCommon::narrow({A, sizeA}, bfloatA);
+        NCommon::narrow({B, sizeB}, bfloatB);
+    }
+
+    // Construction and the multiply are reported separately, the multiply broken down by phase
+    std::chrono::time_point start = std::chrono::high_resolution_clock::now();
+    CVulkanContext          context;
+    if (options.autotune)
+        context.autotune(M, N, K);
 
-    std::vector<float>            matrixC = context.runComputeShader(matrixA.data(), matrixB.data(), NCommon::MATRIX_SIZE);
+    spdlog::info("Starting Vulkan matrix multiplication ({}x{}x{}, batch of {}, precision {}).", M, N, K, batch, NCommon::toString(options.precision));
+    SGemmTiming timing;
+    if (batch > 1) {
+        timing = context.sgemmStridedBatched(M, N, K, 1.0f, A, K, static_cast<size_t>(M) * K, B, N, static_cast<size_t>(K) * N, 0.0f, matrixC.data(), N,
+                                             static_cast<size_t>(M) * N, batch);
+    } else if (options.stream) {
+        timing = context.sgemmStreamed(M, N, K, 1.0f, A, K, B, N, 0.0f, matrixC.data(), N);
+    } else if (options.precision == NCommon::EPrecision::Float16) {
+        timing = context.sgemm(M, N, K, 1.0f, halfA.data(), K, halfB.data(), N, 0.0f, matrixC.data(), N);
+    } else if (options.precision == NCommon::EPrecision::BFloat16) {
+        timing = context.sgemm(M, N, K, 1.0f, bfloatA.data(), K, bfloatB.data(), N, 0.0f, matrixC.data(), N);
+    } else {
+        timing = context.sgemm(M, N, K, 1.0f, A, K, B, N, 0.0f, matrixC.data(), N);
+    }
 
     std::chrono::time_point       end      = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> duration = end - start;
+    spdlog::info("Context created in {} seconds (instance {}, device {}, pipeline {}, resources {})", context.initTiming.totalSeconds, context.initTiming.instanceSeconds,
+                 context.initTiming.deviceSeconds, context.initTiming.pipelineSeconds, context.initTiming.resourceSeconds);
+    spdlog::info("Multiply took {} seconds: acquire {}, copy in {}, record {}, execute {}, copy out {}", timing.totalSeconds, timing.acquireSeconds, timing.copyInSeconds,
+                 timing.recordSeconds, timing.executeSeconds, timing.copyOutSeconds);
+    if (timing.gpuDispatchSeconds > 0.0) {
+        const double gflops = 2.0 * M * N * K * batch / timing.gpuDispatchSeconds / 1e9;
+        spdlog::info("GPU time: upload {} s, dispatch {} s ({} GFLOP/s), readback {} s", timing.gpuUploadSeconds, timing.gpuDispatchSeconds, gflops, timing.gpuReadbackSeconds);
+    }
     spdlog::info("Computation completed in {} seconds", duration.count());
 
-    std::cout << "Press enter to continue...";
-    std::cin.get();
+    // Half the upload and buffer bytes of A and B for some accuracy, measured against the same multiply on fp32 inputs
+    if (options.precision != NCommon::EPrecision::Float32) {
+        NCommon::MatrixBuffer      reference(matrixC.size());
+        const SGemmTiming          fullTiming = context.sgemm(M, N, K, 1.0f, A, K, B, N, 0.0f, reference.data(), N);
+        const NCommon::SErrorStats error      = NCommon::compareMatrices(matrixC, reference);
+        spdlog::info("fp32 multiply took {} seconds, copy in {} (GPU upload {})", fullTiming.totalSeconds, fullTiming.copyInSeconds, fullTiming.gpuUploadSeconds);
+        spdlog::info("{} error: max absolute {}, max relative {}, relative Frobenius {}", NCommon::toString(options.precision), error.maxAbsolute, error.maxRelative,
+                     error.frobeniusRelative);
+    }
+
+    // Freivalds check of every problem in the batch against the fp32 inputs, O(n^2) each
+    if (options.verify) {
+        double seconds    = 0;
+        double worstRatio = 0;
+        for (uint32_t problem = 0; problem < batch; problem++) {
+            const float*                 problemA = A + (static_cast<size_t>(problem) * M * K);
+            const float*                 problemB = B + (static_cast<size_t>(problem) * K * N);
+            const float*                 problemC = matrixC.data() + (static_cast<size_t>(problem) * M * N);
+            const NCommon::SVerifyReport check    = NCommon::verifyProduct(M, N, K, problemA, K, problemB, N, problemC, N, options.precision, options.seed);
+            seconds += check.seconds;
+            worstRatio = std::max(worstRatio, check.worstRatio);
+            if (!check.passed) {
+                spdlog::error("C of problem {} does not match A * B: row {} is off by {} against a bound of {}", problem, check.worstRow, check.residual, check.bound);
+                return EXIT_FAILURE;
+            }
+        }
+        spdlog::info("Verification of {} problems took {} seconds, the worst row is {} of its error bound", batch, seconds, worstRatio);
+    }
 
-    const size_t print_limit = 12;
-    for (size_t i = 0; i < print_limit; i++) {
-        for (size_t j = 0; j < print_limit; j++) {
-            std::cout << "C[" << i << "][" << j << "] = " << matrixC[(i * NCommon::MATRIX_SIZE) + j] << std::endl;
+    // Only the first problem of a batch is saved
+    if (!options.output.empty()) {
+        try {
+            NCommon::saveProblem(options.output, {A, static_cast<size_t>(M) * K}, {B, static_cast<size_t>(K) * N}, {matrixC.data(), static_cast<size_t>(M) * N}, M, N, K);
+            spdlog::info("Wrote A, B and C to {}", options.output.string());
+        } catch (const std::runtime_error& err) {
+            spdlog::error("{}", err.what());
+            return EXIT_FAILURE;
         }
     }
 
+    std::cout << "Press enter to continue...";
+    std::cin.get();
+
+    NCommon::printCorner(matrixC, M, N);
+
     return EXIT_SUCCESS;
 }
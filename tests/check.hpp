@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// Assertions for the ctest executables. A failed check prints its location and fails the test, the checks after it
+// still run so one run reports every failure.
+namespace NTest {
+    // ctest reports a test as skipped rather than failed when it exits with this code
+    constexpr int SKIPPED = 77;
+
+    inline int failures = 0;
+
+    inline void check(bool condition, const char* expression, const char* file, int line) {
+        if (condition)
+            return;
+        failures++;
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+    }
+
+    inline int result() {
+        if (failures > 0)
+            std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+}
+
+#define CHECK(condition) NTest::check(static_cast<bool>(condition), #condition, __FILE__, __LINE__)
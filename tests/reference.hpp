@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace NTest {
+    // C = alpha * A * B + beta * C in double, with the same row-major leading dimension convention as NGemm::sgemm.
+    // bound receives alpha * |A| * |B| + |beta * C| per element, the magnitude fp32 rounding errors scale with.
+    inline void referenceGemm(size_t M, size_t N, size_t K, double alpha, const float* A, size_t lda, const float* B, size_t ldb, double beta, const float* C, size_t ldc,
+                              std::vector<double>& product, std::vector<double>& bound) {
+        product.assign(M * N, 0.0);
+        bound.assign(M * N, 0.0);
+        for (size_t i = 0; i < M; i++) {
+            for (size_t j = 0; j < N; j++) {
+                double sum = 0, magnitude = 0;
+                for (size_t k = 0; k < K; k++) {
+                    sum += static_cast<double>(A[(i * lda) + k]) * B[(k * ldb) + j];
+                    magnitude += std::fabs(static_cast<double>(A[(i * lda) + k]) * B[(k * ldb) + j]);
+                }
+                const double previous = beta != 0.0 ? beta * C[(i * ldc) + j] : 0.0;
+                product[(i * N) + j]  = (alpha * sum) + previous;
+                bound[(i * N) + j]    = (std::fabs(alpha) * magnitude) + std::fabs(previous);
+            }
+        }
+    }
+}
@@ -0,0 +1,90 @@
+#include "check.hpp"
+#include "arena.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+// Alignment, reuse and the limits on reuse of CArena. The free list cap is lowered so evictions can be seen with a
+// few blocks; the arena reads it on first use, which is in main after it has been set.
+
+static constexpr size_t MIB = size_t(1) << 20;
+
+static bool aligned(const void* block, size_t alignment) {
+    return reinterpret_cast<uintptr_t>(block) % alignment == 0;
+}
+
+int main() {
+    ::setenv("ARENA_RETAIN_MB", "12", 1);
+    NCommon::CArena& arena    = NCommon::CArena::instance();
+    const size_t     pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+
+    // Small requests come from the heap on a cache line, large ones are whole pages or huge pages
+    void* small = arena.allocate(100);
+    CHECK(aligned(small, NCommon::CArena::CACHE_LINE));
+    arena.release(small, 100);
+    CHECK(arena.stats().freshBlocks == 0);
+
+    void* paged = arena.allocate(300 << 10);
+    CHECK(aligned(paged, pageSize));
+    CHECK(std::all_of(static_cast<const char*>(paged), static_cast<const char*>(paged) + (300 << 10), [](char byte) { return byte == 0; }));
+    arena.release(paged, 300 << 10);
+
+    // A released block is handed back out to the next request it fits, holding what was last written to it
+    char* huge = static_cast<char*>(arena.allocate(3 * MIB));
+    CHECK(aligned(huge, NCommon::CArena::HUGE_PAGE));
+    std::memset(huge, 0x5A, 3 * MIB);
+    arena.release(huge, 3 * MIB);
+    NCommon::SArenaStats before = arena.stats();
+    CHECK(before.cachedBytes == (4 * MIB) + (300 << 10));
+
+    char* again = static_cast<char*>(arena.allocate((3 * MIB) + 12345));
+    CHECK(again == huge);
+    CHECK(again[0] == 0x5A && again[(3 * MIB) - 1] == 0x5A);
+    CHECK(arena.stats().reusedBlocks == before.reusedBlocks + 1);
+    CHECK(arena.stats().freshBlocks == before.freshBlocks);
+
+    // A cached block more than twice the request is left for requests of its own size
+    arena.release(again, (3 * MIB) + 12345);
+    before       = arena.stats();
+    void* little = arena.allocate(MIB);
+    CHECK(little != huge);
+    CHECK(arena.stats().freshBlocks == before.freshBlocks + 1);
+    arena.release(little, MIB);
+
+    // Beyond the cap the smallest cached blocks are unmapped first, so the large block survives
+    void* large = arena.allocate(10 * MIB);
+    arena.release(large, 10 * MIB);
+    CHECK(arena.stats().cachedBytes <= 12 * MIB);
+    before      = arena.stats();
+    void* reuse = arena.allocate(10 * MIB);
+    CHECK(reuse == large);
+    CHECK(arena.stats().reusedBlocks == before.reusedBlocks + 1);
+    arena.release(reuse, 10 * MIB);
+
+    // MatrixBuffers of a repeated size land on the same block
+    const float* first = nullptr;
+    {
+        NCommon::MatrixBuffer buffer(MIB);
+        first = buffer.data();
+    }
+    {
+        NCommon::MatrixBuffer buffer(MIB);
+        CHECK(buffer.data() == first);
+    }
+
+    // Concurrent use from every thread, after which trimming leaves nothing mapped
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < 256; i++) {
+        const size_t bytes = (static_cast<size_t>(i % 7) + 1) * (512 << 10);
+        char*        block = static_cast<char*>(arena.allocate(bytes));
+        block[0]           = 1;
+        block[bytes - 1]   = 1;
+        arena.release(block, bytes);
+    }
+    arena.trim();
+    CHECK(arena.stats().cachedBytes == 0);
+    CHECK(arena.stats().mappedBytes == 0);
+    return NTest::result();
+}
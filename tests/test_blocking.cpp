@@ -0,0 +1,63 @@
+#include "check.hpp"
+#include "reference.hpp"
+#include "common.hpp"
+#include "gemm.hpp"
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+// The cache-blocked multiply the sequential and OpenMP programs share. Block sizes only change the order partial
+// sums are added in, so every blocking, down to a single row or column per block, has to give the reference
+// product, sequentially and with the tiles spread over threads.
+
+static bool sameProduct(size_t size, const NGemm::SBlockSizes& blocks, bool parallel) {
+    NCommon::MatrixBuffer A = NCommon::generateRandomMatrix(size, size, 1);
+    NCommon::MatrixBuffer B = NCommon::generateRandomMatrix(size, size, 2);
+    NCommon::MatrixBuffer C(size * size, 0.0f);
+
+    std::vector<double> product, bound;
+    NTest::referenceGemm(size, size, size, 1.0, A.data(), size, B.data(), size, 0.0, C.data(), size, product, bound);
+    NGemm::sgemm(size, size, size, 1.0f, A.data(), size, B.data(), size, 0.0f, C.data(), size, blocks, parallel);
+
+    size_t wrong = 0;
+    for (size_t i = 0; i < size * size; i++) {
+        wrong += !(std::fabs(C[i] - product[i]) <= static_cast<double>(size + 2) * FLT_EPSILON * bound[i]);
+    }
+    if (wrong > 0) {
+        std::fprintf(stderr, "%zu^3 %s %s: %zu wrong\n", size, NGemm::toString(blocks).c_str(), parallel ? "parallel" : "sequential", wrong);
+    }
+    return wrong == 0;
+}
+
+static bool rejected(const char* variable, const char* value) {
+    ::setenv(variable, value, 1);
+    bool threw = false;
+    try {
+        NGemm::blockSizesFromEnv();
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    ::unsetenv(variable);
+    return threw;
+}
+
+int main() {
+    const NGemm::SBlockSizes blockings[] = {{}, {.mc = 1, .kc = 1, .nc = 1}, {.mc = 7, .kc = 5, .nc = 3}, {.mc = 50, .kc = 33, .nc = 17}, {.mc = 1000, .kc = 1000, .nc = 1000}};
+    for (const NGemm::SBlockSizes& blocks : blockings) {
+        for (bool parallel : {false, true}) {
+            CHECK(sameProduct(97, blocks, parallel));
+        }
+    }
+
+    // GEMM_MC, GEMM_KC and GEMM_NC override the defaults one at a time and reject anything but a positive count
+    ::setenv("GEMM_KC", "128", 1);
+    const NGemm::SBlockSizes fromEnv = NGemm::blockSizesFromEnv();
+    ::unsetenv("GEMM_KC");
+    CHECK(fromEnv.kc == 128);
+    CHECK(fromEnv.mc == NGemm::SBlockSizes{}.mc && fromEnv.nc == NGemm::SBlockSizes{}.nc);
+    CHECK(rejected("GEMM_MC", "0"));
+    CHECK(rejected("GEMM_NC", "12x"));
+    CHECK(rejected("GEMM_KC", "-"));
+    return NTest::result();
+}
@@ -0,0 +1,90 @@
+#include "check.hpp"
+#include "reference.hpp"
+#include "common.hpp"
+#include "gemm.hpp"
+#include "gemm_kernels.hpp"
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <string>
+
+// sgemm against a double precision reference with the micro-kernel named by GEMM_KERNEL, which ctest sets to each
+// kernel in turn. Shapes are odd so every edge tile path runs, and every matrix has padding its leading dimension
+// skips over that has to come out untouched.
+
+struct SShape {
+    size_t M;
+    size_t N;
+    size_t K;
+};
+
+static void checkProduct(const SShape& shape, float alpha, float beta, const NGemm::SBlockSizes& blocks, bool parallel) {
+    const auto [M, N, K] = shape;
+    const size_t lda = K + 3, ldb = N + 5, ldc = N + 7;
+    const float  guard = -12345.0f;
+
+    NCommon::MatrixBuffer A = NCommon::generateRandomMatrix(M, lda, 11);
+    NCommon::MatrixBuffer B = NCommon::generateRandomMatrix(K, ldb, 12);
+    NCommon::MatrixBuffer C = NCommon::generateRandomMatrix(M, ldc, 13);
+    for (size_t i = 0; i < M; i++) {
+        for (size_t j = N; j < ldc; j++) {
+            C[(i * ldc) + j] = guard;
+        }
+        // With beta zero C must not be read at all, NaNs in it would otherwise leak into the result
+        for (size_t j = 0; j < N && beta == 0.0f; j++) {
+            C[(i * ldc) + j] = std::numeric_limits<float>::quiet_NaN();
+        }
+    }
+
+    std::vector<double> product, bound;
+    NTest::referenceGemm(M, N, K, alpha, A.data(), lda, B.data(), ldb, beta, C.data(), ldc, product, bound);
+    NGemm::sgemm(M, N, K, alpha, A.data(), lda, B.data(), ldb, beta, C.data(), ldc, blocks, parallel);
+
+    size_t wrong = 0, touched = 0;
+    for (size_t i = 0; i < M; i++) {
+        for (size_t j = 0; j < N; j++) {
+            // fp32 accumulation over K terms, plus the final alpha and beta roundings
+            const double tolerance = (static_cast<double>(K + 2) * FLT_EPSILON * bound[(i * N) + j]) + 1e-30;
+            wrong += !(std::fabs(C[(i * ldc) + j] - product[(i * N) + j]) <= tolerance);
+        }
+        for (size_t j = N; j < ldc; j++) {
+            touched += C[(i * ldc) + j] != guard;
+        }
+    }
+    if (wrong > 0 || touched > 0) {
+        std::fprintf(stderr, "%zux%zux%zu alpha=%g beta=%g %s mc=%zu kc=%zu nc=%zu: %zu wrong, %zu padding elements written\n", M, N, K, alpha, beta,
+                     parallel ? "parallel" : "sequential", blocks.mc, blocks.kc, blocks.nc, wrong, touched);
+    }
+    CHECK(wrong == 0);
+    CHECK(touched == 0);
+}
+
+int main() {
+    const char* requested = std::getenv("GEMM_KERNEL");
+    if (requested != nullptr && *requested != '\0') {
+        bool available = false;
+        for (const NGemm::SMicroKernel& kernel : NGemm::availableKernels()) {
+            available = available || requested == std::string(kernel.name);
+        }
+        if (!available) {
+            std::printf("Kernel %s is not supported by this CPU\n", requested);
+            return NTest::SKIPPED;
+        }
+        CHECK(requested == std::string(NGemm::activeKernel().name));
+    }
+
+    // The defaults, and blocks small enough that every shape spans several of them with ragged edges
+    const NGemm::SBlockSizes defaults;
+    const NGemm::SBlockSizes small{.mc = 24, .kc = 40, .nc = 72};
+    const SShape             shapes[] = {{1, 1, 1}, {1, 37, 5}, {29, 1, 17}, {7, 13, 0}, {33, 17, 65}, {67, 129, 300}, {130, 45, 513}};
+    for (const SShape& shape : shapes) {
+        for (const NGemm::SBlockSizes& blocks : {defaults, small}) {
+            for (bool parallel : {false, true}) {
+                checkProduct(shape, 1.0f, 0.0f, blocks, parallel);
+                checkProduct(shape, -1.5f, 0.75f, blocks, parallel);
+            }
+        }
+    }
+    return NTest::result();
+}
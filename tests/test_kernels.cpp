@@ -0,0 +1,66 @@
+#include "check.hpp"
+#include "common.hpp"
+#include "gemm_kernels.hpp"
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+
+// Every micro-kernel this CPU runs, called directly on one full register tile. The kernels differ only in how
+// they vectorise the same sum, so each has to match a double precision product of the packed panels, and must
+// leave the columns of C past its tile alone.
+
+static bool tileMatches(const NGemm::SMicroKernel& kernel, size_t kc, float beta) {
+    const size_t          mr = kernel.mr, nr = kernel.nr, ldc = nr + 3;
+    const float           guard = -777.0f;
+    NCommon::MatrixBuffer a     = NCommon::generateRandomMatrix(kc, mr, 3);
+    NCommon::MatrixBuffer b     = NCommon::generateRandomMatrix(kc, nr, 4);
+    NCommon::MatrixBuffer c     = NCommon::generateRandomMatrix(mr, ldc, 5);
+    NCommon::MatrixBuffer before(c.begin(), c.end());
+    for (size_t i = 0; i < mr; i++) {
+        for (size_t j = 0; j < ldc; j++) {
+            // With beta zero C is write only, NaNs left in it must not reach the result
+            c[(i * ldc) + j] = j >= nr ? guard : beta == 0.0f ? std::numeric_limits<float>::quiet_NaN() : before[(i * ldc) + j];
+        }
+    }
+
+    kernel.run(kc, a.data(), b.data(), c.data(), ldc, beta);
+
+    size_t wrong = 0;
+    for (size_t i = 0; i < mr; i++) {
+        for (size_t j = 0; j < nr; j++) {
+            double sum = 0, magnitude = 0;
+            for (size_t p = 0; p < kc; p++) {
+                sum += static_cast<double>(a[(p * mr) + i]) * b[(p * nr) + j];
+                magnitude += std::fabs(static_cast<double>(a[(p * mr) + i]) * b[(p * nr) + j]);
+            }
+            const double previous = beta == 0.0f ? 0.0 : beta * before[(i * ldc) + j];
+            const double bound    = static_cast<double>(kc + 2) * FLT_EPSILON * (magnitude + std::fabs(previous));
+            wrong += !(std::fabs(c[(i * ldc) + j] - (sum + previous)) <= bound + 1e-30);
+        }
+        for (size_t j = nr; j < ldc; j++) {
+            wrong += c[(i * ldc) + j] != guard;
+        }
+    }
+    if (wrong > 0) {
+        std::fprintf(stderr, "%s kc=%zu beta=%g: %zu wrong\n", kernel.name, kc, beta, wrong);
+    }
+    return wrong == 0;
+}
+
+int main() {
+    const std::vector<NGemm::SMicroKernel> kernels = NGemm::availableKernels();
+    CHECK(!kernels.empty() && std::string(kernels.front().name) == NGemm::scalarKernel().name);
+    for (const NGemm::SMicroKernel& kernel : kernels) {
+        std::printf("%s: %zux%zu tile, %g flop/cycle\n", kernel.name, kernel.mr, kernel.nr, kernel.flopsPerCycle);
+        CHECK(kernel.mr <= NGemm::MAX_MR && kernel.nr <= NGemm::MAX_NR);
+        CHECK(kernel.nr >= kernels.front().nr);
+        for (size_t kc : {1, 2, 7, 64, 301}) {
+            for (float beta : {0.0f, 1.0f, -0.5f}) {
+                CHECK(tileMatches(kernel, kc, beta));
+            }
+        }
+    }
+    return NTest::result();
+}
@@ -0,0 +1,127 @@
+#include "check.hpp"
+#include "common.hpp"
+#include "gemm_chain.hpp"
+#include "matrix_chain.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// planChain on the textbook chain (CLRS 15.2) and on longer random ones, checking the order, that every step reads
+// values that exist, and that no scratch buffer is overwritten while the intermediate in it is still to be read.
+
+static bool throws(std::span<const size_t> dims) {
+    try {
+        NCommon::planChain(dims);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+static void checkSchedule(const NCommon::SChainPlan& plan, std::span<const size_t> dims) {
+    const size_t count = dims.size() - 1;
+    CHECK(plan.steps.size() == count - 1);
+
+    // Which intermediate each buffer holds, and which intermediates are still to be read
+    std::vector<size_t> holder(plan.bufferFloats.size(), NCommon::SChainPlan::OUTPUT);
+    std::vector<bool>   live(count - 1, false);
+    std::vector<bool>   used(count + plan.steps.size(), false);
+    for (size_t s = 0; s < plan.steps.size(); s++) {
+        const NCommon::SChainStep& step = plan.steps[s];
+        for (const size_t operand : {step.left, step.right}) {
+            CHECK(operand < count + s);
+            CHECK(!used[operand]);
+            used[operand] = true;
+            if (operand >= count)
+                live[operand - count] = false;
+        }
+        CHECK(step.M == (step.left < count ? dims[step.left] : plan.steps[step.left - count].M));
+        CHECK(step.N == (step.right < count ? dims[step.right + 1] : plan.steps[step.right - count].N));
+
+        const bool last = s + 1 == plan.steps.size();
+        CHECK((step.buffer == NCommon::SChainPlan::OUTPUT) == last);
+        if (last)
+            continue;
+        CHECK(step.buffer < plan.bufferFloats.size());
+        CHECK(plan.bufferFloats[step.buffer] >= step.M * step.N);
+        // The buffer may only be reused once its last value has been read, which includes the operands of this step
+        const size_t previous = holder[step.buffer];
+        CHECK(previous == NCommon::SChainPlan::OUTPUT || !live[previous]);
+        CHECK(previous == NCommon::SChainPlan::OUTPUT || (step.left != count + previous && step.right != count + previous));
+        holder[step.buffer] = s;
+        live[s]             = true;
+    }
+    CHECK(std::ranges::count(used, false) == 1);
+    CHECK(!used[count + plan.steps.size() - 1]);
+}
+
+int main() {
+    const std::array<size_t, 7> textbook{30, 35, 15, 5, 10, 20, 25};
+    const NCommon::SChainPlan   plan = NCommon::planChain(textbook);
+    CHECK(plan.order == "((M0 (M1 M2)) ((M3 M4) M5))");
+    CHECK(plan.cost == 15125);
+    CHECK(plan.leftToRightCost == 40500);
+    checkSchedule(plan, textbook);
+
+    // Two matrices are a single multiply straight into the output
+    const std::array<size_t, 3> pair{7, 3, 5};
+    const NCommon::SChainPlan   single = NCommon::planChain(pair);
+    CHECK(single.order == "(M0 M1)");
+    CHECK(single.steps.size() == 1 && single.bufferFloats.empty());
+    CHECK(single.cost == 7 * 3 * 5);
+
+    const std::array<size_t, 2> one{4, 4};
+    CHECK(throws(one));
+    CHECK(throws(std::span<const size_t>()));
+
+    // Longer chains never cost more than left to right, and keep a valid schedule
+    std::mt19937                          generator(7);
+    std::uniform_int_distribution<size_t> dimension(1, 64);
+    for (size_t length = 3; length <= 16; length++) {
+        std::vector<size_t> dims(length + 1);
+        for (size_t& dim : dims)
+            dim = dimension(generator);
+        const NCommon::SChainPlan random = NCommon::planChain(dims);
+        CHECK(random.cost <= random.leftToRightCost);
+        checkSchedule(random, dims);
+    }
+
+    // The CPU chain follows the plan to the same product as plain left to right evaluation in double
+    std::vector<NCommon::MatrixBuffer> matrices;
+    std::vector<const float*>          pointers;
+    for (size_t i = 0; i + 1 < textbook.size(); i++) {
+        matrices.push_back(NCommon::generateRandomMatrix(textbook[i], textbook[i + 1], 40 + i));
+        pointers.push_back(matrices.back().data());
+    }
+    std::vector<double> product(matrices[0].begin(), matrices[0].end());
+    size_t              columns = textbook[1];
+    for (size_t m = 1; m < matrices.size(); m++) {
+        const size_t        next = textbook[m + 1];
+        std::vector<double> result(textbook[0] * next, 0.0);
+        for (size_t i = 0; i < textbook[0]; i++)
+            for (size_t k = 0; k < columns; k++)
+                for (size_t j = 0; j < next; j++)
+                    result[(i * next) + j] += product[(i * columns) + k] * matrices[m][(k * next) + j];
+        product = std::move(result);
+        columns = next;
+    }
+
+    NGemm::CMatrixChain   chain{NGemm::SBlockSizes{}};
+    NCommon::MatrixBuffer C(textbook.front() * textbook.back());
+    for (const bool parallel : {false, true}) {
+        chain.multiply(pointers, textbook, C.data(), parallel);
+        double error = 0, norm = 0;
+        for (size_t i = 0; i < C.size(); i++) {
+            error += (C[i] - product[i]) * (C[i] - product[i]);
+            norm += product[i] * product[i];
+        }
+        CHECK(std::sqrt(error) <= 1e-5 * std::sqrt(norm));
+        CHECK(chain.plan.order == plan.order);
+    }
+    return NTest::result();
+}
@@ -0,0 +1,104 @@
+#include "check.hpp"
+#include "MatrixFile.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <unistd.h>
+
+// Round trips through the matrix file format and the ways a file can be wrong: bad magic, a header pointing past the
+// end of the file, and values changed behind the checksum's back.
+
+static bool throws(const std::function<void()>& action) {
+    try {
+        action();
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+// Overwrites the header of an existing matrix file in place
+static void patchHeader(const std::filesystem::path& path, const std::function<void(NCommon::SMatrixFileHeader&)>& patch) {
+    std::fstream               file(path, std::ios::in | std::ios::out | std::ios::binary);
+    NCommon::SMatrixFileHeader header{};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    patch(header);
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+int main() {
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / ("matrix_file_test_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(directory);
+
+    const size_t          rows = 37, cols = 53;
+    NCommon::MatrixBuffer values = NCommon::generateRandomMatrix(rows, cols, 5);
+
+    // writeMatrixFile and open agree on shape, values and checksum, and the values start page aligned
+    const std::filesystem::path written = directory / "written.bin";
+    NCommon::writeMatrixFile(written, values, rows, cols);
+    {
+        const NCommon::CMappedMatrix matrix = NCommon::CMappedMatrix::open(written);
+        CHECK(matrix.rows == rows);
+        CHECK(matrix.cols == cols);
+        CHECK(!matrix.writable);
+        CHECK(std::ranges::equal(matrix.values(), values));
+        CHECK(matrix.verify());
+        CHECK(reinterpret_cast<uintptr_t>(matrix.data()) % NCommon::MATRIX_FILE_ALIGNMENT == 0);
+        CHECK(throws([&] { const_cast<NCommon::CMappedMatrix&>(matrix).mutableData(); }));
+    }
+
+    // create starts from zeros, and sync stores what was written for the next open
+    const std::filesystem::path created = directory / "created.bin";
+    {
+        NCommon::CMappedMatrix matrix = NCommon::CMappedMatrix::create(created, rows, cols);
+        CHECK(std::ranges::all_of(matrix.values(), [](float value) { return value == 0.0f; }));
+        std::ranges::copy(values, matrix.mutableData());
+        matrix.sync();
+    }
+    {
+        const NCommon::CMappedMatrix matrix = NCommon::CMappedMatrix::open(created);
+        CHECK(std::ranges::equal(matrix.values(), values));
+        CHECK(matrix.verify());
+    }
+
+    // A value changed without sync no longer matches the stored checksum, even by a single bit
+    {
+        NCommon::CMappedMatrix matrix = NCommon::CMappedMatrix::open(created, true);
+        float&                 value  = matrix.mutableData()[(rows * cols) / 2];
+        value                         = std::bit_cast<float>(std::bit_cast<uint32_t>(value) ^ 1u);
+    }
+    CHECK(!NCommon::CMappedMatrix::open(created).verify());
+    // Swapping two values changes the checksum as well, it depends on positions
+    {
+        NCommon::CMappedMatrix matrix = NCommon::CMappedMatrix::open(written, true);
+        std::swap(matrix.mutableData()[0], matrix.mutableData()[1]);
+    }
+    CHECK(!NCommon::CMappedMatrix::open(written).verify());
+
+    // Headers that do not describe the file are rejected on open
+    const std::filesystem::path corrupt = directory / "corrupt.bin";
+    auto                        rewrite = [&](const std::function<void(NCommon::SMatrixFileHeader&)>& patch) {
+        NCommon::writeMatrixFile(corrupt, values, rows, cols);
+        patchHeader(corrupt, patch);
+        return throws([&] { NCommon::CMappedMatrix::open(corrupt); });
+    };
+    CHECK(!rewrite([](NCommon::SMatrixFileHeader&) {}));
+    CHECK(rewrite([](NCommon::SMatrixFileHeader& header) { header.magic[0] = 'X'; }));
+    CHECK(rewrite([](NCommon::SMatrixFileHeader& header) { header.version++; }));
+    CHECK(rewrite([](NCommon::SMatrixFileHeader& header) { header.rows++; }));
+    // An offset that wraps around when the data length is added to it
+    CHECK(rewrite([](NCommon::SMatrixFileHeader& header) { header.dataOffset = std::numeric_limits<uint64_t>::max() - NCommon::MATRIX_FILE_ALIGNMENT + 1; }));
+    NCommon::writeMatrixFile(corrupt, values, rows, cols);
+    std::filesystem::resize_file(corrupt, std::filesystem::file_size(corrupt) - sizeof(float));
+    CHECK(throws([&] { NCommon::CMappedMatrix::open(corrupt); }));
+    std::filesystem::resize_file(corrupt, sizeof(NCommon::SMatrixFileHeader) - 1);
+    CHECK(throws([&] { NCommon::CMappedMatrix::open(corrupt); }));
+
+    std::filesystem::remove_all(directory);
+    return NTest::result();
+}
@@ -0,0 +1,82 @@
+#include "check.hpp"
+#include "reference.hpp"
+#include "common.hpp"
+#include "gemm_outofcore.hpp"
+#include "MatrixFile.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+#include <unistd.h>
+
+// sgemmOutOfCore over real matrix files, with budgets small enough to cut C into several row and column bands that
+// do not divide it evenly. Every band is packed, computed, flushed and released on its own, so a wrong offset or a
+// band released before it was written shows up as wrong values or a checksum that no longer matches.
+
+static void checkOutOfCore(const std::filesystem::path& directory, size_t M, size_t N, size_t K, size_t budget, size_t minRowBands, size_t minColBands) {
+    NCommon::MatrixBuffer A = NCommon::generateRandomMatrix(M, K, 31);
+    NCommon::MatrixBuffer B = NCommon::generateRandomMatrix(K, N, 32);
+    NCommon::writeMatrixFile(directory / "A.bin", A, M, K);
+    NCommon::writeMatrixFile(directory / "B.bin", B, K, N);
+
+    const NGemm::SBlockSizes blocks{.mc = 8, .kc = 32, .nc = 64};
+    NGemm::SOutOfCoreReport  report;
+    {
+        const NCommon::CMappedMatrix mappedA = NCommon::CMappedMatrix::open(directory / "A.bin");
+        const NCommon::CMappedMatrix mappedB = NCommon::CMappedMatrix::open(directory / "B.bin");
+        NCommon::CMappedMatrix       mappedC = NCommon::CMappedMatrix::create(directory / "C.bin", M, N);
+        report                               = NGemm::sgemmOutOfCore(mappedA, mappedB, mappedC, budget, blocks);
+    }
+    std::printf("%zux%zux%zu in %zu KiB: %zu x %zu bands of %zu x %zu\n", M, N, K, budget >> 10, report.rowBands, report.colBands, report.bandRows, report.bandCols);
+    CHECK(report.rowBands >= minRowBands);
+    CHECK(report.colBands >= minColBands);
+    CHECK(report.rowBands * report.bandRows >= M && (report.rowBands - 1) * report.bandRows < M);
+    CHECK(report.colBands * report.bandCols >= N && (report.colBands - 1) * report.bandCols < N);
+
+    // Reopened from disk, C carries the checksum of what was computed and that is the product
+    const NCommon::CMappedMatrix C = NCommon::CMappedMatrix::open(directory / "C.bin");
+    CHECK(C.rows == M && C.cols == N);
+    CHECK(C.verify());
+
+    std::vector<double> product, bound;
+    NTest::referenceGemm(M, N, K, 1.0, A.data(), K, B.data(), N, 0.0, nullptr, N, product, bound);
+    size_t wrong = 0;
+    for (size_t i = 0; i < M * N; i++) {
+        wrong += !(std::fabs(C.data()[i] - product[i]) <= static_cast<double>(K + 2) * FLT_EPSILON * bound[i]);
+    }
+    if (wrong > 0)
+        std::fprintf(stderr, "%zux%zux%zu in %zu KiB: %zu wrong\n", M, N, K, budget >> 10, wrong);
+    CHECK(wrong == 0);
+}
+
+static bool throws(const std::filesystem::path& directory, size_t rowsC, size_t colsC, size_t budget) {
+    try {
+        const NCommon::CMappedMatrix A = NCommon::CMappedMatrix::open(directory / "A.bin");
+        const NCommon::CMappedMatrix B = NCommon::CMappedMatrix::open(directory / "B.bin");
+        NCommon::CMappedMatrix       C = NCommon::CMappedMatrix::create(directory / "D.bin", rowsC, colsC);
+        NGemm::sgemmOutOfCore(A, B, C, budget, NGemm::SBlockSizes{});
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / ("outofcore_test_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(directory);
+
+    // Ragged row and column bands, a row band cut back to whole mc blocks leaving a short last one, and a single band
+    checkOutOfCore(directory, 203, 157, 91, 64 << 10, 10, 2);
+    checkOutOfCore(directory, 301, 520, 67, 128 << 10, 5, 2);
+    checkOutOfCore(directory, 45, 33, 200, 1 << 20, 2, 1);
+    checkOutOfCore(directory, 40, 30, 20, 1 << 20, 1, 1);
+
+    // Against the 40 x 20 A and 20 x 30 B left by the last run: a C of the wrong shape, and a budget without room for
+    // one row of A and C
+    CHECK(throws(directory, 41, 30, 1 << 20));
+    CHECK(throws(directory, 40, 31, 1 << 20));
+    CHECK(throws(directory, 40, 30, 64));
+
+    std::filesystem::remove_all(directory);
+    return NTest::result();
+}
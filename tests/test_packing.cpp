@@ -0,0 +1,78 @@
+#include "check.hpp"
+#include "common.hpp"
+#include "gemm.hpp"
+#include "gemm_kernels.hpp"
+#include "precision.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+// The packed B layout, and that one packed B serves any number of A's exactly as packing per call would.
+
+// Panel (pc, jr) has to hold rows [pc, pc + kc) of B's columns [jr, jr + nr) row by row, zero past the last column
+static bool layoutMatches(const NGemm::CPackedB& packed, const float* B, size_t ldb) {
+    size_t wrong = 0;
+    for (size_t pc = 0; pc < packed.rows; pc += packed.blocks.kc) {
+        const size_t kc = std::min(packed.blocks.kc, packed.rows - pc);
+        for (size_t jr = 0; jr < packed.paddedCols; jr += packed.nr) {
+            const float* panel = packed.panel(pc, jr);
+            for (size_t p = 0; p < kc; p++) {
+                for (size_t j = 0; j < packed.nr; j++) {
+                    const float expected = jr + j < packed.cols ? B[((pc + p) * ldb) + jr + j] : 0.0f;
+                    wrong += panel[(p * packed.nr) + j] != expected;
+                }
+            }
+        }
+    }
+    return wrong == 0;
+}
+
+static bool throws(size_t M, size_t N, size_t K, const float* A, const NGemm::CPackedB& B, float* C) {
+    try {
+        NGemm::sgemm(M, N, K, 1.0f, A, K, B, 0.0f, C, N, false);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    const size_t             K = 77, N = 45, ldb = N + 4;
+    const NGemm::SBlockSizes blocks{.mc = 16, .kc = 20, .nc = 30};
+    NCommon::MatrixBuffer    B = NCommon::generateRandomMatrix(K, ldb, 7);
+
+    for (bool parallel : {false, true}) {
+        const NGemm::CPackedB packed(B.data(), K, N, ldb, blocks, parallel);
+        CHECK(packed.nr == NGemm::activeKernel().nr);
+        CHECK(packed.paddedCols % packed.nr == 0 && packed.paddedCols >= N && packed.paddedCols < N + packed.nr);
+        CHECK(packed.blocks.nc % packed.nr == 0);
+        CHECK(layoutMatches(packed, B.data(), ldb));
+    }
+
+    // Packing widens fp16 and bf16 to the fp32 values the rounded inputs stand for
+    std::vector<NCommon::SFloat16>  half(B.size());
+    std::vector<NCommon::SBFloat16> brain(B.size());
+    NCommon::MatrixBuffer           widened(B.size());
+    NCommon::narrow(B, half);
+    NCommon::widen(half, widened);
+    CHECK(layoutMatches(NGemm::CPackedB(half.data(), K, N, ldb, blocks, true), widened.data(), ldb));
+    NCommon::narrow(B, brain);
+    NCommon::widen(brain, widened);
+    CHECK(layoutMatches(NGemm::CPackedB(brain.data(), K, N, ldb, blocks, true), widened.data(), ldb));
+
+    // A B packed once gives every A, of any height, bit for bit what sgemm packing B itself gives
+    const NGemm::CPackedB packed(B.data(), K, N, ldb, blocks, true);
+    for (size_t M : {1, 16, 53}) {
+        NCommon::MatrixBuffer A = NCommon::generateRandomMatrix(M, K, 8 + M);
+        NCommon::MatrixBuffer reused(M * N), fresh(M * N);
+        NGemm::sgemm(M, N, K, 2.0f, A.data(), K, packed, 0.0f, reused.data(), N, true);
+        NGemm::sgemm(M, N, K, 2.0f, A.data(), K, B.data(), ldb, 0.0f, fresh.data(), N, blocks, true);
+        CHECK(std::ranges::equal(reused, fresh));
+    }
+
+    // A packed B only multiplies the shape it was packed for
+    NCommon::MatrixBuffer A = NCommon::generateRandomMatrix(4, K + 1, 9);
+    NCommon::MatrixBuffer C(4 * (N + 1));
+    CHECK(throws(4, N, K + 1, A.data(), packed, C.data()));
+    CHECK(throws(4, N + 1, K, A.data(), packed, C.data()));
+    return NTest::result();
+}
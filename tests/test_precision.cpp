@@ -0,0 +1,158 @@
+#include "check.hpp"
+#include "common.hpp"
+#include "precision.hpp"
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// fp16 and bf16 rounding at the places it goes wrong: ties, the subnormal range, overflow into infinity and NaNs.
+// The bulk conversions, F16C where the CPU has it, have to produce the same bits as the scalar reference.
+
+static uint16_t half(uint32_t bits) {
+    return NCommon::toFloat16(std::bit_cast<float>(bits)).bits;
+}
+
+static uint16_t half(float value) {
+    return NCommon::toFloat16(value).bits;
+}
+
+static uint16_t bfloat(uint32_t bits) {
+    return NCommon::toBFloat16(std::bit_cast<float>(bits)).bits;
+}
+
+static uint32_t widened(uint16_t bits) {
+    return std::bit_cast<uint32_t>(NCommon::toFloat(NCommon::SFloat16{bits}));
+}
+
+static void checkFloat16() {
+    CHECK(half(1.0f) == 0x3C00);
+    CHECK(half(-2.0f) == 0xC000);
+    CHECK(half(-0.0f) == 0x8000);
+    // Halfway between two halves goes to the even one, anything past halfway rounds up
+    CHECK(half(1.0f + 0x1p-11f) == 0x3C00);
+    CHECK(half(1.0f + 0x3p-11f) == 0x3C02);
+    CHECK(half(0x3F801001u) == 0x3C01);
+    CHECK(half(0x3F800FFFu) == 0x3C00);
+    // A carry out of the mantissa moves into the exponent
+    CHECK(half(2.0f - 0x1p-12f) == 0x4000);
+
+    // Largest finite half, the last value still rounding down to it, and the first one overflowing
+    CHECK(half(65504.0f) == 0x7BFF);
+    CHECK(half(std::nextafter(65520.0f, 0.0f)) == 0x7BFF);
+    CHECK(half(65520.0f) == 0x7C00);
+    CHECK(half(-1e10f) == 0xFC00);
+    CHECK(half(std::numeric_limits<float>::infinity()) == 0x7C00);
+    CHECK(half(-std::numeric_limits<float>::infinity()) == 0xFC00);
+
+    // Subnormals are steps of 2^-24 with the same ties to even, and the largest one rounds up into the normals
+    CHECK(half(0x1p-24f) == 0x0001);
+    CHECK(half(0x1p-25f) == 0x0000);
+    CHECK(half(std::nextafter(0x1p-25f, 1.0f)) == 0x0001);
+    CHECK(half(0x3p-25f) == 0x0002);
+    CHECK(half(-0x1p-24f) == 0x8001);
+    CHECK(half(1023.0f * 0x1p-24f) == 0x03FF);
+    CHECK(half(1023.5f * 0x1p-24f) == 0x0400);
+    CHECK(half(0x1p-14f) == 0x0400);
+    CHECK(half(0x1p-30f) == 0x0000);
+
+    // NaNs stay NaN and quiet, keeping the top of their payload, even when only low payload bits were set
+    CHECK(half(std::numeric_limits<float>::quiet_NaN()) == 0x7E00);
+    CHECK(half(0x7F800001u) == 0x7E00);
+    CHECK(half(0x7F802000u) == 0x7E01);
+    CHECK(half(0xFFC00000u) == 0xFE00);
+
+    CHECK(widened(0x0001) == std::bit_cast<uint32_t>(0x1p-24f));
+    CHECK(widened(0x8000) == 0x80000000u);
+    CHECK(widened(0x7C00) == 0x7F800000u);
+    CHECK(widened(0x7D00) == 0x7FE00000u);
+    CHECK(widened(0x7E01) == 0x7FC02000u);
+
+    // Every finite or infinite half survives a trip through fp32 unchanged
+    size_t changed = 0;
+    for (uint32_t bits = 0; bits <= 0xFFFF; bits++) {
+        if ((bits & 0x7C00) != 0x7C00 || (bits & 0x03FF) == 0)
+            changed += half(widened(static_cast<uint16_t>(bits))) != bits;
+    }
+    CHECK(changed == 0);
+}
+
+static void checkBFloat16() {
+    CHECK(bfloat(std::bit_cast<uint32_t>(1.0f)) == 0x3F80);
+    CHECK(bfloat(0x3F808000u) == 0x3F80);
+    CHECK(bfloat(0x3F818000u) == 0x3F82);
+    CHECK(bfloat(0x3F808001u) == 0x3F81);
+    CHECK(bfloat(0x3F807FFFu) == 0x3F80);
+    CHECK(bfloat(0x3FFF8000u) == 0x4000);
+    // The largest floats round up into infinity, infinity stays
+    CHECK(bfloat(0x7F7FFFFFu) == 0x7F80);
+    CHECK(bfloat(0x7F7F7FFFu) == 0x7F7F);
+    CHECK(bfloat(0x7F800000u) == 0x7F80);
+    CHECK(bfloat(0xFF800000u) == 0xFF80);
+    // fp32 subnormals round like any other value
+    CHECK(bfloat(0x00008000u) == 0x0000);
+    CHECK(bfloat(0x00018000u) == 0x0002);
+    CHECK(bfloat(0x80008001u) == 0x8001);
+    // A NaN whose payload sits only in the low half must not truncate to infinity
+    CHECK(bfloat(0x7F800001u) == 0x7FC0);
+    CHECK(std::isnan(NCommon::toFloat(NCommon::SBFloat16{bfloat(0xFF800001u)})));
+
+    size_t changed = 0;
+    for (uint32_t bits = 0; bits <= 0xFFFF; bits++) {
+        const float value = NCommon::toFloat(NCommon::SBFloat16{static_cast<uint16_t>(bits)});
+        if (!std::isnan(value))
+            changed += NCommon::toBFloat16(value).bits != bits;
+    }
+    CHECK(changed == 0);
+}
+
+// Every sign, exponent and upper mantissa combination with the low bits set around the rounding points, plus
+// scattered values, through both the bulk and the scalar conversions
+static void checkBulk() {
+    std::vector<float> values;
+    for (uint32_t high = 0; high < (1u << 18); high++) {
+        for (uint32_t low : {0x0000u, 0x0001u, 0x0FFFu, 0x1000u, 0x1001u, 0x1FFFu, 0x2000u, 0x3FFFu}) {
+            values.push_back(std::bit_cast<float>((high << 14) | low));
+        }
+    }
+    for (uint64_t i = 0; i < (1u << 20); i++) {
+        values.push_back(std::bit_cast<float>(static_cast<uint32_t>(NCommon::mix64(i))));
+    }
+
+    std::vector<NCommon::SFloat16>  halves(values.size());
+    std::vector<NCommon::SBFloat16> bfloats(values.size());
+    NCommon::narrow(values, halves);
+    NCommon::narrow(values, bfloats);
+    size_t halfMismatches = 0, bfloatMismatches = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+        halfMismatches += halves[i].bits != NCommon::toFloat16(values[i]).bits;
+        bfloatMismatches += bfloats[i].bits != NCommon::toBFloat16(values[i]).bits;
+    }
+    CHECK(halfMismatches == 0);
+    CHECK(bfloatMismatches == 0);
+
+    std::vector<NCommon::SFloat16>  allHalves(1u << 16);
+    std::vector<NCommon::SBFloat16> allBfloats(1u << 16);
+    std::vector<float>              fromHalves(allHalves.size());
+    std::vector<float>              fromBfloats(allBfloats.size());
+    for (uint32_t bits = 0; bits <= 0xFFFF; bits++) {
+        allHalves[bits].bits  = static_cast<uint16_t>(bits);
+        allBfloats[bits].bits = static_cast<uint16_t>(bits);
+    }
+    NCommon::widen(allHalves, fromHalves);
+    NCommon::widen(allBfloats, fromBfloats);
+    size_t widenMismatches = 0;
+    for (uint32_t bits = 0; bits <= 0xFFFF; bits++) {
+        widenMismatches += std::bit_cast<uint32_t>(fromHalves[bits]) != std::bit_cast<uint32_t>(NCommon::toFloat(allHalves[bits]));
+        widenMismatches += std::bit_cast<uint32_t>(fromBfloats[bits]) != std::bit_cast<uint32_t>(NCommon::toFloat(allBfloats[bits]));
+    }
+    CHECK(widenMismatches == 0);
+}
+
+int main() {
+    checkFloat16();
+    checkBFloat16();
+    checkBulk();
+    return NTest::result();
+}
@@ -0,0 +1,62 @@
+#include "check.hpp"
+#include "reference.hpp"
+#include "common.hpp"
+#include "strassen.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Strassen-Winograd against a double precision reference. Its error grows with the recursion depth, so the bound is
+// looser than sgemm's but still far below anything a wrong quadrant combination would produce.
+
+static void checkStrassen(size_t M, size_t N, size_t K, size_t cutover, size_t expectedDepth, bool parallel) {
+    const size_t          lda = K + 1, ldb = N + 3, ldc = N + 2;
+    NCommon::MatrixBuffer A = NCommon::generateRandomMatrix(M, lda, 21);
+    NCommon::MatrixBuffer B = NCommon::generateRandomMatrix(K, ldb, 22);
+    NCommon::MatrixBuffer C(M * ldc, 0.0f);
+
+    std::vector<double> product, bound;
+    NTest::referenceGemm(M, N, K, 1.0, A.data(), lda, B.data(), ldb, 0.0, C.data(), ldc, product, bound);
+
+    NGemm::CStrassen strassen(NGemm::SBlockSizes{}, cutover);
+    strassen.multiply(M, N, K, A.data(), lda, B.data(), ldb, C.data(), ldc, parallel);
+    CHECK(strassen.depth == expectedDepth);
+
+    // Relative error in the Frobenius norm, and the largest element error against that element's magnitude
+    double error = 0, norm = 0, worst = 0;
+    for (size_t i = 0; i < M; i++) {
+        for (size_t j = 0; j < N; j++) {
+            const double difference = C[(i * ldc) + j] - product[(i * N) + j];
+            error += difference * difference;
+            norm += product[(i * N) + j] * product[(i * N) + j];
+            worst = std::max(worst, std::fabs(difference) / bound[(i * N) + j]);
+        }
+    }
+    const double relative = std::sqrt(error / norm);
+    std::printf("%zux%zux%zu cutover %zu: depth %zu, relative Frobenius error %g, worst element %g of its magnitude\n", M, N, K, cutover, strassen.depth, relative, worst);
+    CHECK(relative < 1e-6);
+    CHECK(worst < 1e-5);
+}
+
+// The leaves multiply through caller-owned packing space, which has to give what sgemm allocating its own does
+static bool workspaceMatches(size_t M, size_t N, size_t K) {
+    const NGemm::SBlockSizes blocks{.mc = 16, .kc = 24, .nc = 40};
+    NCommon::MatrixBuffer    A = NCommon::generateRandomMatrix(M, K, 23);
+    NCommon::MatrixBuffer    B = NCommon::generateRandomMatrix(K, N, 24);
+    NCommon::MatrixBuffer    packedA(NGemm::packedAFloats(blocks)), packedB(NGemm::CPackedB::floats(K, N));
+    NCommon::MatrixBuffer    own(M * N), shared(M * N);
+    NGemm::sgemm(M, N, K, 1.0f, A.data(), K, B.data(), N, 0.0f, own.data(), N, blocks, false);
+    NGemm::sgemm(M, N, K, 1.0f, A.data(), K, B.data(), N, 0.0f, shared.data(), N, blocks, NGemm::SGemmWorkspace{.packedA = packedA.data(), .packedB = packedB.data()});
+    return std::ranges::equal(own, shared);
+}
+
+int main() {
+    CHECK(workspaceMatches(37, 53, 61));
+    CHECK(workspaceMatches(64, 64, 64));
+    checkStrassen(256, 256, 256, 32, 3, false);
+    checkStrassen(256, 256, 256, 32, 3, true);
+    // Odd dimensions leave a row, column or slice to peel at every level
+    checkStrassen(301, 257, 199, 48, 3, true);
+    // At or below the cutover the classical kernel runs alone
+    checkStrassen(64, 64, 64, 64, 0, false);
+    return NTest::result();
+}
@@ -0,0 +1,81 @@
+#include "check.hpp"
+#include "common.hpp"
+#include "gemm.hpp"
+#include "precision.hpp"
+#include "verify.hpp"
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+
+// Freivalds has to accept the products the kernels really produce, rounding and all, and reject a product with a
+// single element off by a small fraction of its value wherever that element sits.
+
+struct SProblem {
+    size_t                M, N, K;
+    size_t                lda, ldb, ldc;
+    NCommon::MatrixBuffer A, B, C;
+};
+
+static SProblem makeProblem(size_t M, size_t N, size_t K, NCommon::EPrecision precision) {
+    SProblem problem{.M = M, .N = N, .K = K, .lda = K + 1, .ldb = N + 2, .ldc = N + 3};
+    problem.A = NCommon::generateRandomMatrix(M, problem.lda, 31);
+    problem.B = NCommon::generateRandomMatrix(K, problem.ldb, 32);
+    problem.C = NCommon::MatrixBuffer(M * problem.ldc, 0.0f);
+
+    // Reduced precision runs multiply the rounded inputs, but are verified against the fp32 ones
+    const NGemm::SBlockSizes blocks;
+    if (precision == NCommon::EPrecision::Float16) {
+        std::vector<NCommon::SFloat16> A(problem.A.size()), B(problem.B.size());
+        NCommon::narrow(problem.A, A);
+        NCommon::narrow(problem.B, B);
+        NGemm::sgemm(M, N, K, 1.0f, A.data(), problem.lda, B.data(), problem.ldb, 0.0f, problem.C.data(), problem.ldc, blocks, true);
+    } else if (precision == NCommon::EPrecision::BFloat16) {
+        std::vector<NCommon::SBFloat16> A(problem.A.size()), B(problem.B.size());
+        NCommon::narrow(problem.A, A);
+        NCommon::narrow(problem.B, B);
+        NGemm::sgemm(M, N, K, 1.0f, A.data(), problem.lda, B.data(), problem.ldb, 0.0f, problem.C.data(), problem.ldc, blocks, true);
+    } else {
+        NGemm::sgemm(M, N, K, 1.0f, problem.A.data(), problem.lda, problem.B.data(), problem.ldb, 0.0f, problem.C.data(), problem.ldc, blocks, true);
+    }
+    return problem;
+}
+
+static NCommon::SVerifyReport verify(const SProblem& problem, NCommon::EPrecision precision, uint64_t seed = 1) {
+    return NCommon::verifyProduct(problem.M, problem.N, problem.K, problem.A.data(), problem.lda, problem.B.data(), problem.ldb, problem.C.data(), problem.ldc, precision,
+                                  seed);
+}
+
+int main() {
+    for (NCommon::EPrecision precision : {NCommon::EPrecision::Float32, NCommon::EPrecision::Float16, NCommon::EPrecision::BFloat16}) {
+        SProblem problem = makeProblem(97, 131, 517, precision);
+        for (uint64_t seed = 1; seed <= 4; seed++) {
+            const NCommon::SVerifyReport report = verify(problem, precision, seed);
+            std::printf("%s seed %llu: worst row %zu at %g of its bound\n", NCommon::toString(precision), static_cast<unsigned long long>(seed), report.worstRow,
+                        report.worstRatio);
+            CHECK(report.passed);
+            CHECK(report.worstRatio < 1.0);
+        }
+    }
+
+    // One element off by 1%, in a corner, on an edge and in the middle, has to fail and be pinned to its row
+    SProblem     problem = makeProblem(97, 131, 517, NCommon::EPrecision::Float32);
+    const size_t rows[]  = {0, 0, 96, 48, 96};
+    const size_t cols[]  = {0, 130, 0, 65, 130};
+    for (size_t i = 0; i < std::size(rows); i++) {
+        float&      element = problem.C[(rows[i] * problem.ldc) + cols[i]];
+        const float saved   = element;
+        element             = saved * 1.01f;
+        const NCommon::SVerifyReport report = verify(problem, NCommon::EPrecision::Float32);
+        std::printf("C[%zu][%zu] off by 1%%: worst row %zu at %g of its bound\n", rows[i], cols[i], report.worstRow, report.worstRatio);
+        CHECK(!report.passed);
+        CHECK(report.worstRow == rows[i]);
+        element = saved;
+    }
+
+    // The padding past each row of C is not part of the product and must not be looked at
+    for (size_t row = 0; row < problem.M; row++) {
+        problem.C[(row * problem.ldc) + problem.N] = std::nanf("");
+    }
+    CHECK(verify(problem, NCommon::EPrecision::Float32).passed);
+    return NTest::result();
+}